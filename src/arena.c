@@ -0,0 +1,93 @@
+#include "arena.h"
+
+#include <stdlib.h>
+
+#ifdef _WIN32
+#  include <windows.h>
+
+// Large pages need SeLockMemoryPrivilege to be enabled in the process token, not only granted to the account.
+static bool enable_lock_memory_privilege(void) {
+  HANDLE token = NULL;
+  if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES, &token)) {
+    return false;
+  }
+  TOKEN_PRIVILEGES tp = {.PrivilegeCount = 1};
+  tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+  // AdjustTokenPrivileges succeeds with ERROR_NOT_ALL_ASSIGNED when the account does not hold the privilege
+  bool const r = LookupPrivilegeValueW(NULL, SE_LOCK_MEMORY_NAME, &tp.Privileges[0].Luid) &&
+                 AdjustTokenPrivileges(token, FALSE, &tp, 0, NULL, NULL) && GetLastError() == ERROR_SUCCESS;
+  CloseHandle(token);
+  return r;
+}
+
+static void *os_alloc(size_t *const size, bool *const large_pages) {
+  PROCESSOR_NUMBER pn;
+  USHORT node = 0;
+  GetCurrentProcessorNumberEx(&pn);
+  DWORD const preferred = GetNumaProcessorNodeEx(&pn, &node) ? node : NUMA_NO_PREFERRED_NODE;
+  HANDLE const process = GetCurrentProcess();
+
+  size_t const large = GetLargePageMinimum();
+  if (large != 0 && *size >= large && enable_lock_memory_privilege()) {
+    size_t const rounded = (*size + large - 1) / large * large;
+    void *const ptr =
+        VirtualAllocExNuma(process, NULL, rounded, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE, preferred);
+    if (ptr != NULL) {
+      *size = rounded;
+      *large_pages = true;
+      return ptr;
+    }
+  }
+  *large_pages = false;
+  return VirtualAllocExNuma(process, NULL, *size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, preferred);
+}
+
+static void os_free(void *const ptr) { VirtualFree(ptr, 0, MEM_RELEASE); }
+#else
+static void *os_alloc(size_t *const size, bool *const large_pages) {
+  *large_pages = false;
+  return aligned_alloc(arena_alignment, arena_aligned_size(*size));
+}
+
+static void os_free(void *const ptr) { free(ptr); }
+#endif
+
+bool arena_reserve(struct arena *const arena, size_t const size) {
+  if (size <= arena->size) {
+    arena_reset(arena);
+    return true;
+  }
+  size_t new_size = arena_aligned_size(size);
+  bool large_pages = false;
+  void *const ptr = os_alloc(&new_size, &large_pages);
+  if (ptr == NULL) {
+    arena_reset(arena);
+    return false;
+  }
+  arena_destroy(arena);
+  *arena = (struct arena){
+      .ptr = ptr,
+      .size = new_size,
+      .large_pages = large_pages,
+  };
+  return true;
+}
+
+void *arena_alloc(struct arena *const arena, size_t const size) {
+  size_t const aligned = arena_aligned_size(size);
+  if (aligned > arena->size - arena->used) {
+    return NULL;
+  }
+  void *const ptr = arena->ptr + arena->used;
+  arena->used += aligned;
+  return ptr;
+}
+
+void arena_reset(struct arena *const arena) { arena->used = 0; }
+
+void arena_destroy(struct arena *const arena) {
+  if (arena->ptr != NULL) {
+    os_free(arena->ptr);
+  }
+  *arena = (struct arena){0};
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "common.h"
+
+// Backing store for buffers that live as long as a session, such as tensors.
+// Memory is taken from the OS as one block, on large pages when the account may lock memory and on the NUMA node
+// of the calling thread, and is only returned when a larger block is needed or the arena is destroyed.
+// Allocations are carved out in order and released all at once, so once a process has seen its largest tile and
+// model shapes, later jobs and model reloads allocate no tensors.
+// Only the tensors of a session live here. Sources and destinations belong to the caller: the shared-memory and
+// pipe modes keep theirs across frames, but image files are decoded and encoded by stb_image and spng, which
+// allocate per image, so the sequence mode still allocates once per frame.
+struct arena {
+  uint8_t *ptr;
+  size_t size; // usable bytes
+  size_t used;
+  bool large_pages;
+};
+
+enum {
+  arena_alignment = 64,
+};
+
+// Bytes taken by an allocation of size, including the padding up to the next allocation.
+static inline size_t arena_aligned_size(size_t const size) {
+  return (size + arena_alignment - 1) / arena_alignment * arena_alignment;
+}
+
+// Makes room for at least size bytes and discards all allocations.
+// On failure the arena keeps its previous block.
+bool arena_reserve(struct arena *const arena, size_t const size);
+// Returns NULL when the arena is exhausted.
+void *arena_alloc(struct arena *const arena, size_t const size);
+void arena_reset(struct arena *const arena);
+void arena_destroy(struct arena *const arena);
@@ -0,0 +1,1716 @@
+#include "cli.h"
+
+#include <ovbase.h>
+#include <ovprintf.h>
+#include <ovthreads.h>
+#include <ovutil/win32.h>
+
+#include "hash.h"
+#include "image.h"
+#include "manifest.h"
+#include "mapping.h"
+#include "profile.h"
+#include "session.h"
+#include "shard.h"
+#include "stream.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static SR_CHAR_T const g_usage[] =
+    SR_TSTR("usage:\n")
+    SR_TSTR("  sr --rgb-model <name|path> [--alpha-model <name|path>] [--manifest <path>] [--device cpu|dml[:<id>]]\n")
+    SR_TSTR("     [--scale <factor>] [--tile-cache <tiles>] [--tile-cache-dir <dir>] [--warm-up <runs>]\n")
+    SR_TSTR("     [--alpha-mode straight|premultiply]\n")
+    SR_TSTR("     (--shm-source <name> --shm-destination <name> [--shm-previous-source <name>] --width <px> --height <px>\n")
+    SR_TSTR("      | --shm-jobs -)\n")
+    SR_TSTR("  sr --rgb-model <path> [options...] --input <pattern|-> --output <pattern|-> [--start-number <n>]\n")
+    SR_TSTR("     [--destination-file <path|temp>] [--bit-depth 8|16] [--npy-layout hwc|chw]\n")
+    SR_TSTR("  sr --rgb-model <path> [options...] --input - --output - [--stream-format rgba|y4m] [--queue <frames>]\n")
+    SR_TSTR("     [--width <px> --height <px>]\n")
+    SR_TSTR("  sr --rgb-model <name|path> [--alpha-model <name|path>] [--manifest <path>] [--device cpu|dml[:<id>]]\n")
+    SR_TSTR("     --autotune <px> [--profile <path>]\n")
+    SR_TSTR("  sr --rgb-model <name|path> [options...] --input <image> --output <shard> (--shard <i>/<n> | --tiles <x>,<y>,<w>,<h>)\n")
+    SR_TSTR("  sr --merge <shard pattern> --output <image> [--start-number <n>]\n")
+    SR_TSTR("\n")
+    SR_TSTR("  --rgb-model        model name from the manifest, or the path of an ONNX model with input/output tensors\n")
+    SR_TSTR("                     named \"input\" and \"output\".\n")
+    SR_TSTR("  --manifest         model manifest (default: models/models.json when it exists).\n")
+    SR_TSTR("  --scale            output scale such as 2, 1.5 or 3/2 (default: the scale of the model). Smaller scales than\n")
+    SR_TSTR("                     the model's are reduced per tile with an area filter; multiples of 1/8 only.\n")
+    SR_TSTR("  --tile-cache       keep up to <tiles> upscaled tiles in memory and reuse them for identical input tiles.\n")
+    SR_TSTR("  --tile-cache-dir   also store cached tiles in <dir> so that later runs can reuse them.\n")
+    SR_TSTR("  --warm-up          run the models <runs> times on blank tiles while the first image is read, so that its first\n")
+    SR_TSTR("                     tiles do not pay for the models' one-time setup.\n")
+    SR_TSTR("  --alpha-mode       premultiply runs the models on colour premultiplied by alpha, so that colour under transparent\n")
+    SR_TSTR("                     pixels does not bleed into edges; no separate edge bleed pass is needed (default: straight).\n")
+    SR_TSTR("  --shm-source       file mapping that holds width * height RGBA8 pixels.\n")
+    SR_TSTR("  --shm-destination  file mapping that receives (width * scale) * (height * scale) RGBA8 pixels, rounded down.\n")
+    SR_TSTR("  --shm-previous-source  optional file mapping with the source the destination was produced from;\n")
+    SR_TSTR("                     only tiles that changed since then are upscaled again and patched in place.\n")
+    SR_TSTR("                     mappings are opened by name, or by an inherited handle as \"handle:<value>\".\n")
+    SR_TSTR("                     such a run loads the models for its one job; use --shm-jobs to keep them loaded.\n")
+    SR_TSTR("  --shm-jobs         keep the models loaded and read jobs from stdin until it closes, one per line:\n")
+    SR_TSTR("                     <source> <destination> <width> <height> [<previous source>], mappings as above.\n")
+    SR_TSTR("                     each job is answered on stdout with a line of ok or error, the error itself goes to stderr.\n")
+    SR_TSTR("  --input            numbered image sequence such as frame%04d.png, or - to read frames from stdin. Tiles that\n")
+    SR_TSTR("                     did not change from the previous frame reuse its output, except for 16-bit or .npy output.\n")
+    SR_TSTR("  --output           numbered image sequence, or - to write frames to stdout.\n")
+    SR_TSTR("  --start-number     first frame number of an input sequence (default: the first of 0 to 4 that exists).\n")
+    SR_TSTR("  --destination-file keep the output in a memory-mapped file instead of memory, for outputs larger than RAM.\n")
+    SR_TSTR("                     <path> receives the last frame as raw RGBA8, RGBA16 with --bit-depth 16, or float32 in\n")
+    SR_TSTR("                     the --npy-layout for a .npy output; temp uses a sparse temporary file.\n")
+    SR_TSTR("  --bit-depth        16 reads and writes 16 bits per channel, e.g. 16-bit PNG (default: 8). Output must be PNG;\n")
+    SR_TSTR("                     frames are then always upscaled in full.\n")
+    SR_TSTR("  --npy-layout       an --output ending in .npy receives the float32 model output without 8-bit rounding, as\n")
+    SR_TSTR("                     arrays of height x width x 4 (hwc, default) or 4 x height x width (chw).\n")
+    SR_TSTR("  --stream-format    rgba (default) for raw RGBA8 frames of --width x --height, or y4m for a YUV4MPEG2 stream,\n")
+    SR_TSTR("                     e.g. ffmpeg -i in.mp4 -f rawvideo -pix_fmt rgba - | sr ... --input - --output -\n")
+    SR_TSTR("  --queue            frames buffered on each side while reading, upscaling and writing overlap (default: 4).\n")
+    SR_TSTR("  --autotune         time tile sizes, batch sizes and thread counts on a <px> x <px> test image and store the\n")
+    SR_TSTR("                     fastest in the tuning profile, which later runs and the GUI use for the same model and device.\n")
+    SR_TSTR("  --profile          tuning profile (default: %LOCALAPPDATA%\\sr\\profile.txt), none to use the built-in defaults.\n")
+    SR_TSTR("  --shard            upscale band <i> of <n> equal bands of tile rows of a large image and write its tiles to <shard>,\n")
+    SR_TSTR("                     so that workers can split one image; the model and options must be the same for every shard.\n")
+    SR_TSTR("  --tiles            upscale <w> x <h> tiles of the tile grid starting at column <x>, row <y> instead.\n")
+    SR_TSTR("  --merge            stitch the shards of a numbered pattern such as part%d.srs into one image, identical to a\n")
+    SR_TSTR("                     single run of sr on the whole image. Shards of another image, model or options are refused,\n")
+    SR_TSTR("                     and the image is assembled in a temporary file rather than in memory.\n");
+
+struct options {
+  SR_CHAR_T const *rgb_model;
+  SR_CHAR_T const *alpha_model;
+  SR_CHAR_T const *manifest;
+  struct session_provider provider;
+  size_t scale_numerator; // 0 for the scale of the model
+  size_t scale_denominator;
+  size_t tile_cache;
+  SR_CHAR_T const *tile_cache_dir;
+  size_t warm_up;
+  bool premultiply_alpha;
+  SR_CHAR_T const *shm_source;
+  SR_CHAR_T const *shm_destination;
+  SR_CHAR_T const *shm_previous_source;
+  bool shm_jobs; // read jobs from stdin instead of the three above
+  SR_CHAR_T const *input;
+  SR_CHAR_T const *output;
+  SR_CHAR_T const *destination_file; // NULL to keep the destination in memory, "temp" for a temporary file
+  size_t bit_depth;
+  bool npy_planar;
+  size_t start_number;
+  bool has_start_number;
+  enum stream_format stream_format;
+  size_t queue;
+  size_t width;
+  size_t height;
+  size_t autotune; // edge of the test image, 0 unless tuning
+  SR_CHAR_T const *profile;
+  size_t shard_index;
+  size_t shard_count; // 0 unless upscaling a shard
+  size_t tiles[4];    // x, y, columns and rows with has_tiles
+  bool has_tiles;
+  SR_CHAR_T const *merge;
+};
+
+static void attach_console(void) {
+  if (GetStdHandle(STD_ERROR_HANDLE) != NULL) {
+    return; // already redirected by the parent process
+  }
+  if (AttachConsole(ATTACH_PARENT_PROCESS)) {
+    FILE *f = NULL;
+    _wfreopen_s(&f, L"CONOUT$", L"w", stderr);
+  }
+}
+
+static bool parse_size(SR_CHAR_T const *const s, size_t *const v) {
+  SR_CHAR_T *end = NULL;
+  unsigned long long const n = wcstoull(s, &end, 10);
+  if (end == s || *end != SR_TSTR('\0') || n == 0 || n > SIZE_MAX) {
+    return false;
+  }
+  *v = (size_t)n;
+  return true;
+}
+
+// Accepts an integer, a decimal with up to 3 fractional digits or a fraction such as 3/2.
+static bool parse_scale(SR_CHAR_T const *const s, size_t *const numerator, size_t *const denominator) {
+  SR_CHAR_T *end = NULL;
+  unsigned long long num = wcstoull(s, &end, 10);
+  unsigned long long den = 1;
+  if (end == s || num > 1000) {
+    return false;
+  }
+  SR_CHAR_T const *p = end;
+  if (*p == SR_TSTR('/')) {
+    den = wcstoull(p + 1, &end, 10);
+    if (end == p + 1 || den == 0 || den > 1000) {
+      return false;
+    }
+    p = end;
+  } else if (*p == SR_TSTR('.')) {
+    for (++p; *p >= SR_TSTR('0') && *p <= SR_TSTR('9') && den < 1000; ++p) {
+      num = num * 10 + (unsigned long long)(*p - SR_TSTR('0'));
+      den *= 10;
+    }
+    if (den == 1) {
+      return false;
+    }
+  }
+  if (*p != SR_TSTR('\0') || num == 0) {
+    return false;
+  }
+  *numerator = (size_t)num;
+  *denominator = (size_t)den;
+  return true;
+}
+
+static bool parse_provider(SR_CHAR_T const *const s, struct session_provider *const provider) {
+  if (wcscmp(s, SR_TSTR("cpu")) == 0) {
+    *provider = (struct session_provider){.type = PROVIDER_CPU};
+    return true;
+  }
+  if (wcsncmp(s, SR_TSTR("dml"), 3) != 0) {
+    return false;
+  }
+  int device_id = 0;
+  if (s[3] == SR_TSTR(':')) {
+    SR_CHAR_T *end = NULL;
+    long const n = wcstol(s + 4, &end, 10);
+    if (end == s + 4 || *end != SR_TSTR('\0') || n < 0 || n > INT32_MAX) {
+      return false;
+    }
+    device_id = (int)n;
+  } else if (s[3] != SR_TSTR('\0')) {
+    return false;
+  }
+  *provider = (struct session_provider){
+      .type = PROVIDER_DML,
+      .dml =
+          {
+              .device_id = device_id,
+          },
+  };
+  return true;
+}
+
+// Parses n values separated by sep, zero included.
+static bool parse_sizes(SR_CHAR_T const *s, SR_CHAR_T const sep, size_t *const v, size_t const n) {
+  for (size_t i = 0; i < n; ++i) {
+    SR_CHAR_T *end = NULL;
+    unsigned long long const x = wcstoull(s, &end, 10);
+    if (end == s || x > SIZE_MAX || *end != (i + 1 < n ? sep : SR_TSTR('\0'))) {
+      return false;
+    }
+    v[i] = (size_t)x;
+    s = end + 1;
+  }
+  return true;
+}
+
+static bool parse_options(int const argc, SR_CHAR_T *const *const argv, struct options *const opts) {
+  *opts = (struct options){
+      .provider = {.type = PROVIDER_CPU},
+      .stream_format = stream_format_rgba,
+      .queue = 4,
+      .bit_depth = 8,
+  };
+  for (int i = 1; i < argc; ++i) {
+    SR_CHAR_T const *const name = argv[i];
+    SR_CHAR_T const *const value = i + 1 < argc ? argv[i + 1] : NULL;
+    if (value == NULL) {
+      return false;
+    }
+    if (wcscmp(name, SR_TSTR("--rgb-model")) == 0) {
+      opts->rgb_model = value;
+    } else if (wcscmp(name, SR_TSTR("--alpha-model")) == 0) {
+      opts->alpha_model = value;
+    } else if (wcscmp(name, SR_TSTR("--manifest")) == 0) {
+      opts->manifest = value;
+    } else if (wcscmp(name, SR_TSTR("--device")) == 0) {
+      if (!parse_provider(value, &opts->provider)) {
+        return false;
+      }
+    } else if (wcscmp(name, SR_TSTR("--scale")) == 0) {
+      if (!parse_scale(value, &opts->scale_numerator, &opts->scale_denominator)) {
+        return false;
+      }
+    } else if (wcscmp(name, SR_TSTR("--tile-cache")) == 0) {
+      if (!parse_size(value, &opts->tile_cache)) {
+        return false;
+      }
+    } else if (wcscmp(name, SR_TSTR("--tile-cache-dir")) == 0) {
+      opts->tile_cache_dir = value;
+    } else if (wcscmp(name, SR_TSTR("--warm-up")) == 0) {
+      if (!parse_size(value, &opts->warm_up)) {
+        return false;
+      }
+    } else if (wcscmp(name, SR_TSTR("--alpha-mode")) == 0) {
+      if (wcscmp(value, SR_TSTR("straight")) == 0) {
+        opts->premultiply_alpha = false;
+      } else if (wcscmp(value, SR_TSTR("premultiply")) == 0) {
+        opts->premultiply_alpha = true;
+      } else {
+        return false;
+      }
+    } else if (wcscmp(name, SR_TSTR("--shm-source")) == 0) {
+      opts->shm_source = value;
+    } else if (wcscmp(name, SR_TSTR("--shm-destination")) == 0) {
+      opts->shm_destination = value;
+    } else if (wcscmp(name, SR_TSTR("--shm-previous-source")) == 0) {
+      opts->shm_previous_source = value;
+    } else if (wcscmp(name, SR_TSTR("--shm-jobs")) == 0) {
+      if (wcscmp(value, SR_TSTR("-")) != 0) {
+        return false;
+      }
+      opts->shm_jobs = true;
+    } else if (wcscmp(name, SR_TSTR("--input")) == 0) {
+      opts->input = value;
+    } else if (wcscmp(name, SR_TSTR("--output")) == 0) {
+      opts->output = value;
+    } else if (wcscmp(name, SR_TSTR("--destination-file")) == 0) {
+      opts->destination_file = value;
+    } else if (wcscmp(name, SR_TSTR("--bit-depth")) == 0) {
+      if (!parse_size(value, &opts->bit_depth) || (opts->bit_depth != 8 && opts->bit_depth != 16)) {
+        return false;
+      }
+    } else if (wcscmp(name, SR_TSTR("--npy-layout")) == 0) {
+      if (wcscmp(value, SR_TSTR("hwc")) == 0) {
+        opts->npy_planar = false;
+      } else if (wcscmp(value, SR_TSTR("chw")) == 0) {
+        opts->npy_planar = true;
+      } else {
+        return false;
+      }
+    } else if (wcscmp(name, SR_TSTR("--start-number")) == 0) {
+      SR_CHAR_T *end = NULL;
+      unsigned long long const n = wcstoull(value, &end, 10);
+      // the range of ffmpeg's image2 demuxer, which also keeps number + frames from wrapping
+      if (end == value || *end != SR_TSTR('\0') || n > INT_MAX) {
+        return false;
+      }
+      opts->start_number = (size_t)n;
+      opts->has_start_number = true;
+    } else if (wcscmp(name, SR_TSTR("--stream-format")) == 0) {
+      if (wcscmp(value, SR_TSTR("rgba")) == 0) {
+        opts->stream_format = stream_format_rgba;
+      } else if (wcscmp(value, SR_TSTR("y4m")) == 0) {
+        opts->stream_format = stream_format_y4m;
+      } else {
+        return false;
+      }
+    } else if (wcscmp(name, SR_TSTR("--queue")) == 0) {
+      if (!parse_size(value, &opts->queue)) {
+        return false;
+      }
+    } else if (wcscmp(name, SR_TSTR("--width")) == 0) {
+      if (!parse_size(value, &opts->width)) {
+        return false;
+      }
+    } else if (wcscmp(name, SR_TSTR("--height")) == 0) {
+      if (!parse_size(value, &opts->height)) {
+        return false;
+      }
+    } else if (wcscmp(name, SR_TSTR("--autotune")) == 0) {
+      if (!parse_size(value, &opts->autotune)) {
+        return false;
+      }
+    } else if (wcscmp(name, SR_TSTR("--profile")) == 0) {
+      opts->profile = value;
+    } else if (wcscmp(name, SR_TSTR("--shard")) == 0) {
+      size_t v[2];
+      if (!parse_sizes(value, SR_TSTR('/'), v, 2) || v[1] == 0 || v[0] >= v[1]) {
+        return false;
+      }
+      opts->shard_index = v[0];
+      opts->shard_count = v[1];
+    } else if (wcscmp(name, SR_TSTR("--tiles")) == 0) {
+      if (!parse_sizes(value, SR_TSTR(','), opts->tiles, 4) || opts->tiles[2] == 0 || opts->tiles[3] == 0) {
+        return false;
+      }
+      opts->has_tiles = true;
+    } else if (wcscmp(name, SR_TSTR("--merge")) == 0) {
+      opts->merge = value;
+    } else {
+      return false;
+    }
+    ++i;
+  }
+  if (opts->alpha_model == NULL) {
+    opts->alpha_model = opts->rgb_model;
+  }
+  if (opts->tile_cache_dir != NULL && opts->tile_cache == 0) {
+    opts->tile_cache = 64;
+  }
+  if (opts->merge) {
+    return opts->output != NULL && opts->input == NULL;
+  }
+  if (opts->rgb_model == NULL) {
+    return false;
+  }
+  if (opts->shard_count || opts->has_tiles) {
+    // one image in, one shard out
+    return !(opts->shard_count && opts->has_tiles) && opts->input != NULL && opts->output != NULL &&
+           wcscmp(opts->input, SR_TSTR("-")) != 0 && wcscmp(opts->output, SR_TSTR("-")) != 0 && opts->bit_depth == 8;
+  }
+  if (opts->autotune) {
+    return opts->input == NULL && opts->output == NULL && opts->shm_source == NULL && !opts->shm_jobs;
+  }
+  if (opts->input != NULL || opts->output != NULL) {
+    if (opts->input == NULL || opts->output == NULL) {
+      return false;
+    }
+    if (wcscmp(opts->input, SR_TSTR("-")) != 0) {
+      return true;
+    }
+    if (opts->bit_depth != 8) {
+      return false; // only image sequences carry 16-bit frames
+    }
+    // pipe mode always writes the same stream format to stdout
+    return wcscmp(opts->output, SR_TSTR("-")) == 0 &&
+           (opts->stream_format == stream_format_y4m || (opts->width != 0 && opts->height != 0));
+  }
+  if (opts->shm_jobs) {
+    // every job brings its own mappings and size
+    return opts->shm_source == NULL && opts->shm_destination == NULL && opts->shm_previous_source == NULL && opts->width == 0 &&
+           opts->height == 0 && opts->bit_depth == 8;
+  }
+  return opts->shm_source != NULL && opts->shm_destination != NULL && opts->width != 0 && opts->height != 0 && opts->bit_depth == 8;
+}
+
+// a manifest entry wins over a file of the same name
+static SR_CHAR_T const *model_path(struct model_manifest const *const manifest, SR_CHAR_T const *const model) {
+  struct model_info const *const m = manifest_find(manifest, model);
+  return m ? m->path : model;
+}
+
+static struct session_options model_options(struct model_manifest const *const manifest,
+                                            SR_CHAR_T const *const model,
+                                            struct session_provider const *const provider) {
+  struct model_info const *const m = manifest_find(manifest, model);
+  return (struct session_options){
+      .provider = *provider,
+      .input_name = m ? m->input_name : NULL,
+      .output_name = m ? m->output_name : NULL,
+      .scale = m ? m->scale : 0,
+      .channels = m ? m->channels : 0,
+      .fp16 = m ? m->fp16 : (bool)USE_HALF,
+      .file =
+          {
+              .path = model_path(manifest, model),
+          },
+  };
+}
+
+static error load_model(struct session *const session,
+                        struct model_manifest const *const manifest,
+                        SR_CHAR_T const *const model,
+                        struct session_provider const *const provider,
+                        bool const alpha) {
+  struct session_options const opts = model_options(manifest, model, provider);
+  SR_CHAR_T const *const path = opts.file.path;
+  if (alpha) {
+    if (!session_load_alpha_model(session, &opts)) {
+      return emsg_i18nf(
+          err_type_generic, err_fail, NULL, "failed to load Alpha model(%1$ls): %2$ls", path, session_get_last_error(session));
+    }
+  } else {
+    if (!session_load_rgb_model(session, &opts)) {
+      return emsg_i18nf(
+          err_type_generic, err_fail, NULL, "failed to load RGB model(%1$ls): %2$ls", path, session_get_last_error(session));
+    }
+  }
+  return eok();
+}
+
+static error load_manifest(struct options const *const opts, struct model_manifest *const manifest) {
+  SR_CHAR_T error_msg[256] = {0};
+  SR_CHAR_T const *const manifest_path = opts->manifest ? opts->manifest : MANIFEST_DEFAULT_PATH;
+  if ((opts->manifest || GetFileAttributesW(manifest_path) != INVALID_FILE_ATTRIBUTES) &&
+      !manifest_load(manifest, manifest_path, error_msg)) {
+    return emsg_i18nf(err_type_generic, err_fail, NULL, "%ls", error_msg);
+  }
+  return eok();
+}
+
+// Returns false when no profile is used.
+static bool get_profile_path(struct options const *const opts, SR_CHAR_T path[MAX_PATH]) {
+  if (opts->profile == NULL) {
+    return profile_get_default_path(path, MAX_PATH);
+  }
+  if (wcscmp(opts->profile, SR_TSTR("none")) == 0 || wcslen(opts->profile) >= MAX_PATH) {
+    return false;
+  }
+  wcscpy(path, opts->profile);
+  return true;
+}
+
+// Applies the tuning stored by --autotune for the RGB model on this device, if any.
+static error apply_profile(struct options const *const opts, struct model_manifest const *const manifest, struct session *const session) {
+  SR_CHAR_T error_msg[256] = {0};
+  SR_CHAR_T path[MAX_PATH];
+  struct profile profile = {0};
+  error err = eok();
+  if (!get_profile_path(opts, path)) {
+    return eok();
+  }
+  if (!profile_load(&profile, path, error_msg)) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "%ls", error_msg);
+    goto cleanup;
+  }
+  struct profile_entry const *const e = profile_find(&profile, model_path(manifest, opts->rgb_model), &opts->provider);
+  if (e != NULL && !session_set_tuning(session, &e->tuning)) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "invalid tuning profile(%1$ls): %2$ls", path, session_get_last_error(session));
+    goto cleanup;
+  }
+cleanup:
+  profile_free(&profile);
+  return err;
+}
+
+static error open_session(struct options const *const opts, struct session **const sessionp) {
+  SR_CHAR_T error_msg[256] = {0};
+  struct model_manifest manifest = {0};
+  error err = eok();
+  struct session *session = NULL;
+
+  err = load_manifest(opts, &manifest);
+  if (efailed(err)) {
+    err = ethru(err);
+    goto cleanup;
+  }
+
+  session = session_create(error_msg);
+  if (session == NULL) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "%ls", error_msg);
+    goto cleanup;
+  }
+  err = apply_profile(opts, &manifest, session);
+  if (efailed(err)) {
+    err = ethru(err);
+    goto cleanup;
+  }
+  {
+    // both models are built at the same time
+    struct session_options const rgb = model_options(&manifest, opts->rgb_model, &opts->provider);
+    struct session_options const alpha = model_options(&manifest, opts->alpha_model, &opts->provider);
+    if (!session_load_models_async(session, &rgb, &alpha, NULL, NULL) || !session_wait_models(session)) {
+      err = emsg_i18nf(err_type_generic,
+                       err_fail,
+                       NULL,
+                       "failed to load models(%1$ls, %2$ls): %3$ls",
+                       rgb.file.path,
+                       alpha.file.path,
+                       session_get_last_error(session));
+      goto cleanup;
+    }
+  }
+  if (!session_set_output_scale(session, opts->scale_numerator, opts->scale_denominator)) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "invalid scale: %ls", session_get_last_error(session));
+    goto cleanup;
+  }
+  if (!session_set_tile_cache(session, opts->tile_cache, opts->tile_cache_dir)) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to set up tile cache: %ls", session_get_last_error(session));
+    goto cleanup;
+  }
+  // in the background, the caller reads its first image meanwhile
+  if (!session_warm_up(session, opts->warm_up, true)) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to warm up: %ls", session_get_last_error(session));
+    goto cleanup;
+  }
+  *sessionp = session;
+  session = NULL;
+cleanup:
+  if (session) {
+    session_destroy(session);
+  }
+  manifest_free(&manifest);
+  return err;
+}
+
+static void print_stats(struct session const *const session) {
+  struct session_stats stats;
+  session_get_stats(session, &stats);
+  SR_CHAR_T buf[256];
+  if (stats.tiles_unchanged) {
+    ov_snprintf(buf,
+                sizeof(buf) / sizeof(buf[0]),
+                NULL,
+                SR_TSTR("tiles: %zu upscaled, %zu reused from the previous frame\n"),
+                stats.tiles,
+                stats.tiles_unchanged);
+    fputws(buf, stderr);
+  }
+  if (stats.cold_run_us) {
+    // without --warm-up the warm figure is the first batch of the last frame
+    ov_snprintf(buf,
+                sizeof(buf) / sizeof(buf[0]),
+                NULL,
+                SR_TSTR("batch latency: %llu ms cold, %llu ms warm\n"),
+                (unsigned long long)(stats.cold_run_us / 1000),
+                (unsigned long long)((stats.warm_run_us ? stats.warm_run_us : stats.first_batch_us) / 1000));
+    fputws(buf, stderr);
+  }
+  if (stats.cache_hits + stats.cache_misses == 0) {
+    return;
+  }
+  ov_snprintf(buf,
+              sizeof(buf) / sizeof(buf[0]),
+              NULL,
+              SR_TSTR("tile cache: %zu hits, %zu misses (hit ratio %zu%%)\n"),
+              stats.cache_hits,
+              stats.cache_misses,
+              stats.cache_hits * 100 / (stats.cache_hits + stats.cache_misses));
+  fputws(buf, stderr);
+}
+
+static error get_output_size(
+    struct session *const session, size_t const width, size_t const height, size_t *const output_width, size_t *const output_height) {
+  if (!session_get_output_size(session, width, height, output_width, output_height)) {
+    return emsg_i18nf(err_type_generic, err_fail, NULL, "image is too large: %zux%zu", width, height);
+  }
+  return eok();
+}
+
+struct shm_job {
+  SR_CHAR_T const *source;
+  SR_CHAR_T const *destination;
+  SR_CHAR_T const *previous_source; // NULL if none
+  size_t width;
+  size_t height;
+};
+
+static error run_shm_job(struct session *const session, bool const premultiply_alpha, struct shm_job const *const job) {
+  struct mapping source = {0};
+  struct mapping destination = {0};
+  struct mapping previous_source = {0};
+  SR_CHAR_T error_msg[256] = {0};
+  error err = eok();
+
+  size_t output_width = 0, output_height = 0;
+  err = get_output_size(session, job->width, job->height, &output_width, &output_height);
+  if (efailed(err)) {
+    err = ethru(err);
+    goto cleanup;
+  }
+  size_t const source_size = job->width * job->height * 4;
+  size_t const destination_size = output_width * output_height * 4;
+
+  if (!mapping_open(&source, job->source, source_size, false, error_msg)) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to open source(%1$ls): %2$ls", job->source, error_msg);
+    goto cleanup;
+  }
+  if (!mapping_open(&destination, job->destination, destination_size, true, error_msg)) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to open destination(%1$ls): %2$ls", job->destination, error_msg);
+    goto cleanup;
+  }
+  if (job->previous_source != NULL && !mapping_open(&previous_source, job->previous_source, source_size, false, error_msg)) {
+    err = emsg_i18nf(
+        err_type_generic, err_fail, NULL, "failed to open previous source(%1$ls): %2$ls", job->previous_source, error_msg);
+    goto cleanup;
+  }
+
+  // inference reads and writes the caller's pages directly, no intermediate copies are made.
+  if (!session_inference(session,
+                         &(struct session_image){
+                             .width = job->width,
+                             .height = job->height,
+                             .channels = 4,
+                             .source = source.ptr,
+                             .destination = destination.ptr,
+                             .previous_source = previous_source.ptr,
+                             .premultiply_alpha = premultiply_alpha,
+                         })) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to inference: %ls", session_get_last_error(session));
+    goto cleanup;
+  }
+  print_stats(session);
+
+cleanup:
+  mapping_close(&previous_source);
+  mapping_close(&destination);
+  mapping_close(&source);
+  return err;
+}
+
+// Splits line at spaces and tabs in place into at most max fields; returns max + 1 if there are more.
+static size_t split_fields(SR_CHAR_T *line, SR_CHAR_T **const fields, size_t const max) {
+  size_t n = 0;
+  for (;;) {
+    while (*line == SR_TSTR(' ') || *line == SR_TSTR('\t') || *line == SR_TSTR('\r') || *line == SR_TSTR('\n')) {
+      *line++ = SR_TSTR('\0');
+    }
+    if (*line == SR_TSTR('\0')) {
+      return n;
+    }
+    if (n == max) {
+      return max + 1;
+    }
+    fields[n++] = line;
+    while (*line != SR_TSTR('\0') && *line != SR_TSTR(' ') && *line != SR_TSTR('\t') && *line != SR_TSTR('\r') &&
+           *line != SR_TSTR('\n')) {
+      ++line;
+    }
+  }
+}
+
+// Reads jobs from stdin until it closes, so that the models are loaded and set up once for all of them.
+// A failed job is reported and the next one is read; only a closed stdin ends the run.
+static void serve_shm_jobs(struct session *const session, bool const premultiply_alpha) {
+  SR_CHAR_T line[1024];
+  while (fgetws(line, sizeof(line) / sizeof(line[0]), stdin) != NULL) {
+    bool ok = false;
+    if (SR_STRCHR(line, SR_TSTR('\n')) == NULL && !feof(stdin)) {
+      // too long for any valid job, skip the rest of it
+      int c = 0;
+      while ((c = fgetc(stdin)) != EOF && c != '\n') {
+      }
+      fputws(SR_TSTR("job line is too long\n"), stderr);
+    } else {
+      SR_CHAR_T *fields[5] = {NULL};
+      size_t const n = split_fields(line, fields, 5);
+      if (n == 0) {
+        continue;
+      }
+      struct shm_job job = {
+          .source = fields[0],
+          .destination = fields[1],
+          .previous_source = n == 5 ? fields[4] : NULL,
+      };
+      if (n < 4 || n > 5 || !parse_size(fields[2], &job.width) || !parse_size(fields[3], &job.height)) {
+        fputws(SR_TSTR("invalid job, expected: <source> <destination> <width> <height> [<previous source>]\n"), stderr);
+      } else {
+        error err = run_shm_job(session, premultiply_alpha, &job);
+        if (efailed(err)) {
+          ereport(err);
+        } else {
+          ok = true;
+        }
+      }
+    }
+    fputws(ok ? SR_TSTR("ok\n") : SR_TSTR("error\n"), stdout);
+    fflush(stdout);
+  }
+}
+
+static error run_shm(struct options const *const opts) {
+  struct session *session = NULL;
+  error err = eok();
+
+  // the destination size depends on the scale of the models, so they are loaded first
+  err = open_session(opts, &session);
+  if (efailed(err)) {
+    err = ethru(err);
+    goto cleanup;
+  }
+  if (opts->shm_jobs) {
+    serve_shm_jobs(session, opts->premultiply_alpha);
+    goto cleanup;
+  }
+  err = run_shm_job(session,
+                    opts->premultiply_alpha,
+                    &(struct shm_job){
+                        .source = opts->shm_source,
+                        .destination = opts->shm_destination,
+                        .previous_source = opts->shm_previous_source,
+                        .width = opts->width,
+                        .height = opts->height,
+                    });
+  if (efailed(err)) {
+    err = ethru(err);
+    goto cleanup;
+  }
+
+cleanup:
+  if (session) {
+    session_destroy(session);
+    session = NULL;
+  }
+  return err;
+}
+
+static bool format_frame_path(SR_CHAR_T const *const pattern, size_t const number, SR_CHAR_T path[MAX_PATH]) {
+  // only a single %d, %0Nd or %Nd is recognized, everything else is copied verbatim
+  SR_CHAR_T const *p = SR_STRCHR(pattern, SR_TSTR('%'));
+  if (p == NULL) {
+    return false;
+  }
+  SR_CHAR_T const *q = p + 1;
+  bool zero = false;
+  if (*q == SR_TSTR('0')) {
+    zero = true;
+    ++q;
+  }
+  size_t width = 0;
+  while (*q >= SR_TSTR('0') && *q <= SR_TSTR('9')) {
+    width = width * 10 + (size_t)(*q++ - SR_TSTR('0'));
+  }
+  if (*q != SR_TSTR('d') || width > 32) {
+    return false;
+  }
+  SR_CHAR_T digits[64];
+  size_t len = 0;
+  size_t v = number;
+  do {
+    digits[len++] = (SR_CHAR_T)(SR_TSTR('0') + v % 10);
+    v /= 10;
+  } while (v);
+  size_t const prefix = (size_t)(p - pattern);
+  size_t const suffix = SR_STRLEN(q + 1);
+  size_t const pad = width > len ? width - len : 0;
+  if (prefix + pad + len + suffix + 1 > MAX_PATH) {
+    return false;
+  }
+  SR_CHAR_T *d = path;
+  memcpy(d, pattern, prefix * sizeof(SR_CHAR_T));
+  d += prefix;
+  for (size_t i = 0; i < pad; ++i) {
+    *d++ = zero ? SR_TSTR('0') : SR_TSTR(' ');
+  }
+  while (len) {
+    *d++ = digits[--len];
+  }
+  memcpy(d, q + 1, (suffix + 1) * sizeof(SR_CHAR_T));
+  return true;
+}
+
+static bool file_exists(SR_CHAR_T const *const path) { return GetFileAttributesW(path) != INVALID_FILE_ATTRIBUTES; }
+
+// Frames are kept as bytes, 16-bit frames hold uint16_t samples.
+// The decoder allocates every frame, see arena.h; the destination is reused across frames.
+static uint8_t *load_frame(SR_CHAR_T const *const path, bool const wide, size_t *const width, size_t *const height) {
+  return wide ? (uint8_t *)(void *)image_load16(path, width, height) : image_load(path, width, height);
+}
+
+static void free_frame(uint8_t *const frame, bool const wide) {
+  if (wide) {
+    image_free16((uint16_t *)(void *)frame);
+  } else {
+    image_free(frame);
+  }
+}
+
+static error run_sequence(struct options const *const opts) {
+  struct session *session = NULL;
+  uint8_t *frames[2] = {NULL};
+  uint8_t *destination = NULL;
+  struct mapping destination_mapping = {0};
+  struct stream output = {0};
+  size_t width = 0, height = 0;
+  size_t number = opts->start_number;
+  size_t count = 0;
+  SR_CHAR_T error_msg[256] = {0};
+  error err = eok();
+
+  bool const raw_output = wcscmp(opts->output, SR_TSTR("-")) == 0;
+  bool const wide = opts->bit_depth == 16;
+  SR_CHAR_T const *const ext = SR_STRRCHR(opts->output, SR_TSTR('.'));
+  bool const npy = !raw_output && ext != NULL && _wcsicmp(ext, SR_TSTR(".npy")) == 0;
+  size_t const sample_bytes = npy ? sizeof(float) : wide ? 2 : 1;
+  SR_CHAR_T path[MAX_PATH];
+
+  if (wide && raw_output) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "16-bit output must be written to an image sequence");
+    goto cleanup;
+  }
+
+  if (!opts->has_start_number) {
+    // same search range as ffmpeg's image2 demuxer
+    for (number = 0; number < 5; ++number) {
+      if (format_frame_path(opts->input, number, path) && file_exists(path)) {
+        break;
+      }
+    }
+  }
+  if (!format_frame_path(opts->input, number, path)) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "invalid input pattern: %ls", opts->input);
+    goto cleanup;
+  }
+  if (!raw_output && !format_frame_path(opts->output, number, path)) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "invalid output pattern: %ls", opts->output);
+    goto cleanup;
+  }
+
+  err = open_session(opts, &session);
+  if (efailed(err)) {
+    err = ethru(err);
+    goto cleanup;
+  }
+  size_t output_width = 0, output_height = 0;
+
+  for (;; ++number, ++count) {
+    uint8_t **const cur = &frames[count & 1];
+    uint8_t *const prev = frames[(count + 1) & 1];
+    size_t w = 0, h = 0;
+    format_frame_path(opts->input, number, path);
+    if (!file_exists(path)) {
+      break;
+    }
+    if (*cur) {
+      free_frame(*cur, wide);
+    }
+    *cur = load_frame(path, wide, &w, &h);
+    if (*cur == NULL) {
+      err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to load image: %ls", path);
+      goto cleanup;
+    }
+    if (count == 0) {
+      width = w;
+      height = h;
+    } else if (w != width || h != height) {
+      err = emsg_i18nf(err_type_generic, err_fail, NULL, "frame size changed: %ls", path);
+      goto cleanup;
+    }
+
+    if (destination == NULL) {
+      err = get_output_size(session, width, height, &output_width, &output_height);
+      if (efailed(err)) {
+        err = ethru(err);
+        goto cleanup;
+      }
+      if (opts->destination_file != NULL) {
+        SR_CHAR_T const *const file = wcscmp(opts->destination_file, SR_TSTR("temp")) == 0 ? NULL : opts->destination_file;
+        if (!mapping_create_file(&destination_mapping, file, output_width * output_height * 4 * sample_bytes, error_msg)) {
+          err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to create destination file: %ls", error_msg);
+          goto cleanup;
+        }
+        destination = destination_mapping.ptr;
+      } else {
+        destination = malloc(output_width * output_height * 4 * sample_bytes);
+        if (destination == NULL) {
+          err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to allocate destination buffer");
+          goto cleanup;
+        }
+      }
+      if (raw_output && !stream_open_output(&output,
+                                            GetStdHandle(STD_OUTPUT_HANDLE),
+                                            &(struct stream){.format = stream_format_rgba, .width = width, .height = height},
+                                            output_width,
+                                            output_height,
+                                            error_msg)) {
+        err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to open stdout: %ls", error_msg);
+        goto cleanup;
+      }
+    }
+
+    // the destination still holds the output of the previous frame, so unchanged tiles are carried forward
+    if (!session_inference(session,
+                           &(struct session_image){
+                               .width = width,
+                               .height = height,
+                               .channels = 4,
+                               .source = *cur,
+                               .destination = destination,
+                               .bits_per_channel = opts->bit_depth,
+                               .destination_format = npy ? (opts->npy_planar ? session_destination_f32_chw : session_destination_f32_hwc)
+                                                         : session_destination_rgba,
+                               .previous_source = count && !wide && !npy ? prev : NULL,
+                               .premultiply_alpha = opts->premultiply_alpha,
+                           })) {
+      err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to inference: %ls", session_get_last_error(session));
+      goto cleanup;
+    }
+
+    if (raw_output) {
+      if (!stream_write(&output, destination, error_msg)) {
+        err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to write frame %1$zu: %2$ls", count, error_msg);
+        goto cleanup;
+      }
+    } else {
+      format_frame_path(opts->output, number, path);
+      bool saved = false;
+      if (npy) {
+        saved = image_save_npy(path, (float const *)(void const *)destination, output_width, output_height, opts->npy_planar);
+      } else if (wide) {
+        saved = image_save16(path, (uint16_t const *)(void const *)destination, output_width, output_height);
+      } else {
+        saved = image_save(path, destination, output_width, output_height);
+      }
+      if (!saved) {
+        err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to save image: %ls", path);
+        goto cleanup;
+      }
+    }
+  }
+  if (count == 0) {
+    format_frame_path(opts->input, number, path);
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "no input frames found: %ls", path);
+    goto cleanup;
+  }
+  print_stats(session);
+
+cleanup:
+  if (session) {
+    session_destroy(session);
+    session = NULL;
+  }
+  stream_close(&output);
+  if (destination_mapping.ptr) {
+    mapping_close(&destination_mapping);
+  } else if (destination) {
+    free(destination);
+  }
+  for (size_t i = 0; i < 2; ++i) {
+    if (frames[i]) {
+      free_frame(frames[i], wide);
+    }
+  }
+  return err;
+}
+
+// Single-producer single-consumer ring of frame buffers.
+// The producer fills the slot returned by queue_begin_push and publishes it with queue_end_push,
+// the consumer keeps the slot returned by queue_begin_pop until queue_end_pop, so no frame is copied.
+struct frame_queue {
+  mtx_t mtx;
+  cnd_t cnd;
+  uint8_t **slots;
+  size_t capacity;
+  size_t head;
+  size_t count;
+  bool closed;  // the producer will not push any more frames
+  bool aborted; // either side gave up, waiting calls return NULL
+};
+
+static bool queue_init(struct frame_queue *const q, size_t const capacity, size_t const frame_bytes) {
+  *q = (struct frame_queue){
+      .capacity = capacity,
+  };
+  mtx_init(&q->mtx, mtx_plain);
+  cnd_init(&q->cnd);
+  q->slots = calloc(capacity, sizeof(uint8_t *));
+  if (q->slots == NULL) {
+    return false;
+  }
+  for (size_t i = 0; i < capacity; ++i) {
+    q->slots[i] = malloc(frame_bytes);
+    if (q->slots[i] == NULL) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void queue_destroy(struct frame_queue *const q) {
+  if (q->slots) {
+    for (size_t i = 0; i < q->capacity; ++i) {
+      if (q->slots[i]) {
+        free(q->slots[i]);
+      }
+    }
+    free(q->slots);
+    q->slots = NULL;
+  }
+  cnd_destroy(&q->cnd);
+  mtx_destroy(&q->mtx);
+}
+
+static uint8_t *queue_begin_push(struct frame_queue *const q) {
+  mtx_lock(&q->mtx);
+  while (q->count == q->capacity && !q->aborted) {
+    cnd_wait(&q->cnd, &q->mtx);
+  }
+  uint8_t *const slot = q->aborted ? NULL : q->slots[(q->head + q->count) % q->capacity];
+  mtx_unlock(&q->mtx);
+  return slot;
+}
+
+static void queue_end_push(struct frame_queue *const q) {
+  mtx_lock(&q->mtx);
+  ++q->count;
+  cnd_broadcast(&q->cnd);
+  mtx_unlock(&q->mtx);
+}
+
+static uint8_t *queue_begin_pop(struct frame_queue *const q) {
+  mtx_lock(&q->mtx);
+  while (q->count == 0 && !q->closed && !q->aborted) {
+    cnd_wait(&q->cnd, &q->mtx);
+  }
+  uint8_t *const slot = q->aborted || q->count == 0 ? NULL : q->slots[q->head];
+  mtx_unlock(&q->mtx);
+  return slot;
+}
+
+// When keep is not NULL the popped buffer is handed to the consumer and *keep takes its place in the ring.
+static void queue_end_pop(struct frame_queue *const q, uint8_t **const keep) {
+  mtx_lock(&q->mtx);
+  if (keep) {
+    uint8_t *const tmp = q->slots[q->head];
+    q->slots[q->head] = *keep;
+    *keep = tmp;
+  }
+  q->head = (q->head + 1) % q->capacity;
+  --q->count;
+  cnd_broadcast(&q->cnd);
+  mtx_unlock(&q->mtx);
+}
+
+static void queue_close(struct frame_queue *const q) {
+  mtx_lock(&q->mtx);
+  q->closed = true;
+  cnd_broadcast(&q->cnd);
+  mtx_unlock(&q->mtx);
+}
+
+static void queue_abort(struct frame_queue *const q) {
+  mtx_lock(&q->mtx);
+  q->aborted = true;
+  cnd_broadcast(&q->cnd);
+  mtx_unlock(&q->mtx);
+}
+
+// A pipe reader or writer thread that may be blocked in ReadFile/WriteFile when it has to be stopped.
+struct worker {
+  thrd_t thrd;
+  mtx_t mtx;
+  HANDLE thread; // real handle of the thread for CancelSynchronousIo
+  bool started;
+  bool done;
+  bool failed;
+  SR_CHAR_T error_msg[256];
+};
+
+static void worker_enter(struct worker *const w) {
+  HANDLE h = NULL;
+  DuplicateHandle(GetCurrentProcess(), GetCurrentThread(), GetCurrentProcess(), &h, 0, FALSE, DUPLICATE_SAME_ACCESS);
+  mtx_lock(&w->mtx);
+  w->thread = h;
+  mtx_unlock(&w->mtx);
+}
+
+static void worker_leave(struct worker *const w) {
+  mtx_lock(&w->mtx);
+  w->done = true;
+  mtx_unlock(&w->mtx);
+}
+
+// Waits for the worker to finish, cancelling blocking I/O when cancel is true.
+static void worker_join(struct worker *const w, bool const cancel) {
+  if (!w->started) {
+    return;
+  }
+  while (cancel) {
+    mtx_lock(&w->mtx);
+    bool const done = w->done;
+    HANDLE const h = w->thread;
+    mtx_unlock(&w->mtx);
+    if (done) {
+      break;
+    }
+    // the worker may not have entered the blocking call yet, so keep trying until it leaves
+    if (h) {
+      CancelSynchronousIo(h);
+    }
+    Sleep(10);
+  }
+  thrd_join(w->thrd, NULL);
+  w->started = false;
+}
+
+struct pipe_context {
+  struct stream input;
+  struct stream output;
+  struct frame_queue inputs;
+  struct frame_queue outputs;
+  struct worker reader;
+  struct worker writer;
+};
+
+static int reader_main(void *const userdata) {
+  struct pipe_context *const ctx = userdata;
+  worker_enter(&ctx->reader);
+  for (;;) {
+    uint8_t *const frame = queue_begin_push(&ctx->inputs);
+    if (frame == NULL) {
+      break;
+    }
+    bool eof = false;
+    if (!stream_read(&ctx->input, frame, &eof, ctx->reader.error_msg)) {
+      ctx->reader.failed = true;
+      queue_abort(&ctx->inputs);
+      break;
+    }
+    if (eof) {
+      break;
+    }
+    queue_end_push(&ctx->inputs);
+  }
+  queue_close(&ctx->inputs);
+  worker_leave(&ctx->reader);
+  return 0;
+}
+
+static int writer_main(void *const userdata) {
+  struct pipe_context *const ctx = userdata;
+  worker_enter(&ctx->writer);
+  for (;;) {
+    uint8_t const *const frame = queue_begin_pop(&ctx->outputs);
+    if (frame == NULL) {
+      break;
+    }
+    if (!stream_write(&ctx->output, frame, ctx->writer.error_msg)) {
+      ctx->writer.failed = true;
+      queue_abort(&ctx->outputs);
+      break;
+    }
+    queue_end_pop(&ctx->outputs, NULL);
+  }
+  worker_leave(&ctx->writer);
+  return 0;
+}
+
+static error run_pipe(struct options const *const opts) {
+  struct session *session = NULL;
+  struct pipe_context ctx = {0};
+  uint8_t *previous = NULL;
+  uint8_t *destination = NULL;
+  bool queues_ready = false;
+  bool cancel = true;
+  SR_CHAR_T error_msg[256] = {0};
+  error err = eok();
+
+  mtx_init(&ctx.reader.mtx, mtx_plain);
+  mtx_init(&ctx.writer.mtx, mtx_plain);
+
+  if (!stream_open_input(&ctx.input, GetStdHandle(STD_INPUT_HANDLE), opts->stream_format, opts->width, opts->height, error_msg)) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to open stdin: %ls", error_msg);
+    goto cleanup;
+  }
+  size_t const width = ctx.input.width, height = ctx.input.height;
+
+  err = open_session(opts, &session);
+  if (efailed(err)) {
+    err = ethru(err);
+    goto cleanup;
+  }
+  size_t output_width = 0, output_height = 0;
+  err = get_output_size(session, width, height, &output_width, &output_height);
+  if (efailed(err)) {
+    err = ethru(err);
+    goto cleanup;
+  }
+  size_t const destination_bytes = output_width * output_height * 4;
+  if (!stream_open_output(&ctx.output, GetStdHandle(STD_OUTPUT_HANDLE), &ctx.input, output_width, output_height, error_msg)) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to open stdout: %ls", error_msg);
+    goto cleanup;
+  }
+
+  // memory use is bounded by queue frames in each direction plus the previous input and the working destination
+  size_t const source_bytes = width * height * 4;
+  bool const inputs_ready = queue_init(&ctx.inputs, opts->queue, source_bytes);
+  bool const outputs_ready = queue_init(&ctx.outputs, opts->queue, destination_bytes);
+  queues_ready = true;
+  previous = malloc(source_bytes);
+  destination = malloc(destination_bytes);
+  if (!inputs_ready || !outputs_ready || previous == NULL || destination == NULL) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to allocate frame buffers");
+    goto cleanup;
+  }
+  if (thrd_create(&ctx.reader.thrd, reader_main, &ctx) != thrd_success) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to create reader thread");
+    goto cleanup;
+  }
+  ctx.reader.started = true;
+  if (thrd_create(&ctx.writer.thrd, writer_main, &ctx) != thrd_success) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to create writer thread");
+    goto cleanup;
+  }
+  ctx.writer.started = true;
+
+  // reading the next frames and writing the previous ones overlap with inference of the current frame
+  for (size_t count = 0;; ++count) {
+    uint8_t *const source = queue_begin_pop(&ctx.inputs);
+    if (source == NULL) {
+      break;
+    }
+    if (!session_inference(session,
+                           &(struct session_image){
+                               .width = width,
+                               .height = height,
+                               .channels = 4,
+                               .source = source,
+                               .destination = destination,
+                               .previous_source = count ? previous : NULL,
+                               .premultiply_alpha = opts->premultiply_alpha,
+                           })) {
+      err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to inference: %ls", session_get_last_error(session));
+      goto cleanup;
+    }
+    queue_end_pop(&ctx.inputs, &previous);
+
+    // destination keeps this frame's output for the next one, the writer gets a copy
+    uint8_t *const out = queue_begin_push(&ctx.outputs);
+    if (out == NULL) {
+      // the writer failed; the reader may be blocked on a full queue or in ReadFile on stdin, so stop it too
+      queue_abort(&ctx.inputs);
+      worker_join(&ctx.reader, true);
+      break;
+    }
+    memcpy(out, destination, destination_bytes);
+    queue_end_push(&ctx.outputs);
+  }
+  queue_close(&ctx.outputs);
+  worker_join(&ctx.writer, false);
+  worker_join(&ctx.reader, false);
+  cancel = false;
+  // a failed writer also makes the reader fail when it is cancelled, so its error comes first
+  if (ctx.writer.failed) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to write frame: %ls", ctx.writer.error_msg);
+    goto cleanup;
+  }
+  if (ctx.reader.failed) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to read frame: %ls", ctx.reader.error_msg);
+    goto cleanup;
+  }
+  print_stats(session);
+
+cleanup:
+  if (queues_ready) {
+    queue_abort(&ctx.inputs);
+    queue_abort(&ctx.outputs);
+  }
+  worker_join(&ctx.writer, cancel);
+  worker_join(&ctx.reader, cancel);
+  for (size_t i = 0; i < 2; ++i) {
+    struct worker *const w = i ? &ctx.writer : &ctx.reader;
+    if (w->thread) {
+      CloseHandle(w->thread);
+    }
+    mtx_destroy(&w->mtx);
+  }
+  if (queues_ready) {
+    queue_destroy(&ctx.outputs);
+    queue_destroy(&ctx.inputs);
+  }
+  if (destination) {
+    free(destination);
+  }
+  if (previous) {
+    free(previous);
+  }
+  if (session) {
+    session_destroy(session);
+    session = NULL;
+  }
+  stream_close(&ctx.output);
+  stream_close(&ctx.input);
+  return err;
+}
+
+static uint64_t elapsed_us(struct timespec const *const start, struct timespec const *const end) {
+  return (uint64_t)(end->tv_sec - start->tv_sec) * 1000000 + (uint64_t)((end->tv_nsec - start->tv_nsec) / 1000);
+}
+
+// Loads both models with the tuning and returns the time of the fastest of two runs over the image.
+static error time_tuning(struct options const *const opts,
+                         struct model_manifest const *const manifest,
+                         struct session *const session,
+                         struct session_tuning const *const tuning,
+                         struct session_image *const image,
+                         uint8_t **const destination,
+                         uint64_t *const us) {
+  error err = eok();
+  if (!session_set_tuning(session, tuning)) {
+    return emsg_i18nf(err_type_generic, err_fail, NULL, "%ls", session_get_last_error(session));
+  }
+  err = load_model(session, manifest, opts->rgb_model, &opts->provider, false);
+  if (efailed(err)) {
+    return ethru(err);
+  }
+  err = load_model(session, manifest, opts->alpha_model, &opts->provider, true);
+  if (efailed(err)) {
+    return ethru(err);
+  }
+  if (*destination == NULL) {
+    size_t output_width = 0, output_height = 0;
+    err = get_output_size(session, image->width, image->height, &output_width, &output_height);
+    if (efailed(err)) {
+      return ethru(err);
+    }
+    *destination = malloc(output_width * output_height * 4);
+    if (*destination == NULL) {
+      return emsg_i18nf(err_type_generic, err_fail, NULL, "failed to allocate destination buffer");
+    }
+  }
+  image->destination = *destination;
+  // the first run warms up the session, allocates its tensors and is not timed
+  for (size_t i = 0; i < 3; ++i) {
+    struct timespec start, end;
+    timespec_get(&start, TIME_UTC);
+    if (!session_inference(session, image)) {
+      return emsg_i18nf(err_type_generic, err_fail, NULL, "failed to inference: %ls", session_get_last_error(session));
+    }
+    timespec_get(&end, TIME_UTC);
+    uint64_t const t = elapsed_us(&start, &end);
+    if (i == 1 || (i == 2 && t < *us)) {
+      *us = t;
+    }
+  }
+  return eok();
+}
+
+// Upscales a range of the tile grid of one image and stores the tiles, see shard_merge.
+static error run_shard(struct options const *const opts) {
+  struct session *session = NULL;
+  uint8_t *source = NULL;
+  uint8_t *tiles = NULL;
+  SR_CHAR_T error_msg[256] = {0};
+  error err = eok();
+
+  size_t width = 0, height = 0;
+  source = image_load(opts->input, &width, &height);
+  if (source == NULL) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to load image: %ls", opts->input);
+    goto cleanup;
+  }
+  err = open_session(opts, &session);
+  if (efailed(err)) {
+    err = ethru(err);
+    goto cleanup;
+  }
+  size_t output_width = 0, output_height = 0;
+  err = get_output_size(session, width, height, &output_width, &output_height);
+  if (efailed(err)) {
+    err = ethru(err);
+    goto cleanup;
+  }
+  struct session_tile_grid grid = {0};
+  if (!session_get_tile_grid(session, width, height, &grid)) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to get tile grid: %ls", session_get_last_error(session));
+    goto cleanup;
+  }
+  // everything that changes the tiles besides the grid, so that the merge refuses shards of another run
+  struct hash identity;
+  hash_init(&identity, session_get_model_id(session));
+  hash_word(&identity, opts->premultiply_alpha ? 1 : 0);
+  hash_word(&identity, (uint64_t)width << 32 | (uint64_t)height);
+  hash_update(&identity, source, width * height * 4);
+  hash_final(&identity);
+  size_t x = 0, y = 0, columns = grid.columns, rows = grid.rows;
+  if (opts->has_tiles) {
+    x = opts->tiles[0];
+    y = opts->tiles[1];
+    columns = opts->tiles[2];
+    rows = opts->tiles[3];
+    if (x >= grid.columns || columns > grid.columns - x || y >= grid.rows || rows > grid.rows - y) {
+      err = emsg_i18nf(err_type_generic,
+                       err_fail,
+                       NULL,
+                       "tile range is outside the %1$zux%2$zu tile grid of the image",
+                       grid.columns,
+                       grid.rows);
+      goto cleanup;
+    }
+  } else {
+    // bands of whole rows, empty when there are more shards than rows
+    y = grid.rows * opts->shard_index / opts->shard_count;
+    rows = grid.rows * (opts->shard_index + 1) / opts->shard_count - y;
+  }
+  if (rows) {
+    tiles = malloc(columns * rows * grid.tile_size * grid.tile_size * 4);
+    if (tiles == NULL) {
+      err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to allocate tiles");
+      goto cleanup;
+    }
+    if (!session_inference(session,
+                           &(struct session_image){
+                               .width = width,
+                               .height = height,
+                               .channels = 4,
+                               .source = source,
+                               .destination = tiles,
+                               .premultiply_alpha = opts->premultiply_alpha,
+                               .tile_x = x,
+                               .tile_y = y,
+                               .tile_columns = columns,
+                               .tile_rows = rows,
+                           })) {
+      err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to inference: %ls", session_get_last_error(session));
+      goto cleanup;
+    }
+  }
+  if (!shard_write(opts->output,
+                   &(struct shard_header){
+                       .identity = identity.v[0],
+                       .output_width = output_width,
+                       .output_height = output_height,
+                       .columns = grid.columns,
+                       .rows = grid.rows,
+                       .tile_size = grid.tile_size,
+                       .step = grid.step,
+                       .overlap = grid.overlap,
+                       .tile_x = x,
+                       .tile_y = y,
+                       .tile_columns = rows ? columns : 0,
+                       .tile_rows = rows,
+                   },
+                   tiles,
+                   error_msg)) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "%ls", error_msg);
+    goto cleanup;
+  }
+  print_stats(session);
+
+cleanup:
+  if (session) {
+    session_destroy(session);
+    session = NULL;
+  }
+  if (tiles) {
+    free(tiles);
+  }
+  if (source) {
+    image_free(source);
+  }
+  return err;
+}
+
+// Stitches the shards numbered from --start-number, or from 0, up to the first one missing.
+static error run_merge(struct options const *const opts) {
+  SR_CHAR_T(*paths)[MAX_PATH] = NULL;
+  SR_CHAR_T const **list = NULL;
+  struct mapping destination = {0};
+  SR_CHAR_T error_msg[256] = {0};
+  error err = eok();
+
+  size_t n = 0;
+  for (size_t number = opts->start_number;; ++number) {
+    SR_CHAR_T path[MAX_PATH];
+    if (!format_frame_path(opts->merge, number, path)) {
+      err = emsg_i18nf(err_type_generic, err_fail, NULL, "invalid shard pattern: %ls", opts->merge);
+      goto cleanup;
+    }
+    if (!file_exists(path)) {
+      break;
+    }
+    SR_CHAR_T(*const p)[MAX_PATH] = realloc(paths, (n + 1) * sizeof(*paths));
+    if (p == NULL) {
+      err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to allocate memory");
+      goto cleanup;
+    }
+    paths = p;
+    memcpy(paths[n++], path, sizeof(path));
+  }
+  if (n == 0) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "no shards found: %ls", opts->merge);
+    goto cleanup;
+  }
+  list = malloc(n * sizeof(*list));
+  if (list == NULL) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to allocate memory");
+    goto cleanup;
+  }
+  for (size_t i = 0; i < n; ++i) {
+    list[i] = paths[i];
+  }
+  struct shard_header header = {0};
+  if (!shard_read_header(list[0], &header, error_msg)) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "%ls", error_msg);
+    goto cleanup;
+  }
+  // the merged image is what did not fit on one worker, so it is paged to a temporary file rather than held in memory;
+  // shard_read_header made sure that its size cannot overflow
+  if (!mapping_create_file(&destination, NULL, (size_t)header.output_width * (size_t)header.output_height * 4, error_msg)) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to create destination file: %ls", error_msg);
+    goto cleanup;
+  }
+  if (!shard_merge(list, n, destination.ptr, error_msg)) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to merge shards: %ls", error_msg);
+    goto cleanup;
+  }
+  if (!image_save(opts->output, destination.ptr, (size_t)header.output_width, (size_t)header.output_height)) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to save image: %ls", opts->output);
+    goto cleanup;
+  }
+
+cleanup:
+  if (destination.ptr) {
+    mapping_close(&destination);
+  }
+  if (list) {
+    free(list);
+  }
+  if (paths) {
+    free(paths);
+  }
+  return err;
+}
+
+// Sweeps tile size, batch size and thread count and stores the fastest combination in the profile.
+// The number of batches in flight is not swept, session_inference always keeps one batch running while the previous
+// one is written.
+static error run_autotune(struct options const *const opts) {
+  static size_t const tile_sizes[] = {64, 96, 128, 192, 256};
+  static size_t const batch_sizes[] = {1, 2, 4};
+  struct model_manifest manifest = {0};
+  struct session *session = NULL;
+  struct profile profile = {0};
+  uint8_t *source = NULL;
+  uint8_t *destination = NULL;
+  SR_CHAR_T error_msg[256] = {0};
+  SR_CHAR_T path[MAX_PATH];
+  SR_CHAR_T buf[256];
+  error err = eok();
+
+  if (opts->autotune > 16384) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "test image is too large: %zu", opts->autotune);
+    goto cleanup;
+  }
+  if (!get_profile_path(opts, path)) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "no tuning profile to store the result in");
+    goto cleanup;
+  }
+  err = load_manifest(opts, &manifest);
+  if (efailed(err)) {
+    err = ethru(err);
+    goto cleanup;
+  }
+  session = session_create(error_msg);
+  if (session == NULL) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "%ls", error_msg);
+    goto cleanup;
+  }
+
+  // noise keeps the tile cache and unchanged-tile detection out of the measurement, both are off anyway
+  size_t const side = opts->autotune;
+  source = malloc(side * side * 4);
+  if (source == NULL) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to allocate test image");
+    goto cleanup;
+  }
+  uint32_t x = 0x9e3779b9;
+  for (size_t i = 0; i < side * side * 4; ++i) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    source[i] = (uint8_t)x;
+  }
+  struct session_image image = {
+      .width = side,
+      .height = side,
+      .channels = 4,
+      .source = source,
+  };
+
+  // threads only apply to the CPU provider, 0 leaves the choice to onnxruntime (one per physical core)
+  size_t const cores = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+  size_t threads[3] = {0};
+  size_t num_threads = 1;
+  if (opts->provider.type == PROVIDER_CPU && cores > 1) {
+    threads[num_threads++] = cores / 2;
+    threads[num_threads++] = cores;
+  }
+
+  struct session_tuning best = {0};
+  uint64_t best_us = UINT64_MAX;
+  for (size_t ti = 0; ti < sizeof(tile_sizes) / sizeof(tile_sizes[0]); ++ti) {
+    for (size_t bi = 0; bi < sizeof(batch_sizes) / sizeof(batch_sizes[0]); ++bi) {
+      for (size_t ci = 0; ci < num_threads; ++ci) {
+        struct session_tuning const tuning = {
+            .tile_size = tile_sizes[ti],
+            .batch_size = batch_sizes[bi],
+            .threads = threads[ci],
+        };
+        uint64_t us = 0;
+        error e = time_tuning(opts, &manifest, session, &tuning, &image, &destination, &us);
+        if (efailed(e)) {
+          // e.g. a model with a fixed input shape, or a device out of memory
+          ov_snprintf(buf,
+                      sizeof(buf) / sizeof(buf[0]),
+                      NULL,
+                      SR_TSTR("tile %zu, batch %zu, threads %zu: skipped\n"),
+                      tuning.tile_size,
+                      tuning.batch_size,
+                      tuning.threads);
+          fputws(buf, stderr);
+          ereport(e);
+          continue;
+        }
+        uint64_t const us_per_megapixel = us * 1000000 / (side * side);
+        ov_snprintf(buf,
+                    sizeof(buf) / sizeof(buf[0]),
+                    NULL,
+                    SR_TSTR("tile %zu, batch %zu, threads %zu: %llu ms per megapixel\n"),
+                    tuning.tile_size,
+                    tuning.batch_size,
+                    tuning.threads,
+                    (unsigned long long)(us_per_megapixel / 1000));
+        fputws(buf, stderr);
+        if (us_per_megapixel < best_us) {
+          best = tuning;
+          best_us = us_per_megapixel;
+        }
+      }
+    }
+  }
+  if (best_us == UINT64_MAX) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "no configuration could run the model");
+    goto cleanup;
+  }
+
+  if (!profile_load(&profile, path, error_msg)) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "%ls", error_msg);
+    goto cleanup;
+  }
+  if (!profile_set(&profile, model_path(&manifest, opts->rgb_model), &opts->provider, &best, best_us)) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to update tuning profile");
+    goto cleanup;
+  }
+  if (!profile_save(&profile, path, error_msg)) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "%ls", error_msg);
+    goto cleanup;
+  }
+  ov_snprintf(buf,
+              sizeof(buf) / sizeof(buf[0]),
+              NULL,
+              SR_TSTR("best: tile %zu, batch %zu, threads %zu, saved to %ls\n"),
+              best.tile_size,
+              best.batch_size,
+              best.threads,
+              path);
+  fputws(buf, stderr);
+
+cleanup:
+  if (session) {
+    session_destroy(session);
+  }
+  if (destination) {
+    free(destination);
+  }
+  if (source) {
+    free(source);
+  }
+  profile_free(&profile);
+  manifest_free(&manifest);
+  return err;
+}
+
+int cli_main(int const argc, SR_CHAR_T *const *const argv) {
+  struct options opts;
+  attach_console();
+  if (!parse_options(argc, argv, &opts)) {
+    fputws(g_usage, stderr);
+    return 2;
+  }
+  error err = eok();
+  if (opts.autotune) {
+    err = run_autotune(&opts);
+  } else if (opts.merge) {
+    err = run_merge(&opts);
+  } else if (opts.shard_count || opts.has_tiles) {
+    err = run_shard(&opts);
+  } else if (opts.input == NULL) {
+    err = run_shm(&opts);
+  } else if (wcscmp(opts.input, SR_TSTR("-")) == 0) {
+    err = run_pipe(&opts);
+  } else {
+    err = run_sequence(&opts);
+  }
+  if (efailed(err)) {
+    ereport(err);
+    return 1;
+  }
+  return 0;
+}
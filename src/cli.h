@@ -0,0 +1,7 @@
+#pragma once
+
+#include "common.h"
+
+// Runs sr without creating a window.
+// Returns the process exit code.
+int cli_main(int const argc, SR_CHAR_T *const *const argv);
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "common.h"
+
+#include <string.h>
+
+// 128-bit non-cryptographic hash built from two independent xxHash64-style lanes.
+// It is used to identify tile contents, so both lanes must agree before two inputs are treated as equal.
+struct hash {
+  uint64_t v[2];
+};
+
+static inline uint64_t hash_rotl(uint64_t const x, int const r) { return (x << r) | (x >> (64 - r)); }
+
+static inline uint64_t hash_avalanche(uint64_t h) {
+  h ^= h >> 33;
+  h *= UINT64_C(0xC2B2AE3D27D4EB4F);
+  h ^= h >> 29;
+  h *= UINT64_C(0x165667B19E3779F9);
+  h ^= h >> 32;
+  return h;
+}
+
+static inline void hash_init(struct hash *const h, uint64_t const seed) {
+  h->v[0] = seed + UINT64_C(0x9E3779B185EBCA87);
+  h->v[1] = ~seed + UINT64_C(0x27D4EB2F165667C5);
+}
+
+static inline void hash_word(struct hash *const h, uint64_t const w) {
+  h->v[0] = hash_rotl(h->v[0] + w * UINT64_C(0xC2B2AE3D27D4EB4F), 31) * UINT64_C(0x9E3779B185EBCA87);
+  h->v[1] = hash_rotl(h->v[1] ^ (w * UINT64_C(0x165667B19E3779F9)), 27) * UINT64_C(0x85EBCA77C2B2AE63);
+}
+
+static inline void hash_update(struct hash *const h, void const *const data, size_t const len) {
+  uint8_t const *p = (uint8_t const *)data;
+  size_t const words = len / 8;
+  for (size_t i = 0; i < words; ++i, p += 8) {
+    uint64_t w;
+    memcpy(&w, p, 8);
+    hash_word(h, w);
+  }
+  size_t const rest = len & 7;
+  if (rest) {
+    uint64_t w = 0;
+    memcpy(&w, p, rest);
+    hash_word(h, w);
+  }
+  hash_word(h, (uint64_t)len);
+}
+
+static inline void hash_final(struct hash *const h) {
+  uint64_t const a = hash_avalanche(h->v[0]);
+  uint64_t const b = hash_avalanche(h->v[1] ^ a);
+  h->v[0] = a;
+  h->v[1] = b;
+}
+
+static inline bool hash_equal(struct hash const *const a, struct hash const *const b) {
+  return a->v[0] == b->v[0] && a->v[1] == b->v[1];
+}
@@ -1,6 +1,8 @@
 #include "image.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #ifdef __GNUC__
 #  ifndef __has_warning
@@ -118,6 +120,46 @@ void image_free(uint8_t *data) {
   }
 }
 
+uint16_t *image_load16(SR_CHAR_T const *const path, size_t *const width, size_t *const height) {
+  uint16_t *data = NULL;
+#ifdef _WIN32
+  FILE *f = _wfopen(path, L"rb");
+#else
+  FILE *f = fopen(path, "rb");
+#endif
+  if (!f) {
+    goto cleanup;
+  }
+  int w, h;
+  data = stbi_load_16_from_callbacks(
+      &(stbi_io_callbacks){
+          .read = file_read,
+          .skip = file_skip,
+          .eof = file_eof,
+      },
+      f,
+      &w,
+      &h,
+      NULL,
+      4);
+  if (data) {
+    *width = (size_t)w;
+    *height = (size_t)h;
+  }
+cleanup:
+  if (f) {
+    fclose(f);
+    f = NULL;
+  }
+  return data;
+}
+
+void image_free16(uint16_t *data) {
+  if (data) {
+    stbi_image_free(data);
+  }
+}
+
 struct spng_context {
   stbi_write_func *func;
   void *context;
@@ -130,7 +172,13 @@ static int file_write_spng(spng_ctx *ctx, void *user, void *dst_src, size_t leng
   return 0;
 }
 
-static bool image_save_spng(stbi_write_func *func, void *context, uint8_t const *const data, size_t const width, size_t const height) {
+// data holds 8-bit samples, or native-endian 16-bit samples for a bit_depth of 16.
+static bool image_save_spng(stbi_write_func *func,
+                            void *context,
+                            void const *const data,
+                            size_t const width,
+                            size_t const height,
+                            uint8_t const bit_depth) {
   bool r = false;
   struct spng_context spctx = {.func = func, .context = context};
   spng_ctx *ctx = spng_ctx_new(SPNG_CTX_ENCODER);
@@ -140,9 +188,10 @@ static bool image_save_spng(stbi_write_func *func, void *context, uint8_t const
                     .width = (uint32_t)width,
                     .height = (uint32_t)height,
                     .color_type = SPNG_COLOR_TYPE_TRUECOLOR_ALPHA,
-                    .bit_depth = 8,
+                    .bit_depth = bit_depth,
                 });
-  r = spng_encode_image(ctx, data, width * 4 * height, SPNG_FMT_PNG, SPNG_ENCODE_FINALIZE) == 0;
+  // SPNG_FMT_PNG swaps 16-bit samples to big-endian while encoding
+  r = spng_encode_image(ctx, data, width * 4 * height * (bit_depth / 8), SPNG_FMT_PNG, SPNG_ENCODE_FINALIZE) == 0;
   spng_ctx_free(ctx);
   return r;
 }
@@ -204,7 +253,7 @@ bool image_save(SR_CHAR_T const *const path, uint8_t const *const data, size_t c
 
   switch (type) {
   case png:
-    r = image_save_spng(file_write, f, data, width, height);
+    r = image_save_spng(file_write, f, data, width, height, 8);
     break;
   case jpg:
     r = stbi_write_jpg_to_func(file_write, f, (int)width, (int)height, 4, data, 100) != 0;
@@ -225,30 +274,85 @@ cleanup:
   return r;
 }
 
-void image_nn4x(uint8_t const *const source, size_t const width, size_t const height, uint8_t *const destination) {
-  size_t const width4 = width * 4;
-  size_t const width44 = width * 4 * 4;
+bool image_save16(SR_CHAR_T const *const path, uint16_t const *const data, size_t const width, size_t const height) {
+  SR_CHAR_T const *const ext = SR_STRRCHR(path, SR_TSTR('.'));
+  if (ext && !match(ext, SR_TSTR(".png"))) {
+    return false;
+  }
+#ifdef _WIN32
+  FILE *f = _wfopen(path, L"wb");
+#else
+  FILE *f = fopen(path, "wb");
+#endif
+  if (!f) {
+    return false;
+  }
+  bool const r = image_save_spng(file_write, f, data, width, height, 16);
+  fclose(f);
+  return r;
+}
+
+bool image_save_npy(SR_CHAR_T const *const path, float const *const data, size_t const width, size_t const height, bool const planar) {
+  // version 1.0: magic, version, header length, then the header padded with spaces so that the data is 64-byte aligned
+  char header[256];
+  int const n = planar ? snprintf(header,
+                                  sizeof(header),
+                                  "{'descr': '<f4', 'fortran_order': False, 'shape': (4, %llu, %llu), }",
+                                  (unsigned long long)height,
+                                  (unsigned long long)width)
+                       : snprintf(header,
+                                  sizeof(header),
+                                  "{'descr': '<f4', 'fortran_order': False, 'shape': (%llu, %llu, 4), }",
+                                  (unsigned long long)height,
+                                  (unsigned long long)width);
+  if (n <= 0 || (size_t)n >= sizeof(header) - 64) {
+    return false;
+  }
+  size_t len = (size_t)n;
+  while ((10 + len + 1) % 64 != 0) {
+    header[len++] = ' ';
+  }
+  header[len++] = '\n';
+  uint8_t const preamble[10] = {0x93, 'N', 'U', 'M', 'P', 'Y', 1, 0, (uint8_t)(len & 0xff), (uint8_t)(len >> 8)};
+#ifdef _WIN32
+  FILE *f = _wfopen(path, L"wb");
+#else
+  FILE *f = fopen(path, "wb");
+#endif
+  if (!f) {
+    return false;
+  }
+  // samples are written as they are in memory, little-endian on every platform this builds for
+  size_t const count = width * height * 4;
+  bool r = fwrite(preamble, 1, sizeof(preamble), f) == sizeof(preamble) && fwrite(header, 1, len, f) == len &&
+           fwrite(data, sizeof(float), count, f) == count;
+  if (fclose(f) != 0) {
+    r = false;
+  }
+  return r;
+}
+
+void image_nn(uint8_t const *const source, size_t const width, size_t const height, size_t const scale, uint8_t *const destination) {
+  size_t const src_stride = width * 4;
+  size_t const dst_stride = width * scale * 4;
   uint8_t const *s = source;
   uint8_t *d = destination;
   uint8_t p[4];
   for (size_t y = 0; y < height; ++y) {
-    for (size_t x = 0; x < width4; x += 4) {
-      size_t const si = x;
-      size_t const di = x * 4;
-      memcpy(p, &s[si], 4);
-      memcpy(&d[di], p, 4);
-      memcpy(&d[di + 4], p, 4);
-      memcpy(&d[di + 8], p, 4);
-      memcpy(&d[di + 12], p, 4);
-    }
-    d += width44;
-    memcpy(d, d - width44, width44);
-    d += width44;
-    memcpy(d, d - width44, width44);
-    d += width44;
-    memcpy(d, d - width44, width44);
-    d += width44;
-    s += width4;
+    uint8_t *dp = d;
+    for (size_t x = 0; x < src_stride; x += 4) {
+      memcpy(p, &s[x], 4);
+      for (size_t i = 0; i < scale; ++i) {
+        memcpy(dp, p, 4);
+        dp += 4;
+      }
+    }
+    for (size_t i = 1; i < scale; ++i) {
+      memcpy(d + dst_stride, d, dst_stride);
+      d += dst_stride;
+    }
+    d += dst_stride;
+    s += src_stride;
   }
 }
 
@@ -279,6 +383,31 @@ static float inline u8tof32(uint8_t const x) {
   return (float)(x)*divider;
 }
 
+// Clears everything of num_planes tile planes outside the w x h pixels taken from the source: the right part of
+// each row and the rows below. Tensor slots are reused, so padding left over from the tile before would otherwise
+// reach the model and make edge tiles depend on the order tiles were run in. Zero has all bits clear in both
+// float and half precision.
+static void zero_padding(void *const planes,
+                         size_t const num_planes,
+                         size_t const sample_size,
+                         size_t const tile_size,
+                         size_t const w,
+                         size_t const h) {
+  if (w == tile_size && h == tile_size) {
+    return;
+  }
+  size_t const row = tile_size * sample_size;
+  for (size_t c = 0; c < num_planes; ++c) {
+    uint8_t *const p = (uint8_t *)planes + c * tile_size * row;
+    if (w < tile_size) {
+      for (size_t y = 0; y < h; ++y) {
+        memset(p + y * row + w * sample_size, 0, (tile_size - w) * sample_size);
+      }
+    }
+    memset(p + h * row, 0, (tile_size - h) * row);
+  }
+}
+
 void hwc_to_chw16(uint8_t const *const source,
                   size_t const sw,
                   size_t const sh,
@@ -308,21 +437,8 @@ void hwc_to_chw16(uint8_t const *const source,
       pixels_alpha[di + 2 * plane] = a;
     }
   }
-  // fill the rest with zeros
-  if (w < tile_size || h < tile_size) {
-    for (size_t y = h; y < tile_size; ++y) {
-      size_t const dl = y * tile_size;
-      for (size_t x = w; x < tile_size; ++x) {
-        size_t const di = dl + x;
-        pixels[di + 0 * plane] = 0.f;
-        pixels[di + 1 * plane] = 0.f;
-        pixels[di + 2 * plane] = 0.f;
-        pixels_alpha[di + 0 * plane] = 0.f;
-        pixels_alpha[di + 1 * plane] = 0.f;
-        pixels_alpha[di + 2 * plane] = 0.f;
-      }
-    }
-  }
+  zero_padding(pixels, 3, sizeof(*pixels), tile_size, w, h);
+  zero_padding(pixels_alpha, 3, sizeof(*pixels_alpha), tile_size, w, h);
 }
 
 void hwc_to_chw32(uint8_t const *const source,
@@ -354,19 +470,218 @@ void hwc_to_chw32(uint8_t const *const source,
       pixels_alpha[di + 2 * plane] = a;
     }
   }
-  // fill the rest with zeros
-  if (w < tile_size || h < tile_size) {
-    for (size_t y = h; y < tile_size; ++y) {
-      size_t const dl = y * tile_size;
-      for (size_t x = w; x < tile_size; ++x) {
-        size_t const di = dl + x;
-        pixels[di + 0 * plane] = 0.f;
-        pixels[di + 1 * plane] = 0.f;
-        pixels[di + 2 * plane] = 0.f;
-        pixels_alpha[di + 0 * plane] = 0.f;
-        pixels_alpha[di + 1 * plane] = 0.f;
-        pixels_alpha[di + 2 * plane] = 0.f;
-      }
+  zero_padding(pixels, 3, sizeof(*pixels), tile_size, w, h);
+  zero_padding(pixels_alpha, 3, sizeof(*pixels_alpha), tile_size, w, h);
+}
+
+void hwc_to_chw4_16(uint8_t const *const source,
+                    size_t const sw,
+                    size_t const sh,
+                    size_t const sx,
+                    size_t const sy,
+                    size_t const tile_size,
+                    uint16_t *const pixels) {
+  size_t const plane = tile_size * tile_size;
+  size_t const w = (sx + tile_size < sw) ? tile_size : sw - sx;
+  size_t const h = (sy + tile_size < sh) ? tile_size : sh - sy;
+  for (size_t y = 0; y < h; ++y) {
+    size_t const sl = (sy + y) * sw * 4;
+    size_t const dl = y * tile_size;
+    for (size_t x = 0; x < w; ++x) {
+      size_t const si = sl + (sx + x) * 4;
+      size_t const di = dl + x;
+      pixels[di + 0 * plane] = float_to_half(u8tof32(source[si + 0]));
+      pixels[di + 1 * plane] = float_to_half(u8tof32(source[si + 1]));
+      pixels[di + 2 * plane] = float_to_half(u8tof32(source[si + 2]));
+      pixels[di + 3 * plane] = float_to_half(u8tof32(source[si + 3]));
+    }
+  }
+  zero_padding(pixels, 4, sizeof(*pixels), tile_size, w, h);
+}
+
+void hwc_to_chw4_32(uint8_t const *const source,
+                    size_t const sw,
+                    size_t const sh,
+                    size_t const sx,
+                    size_t const sy,
+                    size_t const tile_size,
+                    float *const pixels) {
+  size_t const plane = tile_size * tile_size;
+  size_t const w = (sx + tile_size < sw) ? tile_size : sw - sx;
+  size_t const h = (sy + tile_size < sh) ? tile_size : sh - sy;
+  for (size_t y = 0; y < h; ++y) {
+    size_t const sl = (sy + y) * sw * 4;
+    size_t const dl = y * tile_size;
+    for (size_t x = 0; x < w; ++x) {
+      size_t const si = sl + (sx + x) * 4;
+      size_t const di = dl + x;
+      pixels[di + 0 * plane] = u8tof32(source[si + 0]);
+      pixels[di + 1 * plane] = u8tof32(source[si + 1]);
+      pixels[di + 2 * plane] = u8tof32(source[si + 2]);
+      pixels[di + 3 * plane] = u8tof32(source[si + 3]);
+    }
+  }
+  zero_padding(pixels, 4, sizeof(*pixels), tile_size, w, h);
+}
+
+static float inline u16tof32(uint16_t const x) {
+  static float const divider = 1.f / 65535.f;
+  return (float)(x)*divider;
+}
+
+void hwc_u16_to_chw16(uint16_t const *const source,
+                      size_t const sw,
+                      size_t const sh,
+                      size_t const sx,
+                      size_t const sy,
+                      size_t const tile_size,
+                      uint16_t *const pixels,
+                      uint16_t *const pixels_alpha) {
+  size_t const plane = tile_size * tile_size;
+  size_t const w = (sx + tile_size < sw) ? tile_size : sw - sx;
+  size_t const h = (sy + tile_size < sh) ? tile_size : sh - sy;
+  for (size_t y = 0; y < h; ++y) {
+    size_t const sl = (sy + y) * sw * 4;
+    size_t const dl = y * tile_size;
+    for (size_t x = 0; x < w; ++x) {
+      size_t const si = sl + (sx + x) * 4;
+      size_t const di = dl + x;
+      uint16_t const a = float_to_half(u16tof32(source[si + 3]));
+      pixels[di + 0 * plane] = float_to_half(u16tof32(source[si + 0]));
+      pixels[di + 1 * plane] = float_to_half(u16tof32(source[si + 1]));
+      pixels[di + 2 * plane] = float_to_half(u16tof32(source[si + 2]));
+      pixels_alpha[di + 0 * plane] = a;
+      pixels_alpha[di + 1 * plane] = a;
+      pixels_alpha[di + 2 * plane] = a;
+    }
+  }
+  zero_padding(pixels, 3, sizeof(*pixels), tile_size, w, h);
+  zero_padding(pixels_alpha, 3, sizeof(*pixels_alpha), tile_size, w, h);
+}
+
+void hwc_u16_to_chw32(uint16_t const *const source,
+                      size_t const sw,
+                      size_t const sh,
+                      size_t const sx,
+                      size_t const sy,
+                      size_t const tile_size,
+                      float *const pixels,
+                      float *const pixels_alpha) {
+  size_t const plane = tile_size * tile_size;
+  size_t const w = (sx + tile_size < sw) ? tile_size : sw - sx;
+  size_t const h = (sy + tile_size < sh) ? tile_size : sh - sy;
+  for (size_t y = 0; y < h; ++y) {
+    size_t const sl = (sy + y) * sw * 4;
+    size_t const dl = y * tile_size;
+    for (size_t x = 0; x < w; ++x) {
+      size_t const si = sl + (sx + x) * 4;
+      size_t const di = dl + x;
+      float const a = u16tof32(source[si + 3]);
+      pixels[di + 0 * plane] = u16tof32(source[si + 0]);
+      pixels[di + 1 * plane] = u16tof32(source[si + 1]);
+      pixels[di + 2 * plane] = u16tof32(source[si + 2]);
+      pixels_alpha[di + 0 * plane] = a;
+      pixels_alpha[di + 1 * plane] = a;
+      pixels_alpha[di + 2 * plane] = a;
+    }
+  }
+  zero_padding(pixels, 3, sizeof(*pixels), tile_size, w, h);
+  zero_padding(pixels_alpha, 3, sizeof(*pixels_alpha), tile_size, w, h);
+}
+
+void hwc_u16_to_chw4_16(uint16_t const *const source,
+                        size_t const sw,
+                        size_t const sh,
+                        size_t const sx,
+                        size_t const sy,
+                        size_t const tile_size,
+                        uint16_t *const pixels) {
+  size_t const plane = tile_size * tile_size;
+  size_t const w = (sx + tile_size < sw) ? tile_size : sw - sx;
+  size_t const h = (sy + tile_size < sh) ? tile_size : sh - sy;
+  for (size_t y = 0; y < h; ++y) {
+    size_t const sl = (sy + y) * sw * 4;
+    size_t const dl = y * tile_size;
+    for (size_t x = 0; x < w; ++x) {
+      size_t const si = sl + (sx + x) * 4;
+      size_t const di = dl + x;
+      pixels[di + 0 * plane] = float_to_half(u16tof32(source[si + 0]));
+      pixels[di + 1 * plane] = float_to_half(u16tof32(source[si + 1]));
+      pixels[di + 2 * plane] = float_to_half(u16tof32(source[si + 2]));
+      pixels[di + 3 * plane] = float_to_half(u16tof32(source[si + 3]));
+    }
+  }
+  zero_padding(pixels, 4, sizeof(*pixels), tile_size, w, h);
+}
+
+void hwc_u16_to_chw4_32(uint16_t const *const source,
+                        size_t const sw,
+                        size_t const sh,
+                        size_t const sx,
+                        size_t const sy,
+                        size_t const tile_size,
+                        float *const pixels) {
+  size_t const plane = tile_size * tile_size;
+  size_t const w = (sx + tile_size < sw) ? tile_size : sw - sx;
+  size_t const h = (sy + tile_size < sh) ? tile_size : sh - sy;
+  for (size_t y = 0; y < h; ++y) {
+    size_t const sl = (sy + y) * sw * 4;
+    size_t const dl = y * tile_size;
+    for (size_t x = 0; x < w; ++x) {
+      size_t const si = sl + (sx + x) * 4;
+      size_t const di = dl + x;
+      pixels[di + 0 * plane] = u16tof32(source[si + 0]);
+      pixels[di + 1 * plane] = u16tof32(source[si + 1]);
+      pixels[di + 2 * plane] = u16tof32(source[si + 2]);
+      pixels[di + 3 * plane] = u16tof32(source[si + 3]);
+    }
+  }
+  zero_padding(pixels, 4, sizeof(*pixels), tile_size, w, h);
+}
+
+// The float loops have no branches so that the compiler vectorizes them.
+void chw_premultiply16(uint16_t *const pixels, uint16_t const *const pixels_alpha, size_t const plane) {
+  for (size_t c = 0; c < 3; ++c) {
+    uint16_t *const p = pixels + c * plane;
+    for (size_t i = 0; i < plane; ++i) {
+      p[i] = float_to_half(half_to_float(p[i]) * half_to_float(pixels_alpha[i]));
+    }
+  }
+}
+
+void chw_premultiply32(float *const pixels, float const *const pixels_alpha, size_t const plane) {
+  for (size_t c = 0; c < 3; ++c) {
+    float *const p = pixels + c * plane;
+    for (size_t i = 0; i < plane; ++i) {
+      p[i] *= pixels_alpha[i];
+    }
+  }
+}
+
+// Below 1/512 the alpha rounds to 0 in 8 bits, dividing by it would only amplify model noise.
+static float inline unpremultiply_factor(float const a) { return a > 1.f / 512.f ? 1.f / a : 0.f; }
+
+static float inline clamp1(float const f) {
+  float const t = f < 0.f ? 0.f : f;
+  return t > 1.f ? 1.f : t;
+}
+
+void chw_unpremultiply16(uint16_t *const pixels, uint16_t const *const pixels_alpha, size_t const plane, bool const clamp) {
+  for (size_t i = 0; i < plane; ++i) {
+    float const f = unpremultiply_factor(half_to_float(pixels_alpha[i]));
+    for (size_t c = 0; c < 3; ++c) {
+      float const v = half_to_float(pixels[i + c * plane]) * f;
+      pixels[i + c * plane] = float_to_half(clamp ? clamp1(v) : v);
+    }
+  }
+}
+
+void chw_unpremultiply32(float *const pixels, float const *const pixels_alpha, size_t const plane, bool const clamp) {
+  for (size_t i = 0; i < plane; ++i) {
+    float const f = unpremultiply_factor(pixels_alpha[i]);
+    for (size_t c = 0; c < 3; ++c) {
+      float const v = pixels[i + c * plane] * f;
+      pixels[i + c * plane] = clamp ? clamp1(v) : v;
     }
   }
 }
@@ -386,34 +701,230 @@ static inline uint8_t muldiv255(uint8_t const a, uint8_t const b) { // (a * b) /
 static uint8_t blend(uint8_t const a, uint8_t const b, uint8_t const alpha) { return muldiv255(a, 255 - alpha) + muldiv255(b, alpha); }
 static inline size_t szmin(size_t const a, size_t const b) { return a < b ? a : b; }
 
+static float inline clamp65535(float const f) {
+  float const t = f < 0.f ? 0.f : f;
+  return t > 65535.f ? 65535.f : t;
+}
+
+static uint16_t inline f32tou16(float const x) { return (uint16_t)(clamp65535(x * 65535.f + .5f)); }
+
+// blend for 16-bit samples with the same 8-bit overlap weights, so seams fall where they do in 8 bits.
+static uint16_t blend16(uint16_t const a, uint16_t const b, uint8_t const alpha) {
+  uint_fast32_t const v = (uint_fast32_t)a * (uint_fast32_t)(255 - alpha) + (uint_fast32_t)b * (uint_fast32_t)alpha;
+  return (uint16_t)((v + 127) / 255);
+}
+
+// Returns the range [*begin, *end) of a tile of size pixels placed at d that falls inside [0, n).
+// d is negative for tiles that start before a destination covering only a region of interest.
+static inline void clip_span(ptrdiff_t const d, size_t const size, size_t const n, size_t *const begin, size_t *const end) {
+  *begin = d < 0 ? szmin((size_t)-d, size) : 0;
+  ptrdiff_t const room = (ptrdiff_t)n - d;
+  *end = room <= 0 ? *begin : szmin(size, (size_t)room);
+  if (*end < *begin) {
+    *end = *begin;
+  }
+}
+
+// Returns the weight of the new tile at (x, y), 255 means the pixel is written as is.
+// Leading edges ramp up from the neighbor already in dest; trailing edges ramp down towards it using the
+// exact complement of the ramp that neighbor would have used, so either write order gives the same seam up to
+// the rounding of each 8-bit blend.
+static inline uint8_t overlap_weight(size_t const x, size_t const y, size_t const tile_size, size_t const overlap, unsigned const edges) {
+  size_t const trailing = tile_size - overlap;
+  uint8_t w = 255;
+  if ((edges & image_blend_left) && x < overlap) {
+    w = (uint8_t)szmin(w, (x * 255) / overlap);
+  }
+  if ((edges & image_blend_top) && y < overlap) {
+    w = (uint8_t)szmin(w, (y * 255) / overlap);
+  }
+  if ((edges & image_blend_right) && x >= trailing) {
+    w = (uint8_t)szmin(w, 255 - ((x - trailing) * 255) / overlap);
+  }
+  if ((edges & image_blend_bottom) && y >= trailing) {
+    w = (uint8_t)szmin(w, 255 - ((y - trailing) * 255) / overlap);
+  }
+  return w;
+}
+
+bool image_resample_init(struct image_resample *const r, size_t const src_size, size_t const dst_size) {
+  *r = (struct image_resample){0};
+  if (dst_size == 0 || dst_size > src_size) {
+    return false;
+  }
+  // Output pixel i covers [i * src, (i + 1) * src) and source pixel p covers [p * dst, (p + 1) * dst)
+  // in units of 1 / dst source pixels, so the coverage is exact in integers.
+  size_t const taps = (src_size + dst_size - 1) / dst_size + 1;
+  r->first = malloc(dst_size * sizeof(size_t));
+  r->weights = calloc(dst_size * taps, sizeof(float));
+  r->row = malloc(src_size * 4 * sizeof(float));
+  if (r->first == NULL || r->weights == NULL || r->row == NULL) {
+    image_resample_free(r);
+    return false;
+  }
+  for (size_t i = 0; i < dst_size; ++i) {
+    size_t const lo = i * src_size, hi = lo + src_size;
+    r->first[i] = lo / dst_size;
+    for (size_t k = 0; k < taps; ++k) {
+      size_t const p = r->first[i] + k;
+      if (p >= src_size || p * dst_size >= hi) {
+        break;
+      }
+      size_t const plo = p * dst_size, phi = plo + dst_size;
+      size_t const covered = (phi < hi ? phi : hi) - (plo > lo ? plo : lo);
+      r->weights[i * taps + k] = (float)covered / (float)src_size;
+    }
+  }
+  r->src_size = src_size;
+  r->dst_size = dst_size;
+  r->taps = taps;
+  return true;
+}
+
+void image_resample_free(struct image_resample *const r) {
+  if (r->first) {
+    free(r->first);
+  }
+  if (r->weights) {
+    free(r->weights);
+  }
+  if (r->row) {
+    free(r->row);
+  }
+  *r = (struct image_resample){0};
+}
+
+// Adds the source row sy to the vertical accumulator with the given weight.
+static inline void resample_accumulate16(
+    struct image_resample *const r, uint16_t const *const pixels, uint16_t const *const pixels_alpha, size_t const sy, float const weight) {
+  size_t const plane = r->src_size * r->src_size;
+  size_t const sl = sy * r->src_size;
+  for (size_t x = 0; x < r->src_size; ++x) {
+    r->row[x * 4 + 0] += weight * half_to_float(pixels[sl + x + 0 * plane]);
+    r->row[x * 4 + 1] += weight * half_to_float(pixels[sl + x + 1 * plane]);
+    r->row[x * 4 + 2] += weight * half_to_float(pixels[sl + x + 2 * plane]);
+    r->row[x * 4 + 3] += weight * half_to_float(pixels_alpha[sl + x + 0 * plane]);
+  }
+}
+
+static inline void resample_accumulate32(
+    struct image_resample *const r, float const *const pixels, float const *const pixels_alpha, size_t const sy, float const weight) {
+  size_t const plane = r->src_size * r->src_size;
+  size_t const sl = sy * r->src_size;
+  for (size_t x = 0; x < r->src_size; ++x) {
+    r->row[x * 4 + 0] += weight * pixels[sl + x + 0 * plane];
+    r->row[x * 4 + 1] += weight * pixels[sl + x + 1 * plane];
+    r->row[x * 4 + 2] += weight * pixels[sl + x + 2 * plane];
+    r->row[x * 4 + 3] += weight * pixels_alpha[sl + x + 0 * plane];
+  }
+}
+
+// Runs the horizontal pass over the accumulated row and writes pixels [x0, x1) of output row y to d,
+// which points at the destination pixel of x0.
+static void resample_store_row(struct image_resample const *const r,
+                               uint8_t *const d,
+                               size_t const x0,
+                               size_t const x1,
+                               size_t const y,
+                               size_t const overlap,
+                               unsigned const blend_edges) {
+  for (size_t x = x0; x < x1; ++x) {
+    float const *const weights = r->weights + x * r->taps;
+    float const *const row = r->row + r->first[x] * 4;
+    float c[4] = {0.f, 0.f, 0.f, 0.f};
+    for (size_t k = 0; k < r->taps && weights[k] != 0.f; ++k) {
+      c[0] += weights[k] * row[k * 4 + 0];
+      c[1] += weights[k] * row[k * 4 + 1];
+      c[2] += weights[k] * row[k * 4 + 2];
+      c[3] += weights[k] * row[k * 4 + 3];
+    }
+    size_t const i = (x - x0) * 4;
+    uint8_t const bl = overlap_weight(x, y, r->dst_size, overlap, blend_edges);
+    if (bl != 255) {
+      d[i + 0] = blend(d[i + 0], f32tou8(c[0]), bl);
+      d[i + 1] = blend(d[i + 1], f32tou8(c[1]), bl);
+      d[i + 2] = blend(d[i + 2], f32tou8(c[2]), bl);
+      d[i + 3] = blend(d[i + 3], f32tou8(c[3]), bl);
+    } else {
+      d[i + 0] = f32tou8(c[0]);
+      d[i + 1] = f32tou8(c[1]);
+      d[i + 2] = f32tou8(c[2]);
+      d[i + 3] = f32tou8(c[3]);
+    }
+  }
+}
+
+// resample_store_row for a destination with 16 bits per channel.
+static void resample_store_row_u16(struct image_resample const *const r,
+                                   uint16_t *const d,
+                                   size_t const x0,
+                                   size_t const x1,
+                                   size_t const y,
+                                   size_t const overlap,
+                                   unsigned const blend_edges) {
+  for (size_t x = x0; x < x1; ++x) {
+    float const *const weights = r->weights + x * r->taps;
+    float const *const row = r->row + r->first[x] * 4;
+    float c[4] = {0.f, 0.f, 0.f, 0.f};
+    for (size_t k = 0; k < r->taps && weights[k] != 0.f; ++k) {
+      c[0] += weights[k] * row[k * 4 + 0];
+      c[1] += weights[k] * row[k * 4 + 1];
+      c[2] += weights[k] * row[k * 4 + 2];
+      c[3] += weights[k] * row[k * 4 + 3];
+    }
+    size_t const i = (x - x0) * 4;
+    uint8_t const bl = overlap_weight(x, y, r->dst_size, overlap, blend_edges);
+    if (bl != 255) {
+      d[i + 0] = blend16(d[i + 0], f32tou16(c[0]), bl);
+      d[i + 1] = blend16(d[i + 1], f32tou16(c[1]), bl);
+      d[i + 2] = blend16(d[i + 2], f32tou16(c[2]), bl);
+      d[i + 3] = blend16(d[i + 3], f32tou16(c[3]), bl);
+    } else {
+      d[i + 0] = f32tou16(c[0]);
+      d[i + 1] = f32tou16(c[1]);
+      d[i + 2] = f32tou16(c[2]);
+      d[i + 3] = f32tou16(c[3]);
+    }
+  }
+}
+
 void chw_to_hwc16(uint16_t const *const pixels,
                   uint16_t const *const pixels_alpha,
                   size_t const tile_size,
                   uint8_t *const dest,
                   size_t const dw,
                   size_t const dh,
-                  size_t const dx,
-                  size_t const dy,
-                  size_t const overlap) {
+                  ptrdiff_t const dx,
+                  ptrdiff_t const dy,
+                  size_t const overlap,
+                  unsigned const blend_edges,
+                  struct image_resample *const resample) {
+  size_t x0, x1, y0, y1;
+  if (resample) {
+    clip_span(dx, resample->dst_size, dw, &x0, &x1);
+    clip_span(dy, resample->dst_size, dh, &y0, &y1);
+    for (size_t y = y0; y < y1 && x0 < x1; ++y) {
+      memset(resample->row, 0, resample->src_size * 4 * sizeof(float));
+      float const *const weights = resample->weights + y * resample->taps;
+      for (size_t k = 0; k < resample->taps && weights[k] != 0.f; ++k) {
+        resample_accumulate16(resample, pixels, pixels_alpha, resample->first[y] + k, weights[k]);
+      }
+      resample_store_row(
+          resample, dest + ((size_t)(dy + (ptrdiff_t)y) * dw + (size_t)(dx + (ptrdiff_t)x0)) * 4, x0, x1, y, overlap, blend_edges);
+    }
+    return;
+  }
   size_t const plane = tile_size * tile_size;
-  size_t const w = (dx + tile_size < dw) ? tile_size : dw - dx;
-  size_t const h = (dy + tile_size < dh) ? tile_size : dh - dy;
-  for (size_t y = 0; y < h; ++y) {
+  clip_span(dx, tile_size, dw, &x0, &x1);
+  clip_span(dy, tile_size, dh, &y0, &y1);
+  for (size_t y = y0; y < y1; ++y) {
     size_t const sl = y * tile_size;
-    size_t const dl = (dy + y) * dw * 4;
-    for (size_t x = 0; x < w; ++x) {
+    size_t const dl = (size_t)(dy + (ptrdiff_t)y) * dw * 4;
+    for (size_t x = x0; x < x1; ++x) {
       size_t const si = sl + x;
-      size_t const di = dl + (dx + x) * 4;
-      bool const is_overlap = (dx && x < overlap) || (dy && y < overlap);
-      if (is_overlap) {
-        uint8_t b;
-        if (!dx) {
-          b = (uint8_t)((y * 255) / overlap);
-        } else if (!dy) {
-          b = (uint8_t)((x * 255) / overlap);
-        } else {
-          b = (uint8_t)((szmin(x, y) * 255) / overlap);
-        }
+      size_t const di = dl + (size_t)(dx + (ptrdiff_t)x) * 4;
+      uint8_t const b = overlap_weight(x, y, tile_size, overlap, blend_edges);
+      if (b != 255) {
         dest[di + 0] = blend(dest[di + 0], f32tou8(half_to_float(pixels[si + 0 * plane])), b);
         dest[di + 1] = blend(dest[di + 1], f32tou8(half_to_float(pixels[si + 1 * plane])), b);
         dest[di + 2] = blend(dest[di + 2], f32tou8(half_to_float(pixels[si + 2 * plane])), b);
@@ -434,32 +945,41 @@ void chw_to_hwc32(float const *const pixels,
                   uint8_t *const dest,
                   size_t const dw,
                   size_t const dh,
-                  size_t const dx,
-                  size_t const dy,
-                  size_t const overlap) {
+                  ptrdiff_t const dx,
+                  ptrdiff_t const dy,
+                  size_t const overlap,
+                  unsigned const blend_edges,
+                  struct image_resample *const resample) {
+  size_t x0, x1, y0, y1;
+  if (resample) {
+    clip_span(dx, resample->dst_size, dw, &x0, &x1);
+    clip_span(dy, resample->dst_size, dh, &y0, &y1);
+    for (size_t y = y0; y < y1 && x0 < x1; ++y) {
+      memset(resample->row, 0, resample->src_size * 4 * sizeof(float));
+      float const *const weights = resample->weights + y * resample->taps;
+      for (size_t k = 0; k < resample->taps && weights[k] != 0.f; ++k) {
+        resample_accumulate32(resample, pixels, pixels_alpha, resample->first[y] + k, weights[k]);
+      }
+      resample_store_row(
+          resample, dest + ((size_t)(dy + (ptrdiff_t)y) * dw + (size_t)(dx + (ptrdiff_t)x0)) * 4, x0, x1, y, overlap, blend_edges);
+    }
+    return;
+  }
   size_t const plane = tile_size * tile_size;
-  size_t const w = (dx + tile_size < dw) ? tile_size : dw - dx;
-  size_t const h = (dy + tile_size < dh) ? tile_size : dh - dy;
-  for (size_t y = 0; y < h; ++y) {
+  clip_span(dx, tile_size, dw, &x0, &x1);
+  clip_span(dy, tile_size, dh, &y0, &y1);
+  for (size_t y = y0; y < y1; ++y) {
     size_t const sl = y * tile_size;
-    size_t const dl = (dy + y) * dw * 4;
-    for (size_t x = 0; x < w; ++x) {
+    size_t const dl = (size_t)(dy + (ptrdiff_t)y) * dw * 4;
+    for (size_t x = x0; x < x1; ++x) {
       size_t const si = sl + x;
-      size_t const di = dl + (dx + x) * 4;
-      bool const is_overlap = (dx && x < overlap) || (dy && y < overlap);
+      size_t const di = dl + (size_t)(dx + (ptrdiff_t)x) * 4;
       uint8_t const r = f32tou8(pixels[si + 0 * plane]);
       uint8_t const g = f32tou8(pixels[si + 1 * plane]);
       uint8_t const b = f32tou8(pixels[si + 2 * plane]);
       uint8_t const a = f32tou8(pixels_alpha[si + 0 * plane]);
-      if (is_overlap) {
-        uint8_t bl;
-        if (!dx) {
-          bl = (uint8_t)((y * 255) / overlap);
-        } else if (!dy) {
-          bl = (uint8_t)((x * 255) / overlap);
-        } else {
-          bl = (uint8_t)((szmin(x, y) * 255) / overlap);
-        }
+      uint8_t const bl = overlap_weight(x, y, tile_size, overlap, blend_edges);
+      if (bl != 255) {
         dest[di + 0] = blend(dest[di + 0], r, bl);
         dest[di + 1] = blend(dest[di + 1], g, bl);
         dest[di + 2] = blend(dest[di + 2], b, bl);
@@ -473,3 +993,475 @@ void chw_to_hwc32(float const *const pixels,
     }
   }
 }
+
+void chw_to_hwc_u16_16(uint16_t const *const pixels,
+                       uint16_t const *const pixels_alpha,
+                       size_t const tile_size,
+                       uint16_t *const dest,
+                       size_t const dw,
+                       size_t const dh,
+                       ptrdiff_t const dx,
+                       ptrdiff_t const dy,
+                       size_t const overlap,
+                       unsigned const blend_edges,
+                       struct image_resample *const resample) {
+  size_t x0, x1, y0, y1;
+  if (resample) {
+    clip_span(dx, resample->dst_size, dw, &x0, &x1);
+    clip_span(dy, resample->dst_size, dh, &y0, &y1);
+    for (size_t y = y0; y < y1 && x0 < x1; ++y) {
+      memset(resample->row, 0, resample->src_size * 4 * sizeof(float));
+      float const *const weights = resample->weights + y * resample->taps;
+      for (size_t k = 0; k < resample->taps && weights[k] != 0.f; ++k) {
+        resample_accumulate16(resample, pixels, pixels_alpha, resample->first[y] + k, weights[k]);
+      }
+      resample_store_row_u16(
+          resample, dest + ((size_t)(dy + (ptrdiff_t)y) * dw + (size_t)(dx + (ptrdiff_t)x0)) * 4, x0, x1, y, overlap, blend_edges);
+    }
+    return;
+  }
+  size_t const plane = tile_size * tile_size;
+  clip_span(dx, tile_size, dw, &x0, &x1);
+  clip_span(dy, tile_size, dh, &y0, &y1);
+  for (size_t y = y0; y < y1; ++y) {
+    size_t const sl = y * tile_size;
+    size_t const dl = (size_t)(dy + (ptrdiff_t)y) * dw * 4;
+    for (size_t x = x0; x < x1; ++x) {
+      size_t const si = sl + x;
+      size_t const di = dl + (size_t)(dx + (ptrdiff_t)x) * 4;
+      uint8_t const b = overlap_weight(x, y, tile_size, overlap, blend_edges);
+      if (b != 255) {
+        dest[di + 0] = blend16(dest[di + 0], f32tou16(half_to_float(pixels[si + 0 * plane])), b);
+        dest[di + 1] = blend16(dest[di + 1], f32tou16(half_to_float(pixels[si + 1 * plane])), b);
+        dest[di + 2] = blend16(dest[di + 2], f32tou16(half_to_float(pixels[si + 2 * plane])), b);
+        dest[di + 3] = blend16(dest[di + 3], f32tou16(half_to_float(pixels_alpha[si + 0 * plane])), b);
+      } else {
+        dest[di + 0] = f32tou16(half_to_float(pixels[si + 0 * plane]));
+        dest[di + 1] = f32tou16(half_to_float(pixels[si + 1 * plane]));
+        dest[di + 2] = f32tou16(half_to_float(pixels[si + 2 * plane]));
+        dest[di + 3] = f32tou16(half_to_float(pixels_alpha[si + 0 * plane]));
+      }
+    }
+  }
+}
+
+void chw_to_hwc_u16_32(float const *const pixels,
+                       float const *const pixels_alpha,
+                       size_t const tile_size,
+                       uint16_t *const dest,
+                       size_t const dw,
+                       size_t const dh,
+                       ptrdiff_t const dx,
+                       ptrdiff_t const dy,
+                       size_t const overlap,
+                       unsigned const blend_edges,
+                       struct image_resample *const resample) {
+  size_t x0, x1, y0, y1;
+  if (resample) {
+    clip_span(dx, resample->dst_size, dw, &x0, &x1);
+    clip_span(dy, resample->dst_size, dh, &y0, &y1);
+    for (size_t y = y0; y < y1 && x0 < x1; ++y) {
+      memset(resample->row, 0, resample->src_size * 4 * sizeof(float));
+      float const *const weights = resample->weights + y * resample->taps;
+      for (size_t k = 0; k < resample->taps && weights[k] != 0.f; ++k) {
+        resample_accumulate32(resample, pixels, pixels_alpha, resample->first[y] + k, weights[k]);
+      }
+      resample_store_row_u16(
+          resample, dest + ((size_t)(dy + (ptrdiff_t)y) * dw + (size_t)(dx + (ptrdiff_t)x0)) * 4, x0, x1, y, overlap, blend_edges);
+    }
+    return;
+  }
+  size_t const plane = tile_size * tile_size;
+  clip_span(dx, tile_size, dw, &x0, &x1);
+  clip_span(dy, tile_size, dh, &y0, &y1);
+  for (size_t y = y0; y < y1; ++y) {
+    size_t const sl = y * tile_size;
+    size_t const dl = (size_t)(dy + (ptrdiff_t)y) * dw * 4;
+    for (size_t x = x0; x < x1; ++x) {
+      size_t const si = sl + x;
+      size_t const di = dl + (size_t)(dx + (ptrdiff_t)x) * 4;
+      uint16_t const r = f32tou16(pixels[si + 0 * plane]);
+      uint16_t const g = f32tou16(pixels[si + 1 * plane]);
+      uint16_t const b = f32tou16(pixels[si + 2 * plane]);
+      uint16_t const a = f32tou16(pixels_alpha[si + 0 * plane]);
+      uint8_t const bl = overlap_weight(x, y, tile_size, overlap, blend_edges);
+      if (bl != 255) {
+        dest[di + 0] = blend16(dest[di + 0], r, bl);
+        dest[di + 1] = blend16(dest[di + 1], g, bl);
+        dest[di + 2] = blend16(dest[di + 2], b, bl);
+        dest[di + 3] = blend16(dest[di + 3], a, bl);
+      } else {
+        dest[di + 0] = r;
+        dest[di + 1] = g;
+        dest[di + 2] = b;
+        dest[di + 3] = a;
+      }
+    }
+  }
+}
+
+// Blends towards the value by the 8-bit overlap weight, the same fraction blend applies to 8-bit samples.
+static float inline blend_f32(float const a, float const b, uint8_t const alpha) {
+  static float const divider = 1.f / 255.f;
+  return a + (b - a) * ((float)(alpha)*divider);
+}
+
+// Sample c of destination pixel i is d[i * pixel_step + c * channel_step], for both interleaved and planar output.
+static inline void store_f32(float *const d,
+                             size_t const i,
+                             size_t const pixel_step,
+                             size_t const channel_step,
+                             float const c[4],
+                             uint8_t const bl) {
+  for (size_t k = 0; k < 4; ++k) {
+    float *const p = d + i * pixel_step + k * channel_step;
+    *p = bl != 255 ? blend_f32(*p, c[k], bl) : c[k];
+  }
+}
+
+static void resample_store_row_f32(struct image_resample const *const r,
+                                   float *const d,
+                                   size_t const pixel_step,
+                                   size_t const channel_step,
+                                   size_t const x0,
+                                   size_t const x1,
+                                   size_t const y,
+                                   size_t const overlap,
+                                   unsigned const blend_edges) {
+  for (size_t x = x0; x < x1; ++x) {
+    float const *const weights = r->weights + x * r->taps;
+    float const *const row = r->row + r->first[x] * 4;
+    float c[4] = {0.f, 0.f, 0.f, 0.f};
+    for (size_t k = 0; k < r->taps && weights[k] != 0.f; ++k) {
+      c[0] += weights[k] * row[k * 4 + 0];
+      c[1] += weights[k] * row[k * 4 + 1];
+      c[2] += weights[k] * row[k * 4 + 2];
+      c[3] += weights[k] * row[k * 4 + 3];
+    }
+    store_f32(d, x - x0, pixel_step, channel_step, c, overlap_weight(x, y, r->dst_size, overlap, blend_edges));
+  }
+}
+
+void chw_to_f32_16(uint16_t const *const pixels,
+                   uint16_t const *const pixels_alpha,
+                   size_t const tile_size,
+                   float *const dest,
+                   bool const planar,
+                   size_t const dw,
+                   size_t const dh,
+                   ptrdiff_t const dx,
+                   ptrdiff_t const dy,
+                   size_t const overlap,
+                   unsigned const blend_edges,
+                   struct image_resample *const resample) {
+  size_t const pixel_step = planar ? 1 : 4, channel_step = planar ? dw * dh : 1;
+  size_t x0, x1, y0, y1;
+  if (resample) {
+    clip_span(dx, resample->dst_size, dw, &x0, &x1);
+    clip_span(dy, resample->dst_size, dh, &y0, &y1);
+    for (size_t y = y0; y < y1 && x0 < x1; ++y) {
+      memset(resample->row, 0, resample->src_size * 4 * sizeof(float));
+      float const *const weights = resample->weights + y * resample->taps;
+      for (size_t k = 0; k < resample->taps && weights[k] != 0.f; ++k) {
+        resample_accumulate16(resample, pixels, pixels_alpha, resample->first[y] + k, weights[k]);
+      }
+      size_t const di = (size_t)(dy + (ptrdiff_t)y) * dw + (size_t)(dx + (ptrdiff_t)x0);
+      resample_store_row_f32(resample, dest + di * pixel_step, pixel_step, channel_step, x0, x1, y, overlap, blend_edges);
+    }
+    return;
+  }
+  size_t const plane = tile_size * tile_size;
+  clip_span(dx, tile_size, dw, &x0, &x1);
+  clip_span(dy, tile_size, dh, &y0, &y1);
+  for (size_t y = y0; y < y1; ++y) {
+    size_t const sl = y * tile_size;
+    size_t const dl = (size_t)(dy + (ptrdiff_t)y) * dw;
+    for (size_t x = x0; x < x1; ++x) {
+      size_t const si = sl + x;
+      float const c[4] = {
+          half_to_float(pixels[si + 0 * plane]),
+          half_to_float(pixels[si + 1 * plane]),
+          half_to_float(pixels[si + 2 * plane]),
+          half_to_float(pixels_alpha[si + 0 * plane]),
+      };
+      store_f32(dest, dl + (size_t)(dx + (ptrdiff_t)x), pixel_step, channel_step, c, overlap_weight(x, y, tile_size, overlap, blend_edges));
+    }
+  }
+}
+
+void chw_to_f32_32(float const *const pixels,
+                   float const *const pixels_alpha,
+                   size_t const tile_size,
+                   float *const dest,
+                   bool const planar,
+                   size_t const dw,
+                   size_t const dh,
+                   ptrdiff_t const dx,
+                   ptrdiff_t const dy,
+                   size_t const overlap,
+                   unsigned const blend_edges,
+                   struct image_resample *const resample) {
+  size_t const pixel_step = planar ? 1 : 4, channel_step = planar ? dw * dh : 1;
+  size_t x0, x1, y0, y1;
+  if (resample) {
+    clip_span(dx, resample->dst_size, dw, &x0, &x1);
+    clip_span(dy, resample->dst_size, dh, &y0, &y1);
+    for (size_t y = y0; y < y1 && x0 < x1; ++y) {
+      memset(resample->row, 0, resample->src_size * 4 * sizeof(float));
+      float const *const weights = resample->weights + y * resample->taps;
+      for (size_t k = 0; k < resample->taps && weights[k] != 0.f; ++k) {
+        resample_accumulate32(resample, pixels, pixels_alpha, resample->first[y] + k, weights[k]);
+      }
+      size_t const di = (size_t)(dy + (ptrdiff_t)y) * dw + (size_t)(dx + (ptrdiff_t)x0);
+      resample_store_row_f32(resample, dest + di * pixel_step, pixel_step, channel_step, x0, x1, y, overlap, blend_edges);
+    }
+    return;
+  }
+  size_t const plane = tile_size * tile_size;
+  clip_span(dx, tile_size, dw, &x0, &x1);
+  clip_span(dy, tile_size, dh, &y0, &y1);
+  for (size_t y = y0; y < y1; ++y) {
+    size_t const sl = y * tile_size;
+    size_t const dl = (size_t)(dy + (ptrdiff_t)y) * dw;
+    for (size_t x = x0; x < x1; ++x) {
+      size_t const si = sl + x;
+      float const c[4] = {
+          pixels[si + 0 * plane],
+          pixels[si + 1 * plane],
+          pixels[si + 2 * plane],
+          pixels_alpha[si + 0 * plane],
+      };
+      store_f32(dest, dl + (size_t)(dx + (ptrdiff_t)x), pixel_step, channel_step, c, overlap_weight(x, y, tile_size, overlap, blend_edges));
+    }
+  }
+}
+
+void image_hash_tile(uint8_t const *const source,
+                     size_t const sw,
+                     size_t const sh,
+                     size_t const sx,
+                     size_t const sy,
+                     size_t const tile_size,
+                     struct hash *const h) {
+  size_t const w = (sx + tile_size < sw) ? tile_size : sw - sx;
+  size_t const hh = (sy + tile_size < sh) ? tile_size : sh - sy;
+  hash_word(h, (uint64_t)w << 32 | (uint64_t)hh);
+  if (w < tile_size || hh < tile_size) {
+    // edge tiles cached on disk before their padding was cleared depend on the tile run before them
+    hash_word(h, UINT64_C(0x7a65726f706164));
+  }
+  for (size_t y = 0; y < hh; ++y) {
+    hash_update(h, source + ((sy + y) * sw + sx) * 4, w * 4);
+  }
+}
+
+void chw_to_rgba16(uint16_t const *const pixels,
+                   uint16_t const *const pixels_alpha,
+                   size_t const tile_size,
+                   uint8_t *const tile,
+                   struct image_resample *const resample) {
+  if (resample) {
+    size_t const size = resample->dst_size;
+    for (size_t y = 0; y < size; ++y) {
+      memset(resample->row, 0, resample->src_size * 4 * sizeof(float));
+      float const *const weights = resample->weights + y * resample->taps;
+      for (size_t k = 0; k < resample->taps && weights[k] != 0.f; ++k) {
+        resample_accumulate16(resample, pixels, pixels_alpha, resample->first[y] + k, weights[k]);
+      }
+      resample_store_row(resample, tile + y * size * 4, 0, size, y, 0, 0);
+    }
+    return;
+  }
+  size_t const plane = tile_size * tile_size;
+  for (size_t i = 0; i < plane; ++i) {
+    tile[i * 4 + 0] = f32tou8(half_to_float(pixels[i + 0 * plane]));
+    tile[i * 4 + 1] = f32tou8(half_to_float(pixels[i + 1 * plane]));
+    tile[i * 4 + 2] = f32tou8(half_to_float(pixels[i + 2 * plane]));
+    tile[i * 4 + 3] = f32tou8(half_to_float(pixels_alpha[i + 0 * plane]));
+  }
+}
+
+void chw_to_rgba32(float const *const pixels,
+                   float const *const pixels_alpha,
+                   size_t const tile_size,
+                   uint8_t *const tile,
+                   struct image_resample *const resample) {
+  if (resample) {
+    size_t const size = resample->dst_size;
+    for (size_t y = 0; y < size; ++y) {
+      memset(resample->row, 0, resample->src_size * 4 * sizeof(float));
+      float const *const weights = resample->weights + y * resample->taps;
+      for (size_t k = 0; k < resample->taps && weights[k] != 0.f; ++k) {
+        resample_accumulate32(resample, pixels, pixels_alpha, resample->first[y] + k, weights[k]);
+      }
+      resample_store_row(resample, tile + y * size * 4, 0, size, y, 0, 0);
+    }
+    return;
+  }
+  size_t const plane = tile_size * tile_size;
+  for (size_t i = 0; i < plane; ++i) {
+    tile[i * 4 + 0] = f32tou8(pixels[i + 0 * plane]);
+    tile[i * 4 + 1] = f32tou8(pixels[i + 1 * plane]);
+    tile[i * 4 + 2] = f32tou8(pixels[i + 2 * plane]);
+    tile[i * 4 + 3] = f32tou8(pixels_alpha[i + 0 * plane]);
+  }
+}
+
+void rgba_to_hwc(uint8_t const *const tile,
+                 size_t const tile_size,
+                 uint8_t *const dest,
+                 size_t const dw,
+                 size_t const dh,
+                 ptrdiff_t const dx,
+                 ptrdiff_t const dy,
+                 size_t const overlap,
+                 unsigned const blend_edges) {
+  rgba_to_hwc_rect(tile, tile_size, dest, dw, dh, dx, dy, overlap, blend_edges, 0, 0, tile_size, tile_size);
+}
+
+void rgba_to_hwc_rect(uint8_t const *const tile,
+                      size_t const tile_size,
+                      uint8_t *const dest,
+                      size_t const dw,
+                      size_t const dh,
+                      ptrdiff_t const dx,
+                      ptrdiff_t const dy,
+                      size_t const overlap,
+                      unsigned const blend_edges,
+                      size_t const left,
+                      size_t const top,
+                      size_t const right,
+                      size_t const bottom) {
+  size_t x0, x1, y0, y1;
+  clip_span(dx, tile_size, dw, &x0, &x1);
+  clip_span(dy, tile_size, dh, &y0, &y1);
+  x0 = x0 > left ? x0 : left;
+  y0 = y0 > top ? y0 : top;
+  x1 = szmin(x1, right);
+  y1 = szmin(y1, bottom);
+  for (size_t y = y0; y < y1 && x0 < x1; ++y) {
+    uint8_t const *const s = tile + (y * tile_size + x0) * 4;
+    uint8_t *const d = dest + ((size_t)(dy + (ptrdiff_t)y) * dw + (size_t)(dx + (ptrdiff_t)x0)) * 4;
+    if (!blend_edges) {
+      memcpy(d, s, (x1 - x0) * 4);
+      continue;
+    }
+    for (size_t x = x0; x < x1; ++x) {
+      size_t const i = (x - x0) * 4;
+      uint8_t const bl = overlap_weight(x, y, tile_size, overlap, blend_edges);
+      if (bl != 255) {
+        d[i + 0] = blend(d[i + 0], s[i + 0], bl);
+        d[i + 1] = blend(d[i + 1], s[i + 1], bl);
+        d[i + 2] = blend(d[i + 2], s[i + 2], bl);
+        d[i + 3] = blend(d[i + 3], s[i + 3], bl);
+      } else {
+        memcpy(d + i, s + i, 4);
+      }
+    }
+  }
+}
+
+bool image_mip_init(struct image_mip *const mip, size_t const width, size_t const height, size_t const levels) {
+  *mip = (struct image_mip){0};
+  size_t w = width, h = height;
+  while (mip->levels < levels && mip->levels < image_mip_max_levels && (w > 1 || h > 1)) {
+    w = (w + 1) / 2;
+    h = (h + 1) / 2;
+    struct image_mip_level *const l = &mip->level[mip->levels];
+    l->pixels = calloc(w * h, 4);
+    if (l->pixels == NULL) {
+      image_mip_free(mip);
+      return false;
+    }
+    l->width = w;
+    l->height = h;
+    ++mip->levels;
+  }
+  return true;
+}
+
+void image_mip_free(struct image_mip *const mip) {
+  for (size_t i = 0; i < mip->levels; ++i) {
+    free(mip->level[i].pixels);
+  }
+  *mip = (struct image_mip){0};
+}
+
+// Averages the 2x2 blocks of src covering the region [x0, x1) x [y0, y1) of dst.
+static void mip_reduce(uint8_t const *const src,
+                       size_t const sw,
+                       size_t const sh,
+                       uint8_t *const dst,
+                       size_t const dw,
+                       size_t const x0,
+                       size_t const y0,
+                       size_t const x1,
+                       size_t const y1) {
+  for (size_t y = y0; y < y1; ++y) {
+    uint8_t const *const r0 = src + (y * 2) * sw * 4;
+    uint8_t const *const r1 = src + szmin(y * 2 + 1, sh - 1) * sw * 4;
+    uint8_t *const d = dst + y * dw * 4;
+    for (size_t x = x0; x < x1; ++x) {
+      size_t const a = x * 2 * 4, b = szmin(x * 2 + 1, sw - 1) * 4;
+      for (size_t c = 0; c < 4; ++c) {
+        d[x * 4 + c] = (uint8_t)((r0[a + c] + r0[b + c] + r1[a + c] + r1[b + c] + 2) / 4);
+      }
+    }
+  }
+}
+
+void image_mip_update(struct image_mip *const mip,
+                      uint8_t const *const image,
+                      size_t const width,
+                      size_t const height,
+                      size_t const x,
+                      size_t const y,
+                      size_t const w,
+                      size_t const h) {
+  if (w == 0 || h == 0 || x >= width || y >= height) {
+    return;
+  }
+  uint8_t const *src = image;
+  size_t sw = width, sh = height;
+  size_t x0 = x, y0 = y, x1 = szmin(x + w, width), y1 = szmin(y + h, height);
+  for (size_t i = 0; i < mip->levels; ++i) {
+    struct image_mip_level *const l = &mip->level[i];
+    x0 /= 2;
+    y0 /= 2;
+    x1 = szmin((x1 + 1) / 2, l->width);
+    y1 = szmin((y1 + 1) / 2, l->height);
+    mip_reduce(src, sw, sh, l->pixels, l->width, x0, y0, x1, y1);
+    src = l->pixels;
+    sw = l->width;
+    sh = l->height;
+  }
+}
+
+struct image_mip_level const *image_mip_select(struct image_mip const *const mip, size_t const width, size_t const height) {
+  struct image_mip_level const *r = NULL;
+  for (size_t i = 0; i < mip->levels; ++i) {
+    if (mip->level[i].width < width || mip->level[i].height < height) {
+      break;
+    }
+    r = &mip->level[i];
+  }
+  return r;
+}
+
+bool image_region_equal(uint8_t const *const a,
+                        uint8_t const *const b,
+                        size_t const sw,
+                        size_t const sh,
+                        size_t const sx,
+                        size_t const sy,
+                        size_t const tile_size) {
+  size_t const w = (sx + tile_size < sw) ? tile_size : sw - sx;
+  size_t const h = (sy + tile_size < sh) ? tile_size : sh - sy;
+  for (size_t y = 0; y < h; ++y) {
+    size_t const offset = ((sy + y) * sw + sx) * 4;
+    if (memcmp(a + offset, b + offset, w * 4) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
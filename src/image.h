@@ -1,12 +1,20 @@
 #pragma once
 
 #include "common.h"
+#include "hash.h"
 
 uint8_t *image_load(SR_CHAR_T const *const path, size_t *const width, size_t *const height);
 void image_free(uint8_t *const data);
 bool image_save(SR_CHAR_T const *const path, uint8_t const *const data, size_t const width, size_t const height);
+// RGBA with 16 bits per channel in native byte order. 8-bit files load widened to 16 bits; only PNG is saved.
+uint16_t *image_load16(SR_CHAR_T const *const path, size_t *const width, size_t *const height);
+void image_free16(uint16_t *const data);
+bool image_save16(SR_CHAR_T const *const path, uint16_t const *const data, size_t const width, size_t const height);
+// Writes float RGBA as a NumPy .npy array of shape (height, width, 4), or (4, height, width) when planar.
+bool image_save_npy(SR_CHAR_T const *const path, float const *const data, size_t const width, size_t const height, bool const planar);
 
-void image_nn4x(uint8_t const *const source, size_t const width, size_t const height, uint8_t *const destination);
+// Nearest-neighbor upscale, used to fill the destination before inference refines it.
+void image_nn(uint8_t const *const source, size_t const width, size_t const height, size_t const scale, uint8_t *const destination);
 
 void hwc_to_chw16(uint8_t const *const source,
                   size_t const sw,
@@ -28,25 +36,282 @@ void hwc_to_chw32(uint8_t const *const source,
 #define hwc_to_chw(source, sw, sh, sx, sy, tile_size, pixels, pixels_alpha)                                                                \
   _Generic((pixels), uint16_t *: hwc_to_chw16, float *: hwc_to_chw32)(source, sw, sh, sx, sy, tile_size, pixels, pixels_alpha)
 
+// Same as hwc_to_chw for models that take RGBA as one tensor: four planes R, G, B and A.
+// The output side needs no variant, chw_to_hwc and chw_to_rgba take pixels + 3 * plane as the alpha plane.
+void hwc_to_chw4_16(uint8_t const *const source,
+                    size_t const sw,
+                    size_t const sh,
+                    size_t const sx,
+                    size_t const sy,
+                    size_t const tile_size,
+                    uint16_t *const pixels);
+void hwc_to_chw4_32(uint8_t const *const source,
+                    size_t const sw,
+                    size_t const sh,
+                    size_t const sx,
+                    size_t const sy,
+                    size_t const tile_size,
+                    float *const pixels);
+
+#define hwc_to_chw4(source, sw, sh, sx, sy, tile_size, pixels)                                                                           \
+  _Generic((pixels), uint16_t *: hwc_to_chw4_16, float *: hwc_to_chw4_32)(source, sw, sh, sx, sy, tile_size, pixels)
+
+// hwc_to_chw and hwc_to_chw4 for sources with 16 bits per channel.
+void hwc_u16_to_chw16(uint16_t const *const source,
+                      size_t const sw,
+                      size_t const sh,
+                      size_t const sx,
+                      size_t const sy,
+                      size_t const tile_size,
+                      uint16_t *const pixels,
+                      uint16_t *const pixels_alpha);
+void hwc_u16_to_chw32(uint16_t const *const source,
+                      size_t const sw,
+                      size_t const sh,
+                      size_t const sx,
+                      size_t const sy,
+                      size_t const tile_size,
+                      float *const pixels,
+                      float *const pixels_alpha);
+void hwc_u16_to_chw4_16(uint16_t const *const source,
+                        size_t const sw,
+                        size_t const sh,
+                        size_t const sx,
+                        size_t const sy,
+                        size_t const tile_size,
+                        uint16_t *const pixels);
+void hwc_u16_to_chw4_32(uint16_t const *const source,
+                        size_t const sw,
+                        size_t const sh,
+                        size_t const sx,
+                        size_t const sy,
+                        size_t const tile_size,
+                        float *const pixels);
+
+#define hwc_u16_to_chw(source, sw, sh, sx, sy, tile_size, pixels, pixels_alpha)                                                            \
+  _Generic((pixels), uint16_t *: hwc_u16_to_chw16, float *: hwc_u16_to_chw32)(source, sw, sh, sx, sy, tile_size, pixels, pixels_alpha)
+#define hwc_u16_to_chw4(source, sw, sh, sx, sy, tile_size, pixels)                                                                       \
+  _Generic((pixels), uint16_t *: hwc_u16_to_chw4_16, float *: hwc_u16_to_chw4_32)(source, sw, sh, sx, sy, tile_size, pixels)
+
+// Premultiplied alpha for a tile in tensor layout: the plane colour planes at pixels are multiplied by the alpha
+// plane at pixels_alpha before the model runs, and divided by the alpha the model returns afterwards. Colour under
+// transparent pixels then cannot bleed into visible edges. Colour where the output alpha is zero becomes black.
+// Both work in place on whole planes, including the zero padding of edge tiles. clamp limits the unpremultiplied colour
+// to [0, 1]; float destinations pass false to receive it unclamped like any other model output.
+void chw_premultiply16(uint16_t *const pixels, uint16_t const *const pixels_alpha, size_t const plane);
+void chw_premultiply32(float *const pixels, float const *const pixels_alpha, size_t const plane);
+void chw_unpremultiply16(uint16_t *const pixels, uint16_t const *const pixels_alpha, size_t const plane, bool const clamp);
+void chw_unpremultiply32(float *const pixels, float const *const pixels_alpha, size_t const plane, bool const clamp);
+
+#define chw_premultiply(pixels, pixels_alpha, plane)                                                                                       \
+  _Generic((pixels), uint16_t *: chw_premultiply16, float *: chw_premultiply32)(pixels, pixels_alpha, plane)
+#define chw_unpremultiply(pixels, pixels_alpha, plane, clamp)                                                                              \
+  _Generic((pixels), uint16_t *: chw_unpremultiply16, float *: chw_unpremultiply32)(pixels, pixels_alpha, plane, clamp)
+
+// Area filter that reduces a model output tile of src_size pixels per axis to dst_size pixels before it is written,
+// so an output smaller than the model scale never exists at full size. The same weights are used for both axes.
+struct image_resample {
+  size_t src_size;
+  size_t dst_size;
+  size_t taps;     // per output pixel, unused taps have zero weight
+  size_t *first;   // dst_size, first source pixel of each output pixel
+  float *weights;  // dst_size * taps
+  float *row;      // src_size * 4, scratch for the vertical pass
+};
+
+// dst_size must not exceed src_size.
+bool image_resample_init(struct image_resample *const r, size_t const src_size, size_t const dst_size);
+void image_resample_free(struct image_resample *const r);
+
+// Edges of a tile whose overlap is blended with what is already in the destination.
+enum image_blend_edge {
+  image_blend_left = 1,
+  image_blend_top = 2,
+  image_blend_right = 4,
+  image_blend_bottom = 8,
+};
+
 void chw_to_hwc16(uint16_t const *const pixels,
                   uint16_t const *const pixels_alpha,
                   size_t const tile_size,
                   uint8_t *const dest,
                   size_t const dw,
                   size_t const dh,
-                  size_t const dx,
-                  size_t const dy,
-                  size_t const overlap);
+                  ptrdiff_t const dx,
+                  ptrdiff_t const dy,
+                  size_t const overlap,
+                  unsigned const blend_edges,
+                  struct image_resample *const resample);
 void chw_to_hwc32(float const *const pixels,
                   float const *const pixels_alpha,
                   size_t const tile_size,
                   uint8_t *const dest,
                   size_t const dw,
                   size_t const dh,
-                  size_t const dx,
-                  size_t const dy,
-                  size_t const overlap);
+                  ptrdiff_t const dx,
+                  ptrdiff_t const dy,
+                  size_t const overlap,
+                  unsigned const blend_edges,
+                  struct image_resample *const resample);
 
-#define chw_to_hwc(pixels, pixels_alpha, tile_size, dest, dw, dh, dx, dy, overlap)                                                         \
+// tile_size is the size of the tensor tile. With resample, dx, dy, dw, dh and overlap are in destination pixels
+// and the tile covers resample->dst_size of them; NULL writes the tile as is.
+// Parts of the tile outside the dw x dh destination are clipped, so dx and dy may be negative.
+#define chw_to_hwc(pixels, pixels_alpha, tile_size, dest, dw, dh, dx, dy, overlap, blend_edges, resample)                                  \
   _Generic((pixels), uint16_t const *: chw_to_hwc16, uint16_t *: chw_to_hwc16, float const *: chw_to_hwc32, float *: chw_to_hwc32)(        \
-      pixels, pixels_alpha, tile_size, dest, dw, dh, dx, dy, overlap)
+      pixels, pixels_alpha, tile_size, dest, dw, dh, dx, dy, overlap, blend_edges, resample)
+
+// chw_to_hwc for destinations with 16 bits per channel, with the same placement, resampling and overlap weights.
+void chw_to_hwc_u16_16(uint16_t const *const pixels,
+                       uint16_t const *const pixels_alpha,
+                       size_t const tile_size,
+                       uint16_t *const dest,
+                       size_t const dw,
+                       size_t const dh,
+                       ptrdiff_t const dx,
+                       ptrdiff_t const dy,
+                       size_t const overlap,
+                       unsigned const blend_edges,
+                       struct image_resample *const resample);
+void chw_to_hwc_u16_32(float const *const pixels,
+                       float const *const pixels_alpha,
+                       size_t const tile_size,
+                       uint16_t *const dest,
+                       size_t const dw,
+                       size_t const dh,
+                       ptrdiff_t const dx,
+                       ptrdiff_t const dy,
+                       size_t const overlap,
+                       unsigned const blend_edges,
+                       struct image_resample *const resample);
+
+#define chw_to_hwc_u16(pixels, pixels_alpha, tile_size, dest, dw, dh, dx, dy, overlap, blend_edges, resample)                              \
+  _Generic((pixels),                                                                                                                       \
+      uint16_t const *: chw_to_hwc_u16_16,                                                                                                 \
+      uint16_t *: chw_to_hwc_u16_16,                                                                                                       \
+      float const *: chw_to_hwc_u16_32,                                                                                                    \
+      float *: chw_to_hwc_u16_32)(pixels, pixels_alpha, tile_size, dest, dw, dh, dx, dy, overlap, blend_edges, resample)
+
+// chw_to_hwc for float destinations: the model output as is, without quantization or clamping, only blended at
+// overlaps. planar writes four dw x dh planes R, G, B and A instead of interleaved RGBA.
+void chw_to_f32_16(uint16_t const *const pixels,
+                   uint16_t const *const pixels_alpha,
+                   size_t const tile_size,
+                   float *const dest,
+                   bool const planar,
+                   size_t const dw,
+                   size_t const dh,
+                   ptrdiff_t const dx,
+                   ptrdiff_t const dy,
+                   size_t const overlap,
+                   unsigned const blend_edges,
+                   struct image_resample *const resample);
+void chw_to_f32_32(float const *const pixels,
+                   float const *const pixels_alpha,
+                   size_t const tile_size,
+                   float *const dest,
+                   bool const planar,
+                   size_t const dw,
+                   size_t const dh,
+                   ptrdiff_t const dx,
+                   ptrdiff_t const dy,
+                   size_t const overlap,
+                   unsigned const blend_edges,
+                   struct image_resample *const resample);
+
+#define chw_to_f32(pixels, pixels_alpha, tile_size, dest, planar, dw, dh, dx, dy, overlap, blend_edges, resample)                          \
+  _Generic((pixels), uint16_t const *: chw_to_f32_16, uint16_t *: chw_to_f32_16, float const *: chw_to_f32_32, float *: chw_to_f32_32)(    \
+      pixels, pixels_alpha, tile_size, dest, planar, dw, dh, dx, dy, overlap, blend_edges, resample)
+
+// Feeds the tile_size x tile_size window at (sx, sy) into h. Pixels outside the image are not hashed,
+// but the clipped window size is, so that edge tiles never collide with interior tiles. The tile loaders fill
+// the outside with zeros, so the window size alone determines what the model sees there.
+void image_hash_tile(uint8_t const *const source,
+                     size_t const sw,
+                     size_t const sh,
+                     size_t const sx,
+                     size_t const sy,
+                     size_t const tile_size,
+                     struct hash *const h);
+
+// With resample, tile receives resample->dst_size x resample->dst_size pixels.
+void chw_to_rgba16(uint16_t const *const pixels,
+                   uint16_t const *const pixels_alpha,
+                   size_t const tile_size,
+                   uint8_t *const tile,
+                   struct image_resample *const resample);
+void chw_to_rgba32(float const *const pixels,
+                   float const *const pixels_alpha,
+                   size_t const tile_size,
+                   uint8_t *const tile,
+                   struct image_resample *const resample);
+
+#define chw_to_rgba(pixels, pixels_alpha, tile_size, tile, resample)                                                                      \
+  _Generic((pixels), uint16_t const *: chw_to_rgba16, uint16_t *: chw_to_rgba16, float const *: chw_to_rgba32, float *: chw_to_rgba32)(    \
+      pixels, pixels_alpha, tile_size, tile, resample)
+
+// Same placement and overlap blending as chw_to_hwc, but for a tile that is already packed as RGBA8.
+void rgba_to_hwc(uint8_t const *const tile,
+                 size_t const tile_size,
+                 uint8_t *const dest,
+                 size_t const dw,
+                 size_t const dh,
+                 ptrdiff_t const dx,
+                 ptrdiff_t const dy,
+                 size_t const overlap,
+                 unsigned const blend_edges);
+// Same as rgba_to_hwc for the pixels of the tile in [left, right) x [top, bottom) only.
+void rgba_to_hwc_rect(uint8_t const *const tile,
+                      size_t const tile_size,
+                      uint8_t *const dest,
+                      size_t const dw,
+                      size_t const dh,
+                      ptrdiff_t const dx,
+                      ptrdiff_t const dy,
+                      size_t const overlap,
+                      unsigned const blend_edges,
+                      size_t const left,
+                      size_t const top,
+                      size_t const right,
+                      size_t const bottom);
+
+// Box-filtered pyramid of an RGBA8 image for previews and zoomed-out views. Level i is half the size of
+// level i - 1 (rounded up, the last row or column of an odd level is reused), level 0 being the image itself,
+// which is not stored. Levels are kept up to date per written region, so a viewer can read a screen-sized
+// level without touching the full image.
+enum {
+  image_mip_max_levels = 16,
+};
+
+struct image_mip {
+  size_t levels; // stored levels, level[0] is level 1
+  struct image_mip_level {
+    uint8_t *pixels;
+    size_t width;
+    size_t height;
+  } level[image_mip_max_levels];
+};
+
+// Creates up to levels levels, stopping once a level is 1x1.
+bool image_mip_init(struct image_mip *const mip, size_t const width, size_t const height, size_t const levels);
+void image_mip_free(struct image_mip *const mip);
+// Recomputes every level from the w x h region at (x, y) of image, which has the size mip was created for.
+void image_mip_update(struct image_mip *const mip,
+                      uint8_t const *const image,
+                      size_t const width,
+                      size_t const height,
+                      size_t const x,
+                      size_t const y,
+                      size_t const w,
+                      size_t const h);
+// Returns the smallest level that is still at least width x height, or level 0 (NULL) if none is.
+struct image_mip_level const *image_mip_select(struct image_mip const *const mip, size_t const width, size_t const height);
+
+// Reports whether the tile_size x tile_size windows at (sx, sy) of two images of the same size are identical.
+bool image_region_equal(uint8_t const *const a,
+                        uint8_t const *const b,
+                        size_t const sw,
+                        size_t const sh,
+                        size_t const sx,
+                        size_t const sy,
+                        size_t const tile_size);
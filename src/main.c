@@ -6,16 +6,22 @@
 
 #include "common.h"
 
+#include "cli.h"
 #include "image.h"
+#include "manifest.h"
+#include "mapping.h"
 #include "onnx.h"
+#include "profile.h"
 #include "session.h"
 
 #include <math.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <time.h>
 
 #include <commdlg.h>
 #include <dwmapi.h>
+#include <shellapi.h>
 #include <shobjidl.h>
 
 enum {
@@ -41,6 +47,10 @@ enum {
   WM_THREAD_COMPLETE_ABORTED = 2,
   WM_UPDATE_PROGRESS = WM_USER + 2,
   WM_CHANGE_STATE = WM_USER + 3,
+
+  progress_timer_id = 1,
+  progress_timer_interval = 50, // ms
+  dirty_queue_size = 256,
 };
 
 static SR_CHAR_T const g_model_group_label_text[] = SR_TSTR("使用するモデル");
@@ -53,66 +63,9 @@ static SR_CHAR_T const g_start_button_text[] = SR_TSTR("処理開始");
 static SR_CHAR_T const g_abort_button_text[] = SR_TSTR("中止");
 static SR_CHAR_T const g_save_button_text[] = SR_TSTR("保存...");
 
-static struct model {
-  SR_CHAR_T const *name;
-  SR_CHAR_T const *path;
-  SR_CHAR_T const *rgb_description;
-  SR_CHAR_T const *alpha_description;
-} const g_models[] = {
-    {
-        SR_TSTR("realesr-general-x4v3"),
-        SR_TSTR("models/realesrgan/realesr-general-x4v3.onnx"),
-        SR_TSTR("Real-ESRGAN - 一般向け"),
-        SR_TSTR("Real-ESRGAN - 一般向け"),
-    },
-    {
-        SR_TSTR("realesr-general-wdn-x4v3"),
-        SR_TSTR("models/realesrgan/realesr-general-wdn-x4v3.onnx"),
-        SR_TSTR("Real-ESRGAN - 一般向け（ノイズ除去あり）"),
-        SR_TSTR("Real-ESRGAN - 一般向け（ノイズ除去あり）"),
-    },
-    {
-        SR_TSTR("RealESRGAN_x4plus_anime_6B"),
-        SR_TSTR("models/realesrgan/RealESRGAN_x4plus_anime_6B.onnx"),
-        SR_TSTR("Real-ESRGAN - アニメ・イラスト向け"),
-        SR_TSTR("Real-ESRGAN - アニメ・イラスト向け"),
-    },
-    {
-        SR_TSTR("realesr-animevideov3"),
-        SR_TSTR("models/realesrgan/realesr-animevideov3.onnx"),
-        SR_TSTR("Real-ESRGAN - アニメ・速度重視"),
-        SR_TSTR("[非推奨] Real-ESRGAN - アニメ・速度重視"),
-    },
-    {
-        SR_TSTR("up4x-latest-no-denoise"),
-        SR_TSTR("models/realcugan/up4x-latest-no-denoise.onnx"),
-        SR_TSTR("Real-CUGAN - アニメ・イラスト向け"),
-        SR_TSTR("[非推奨] Real-CUGAN - アニメ・イラスト向け"),
-    },
-    {
-        SR_TSTR("up4x-latest-conservative"),
-        SR_TSTR("models/realcugan/up4x-latest-conservative.onnx"),
-        SR_TSTR("Real-CUGAN - アニメ・イラスト向け（ノイズ除去あり）"),
-        SR_TSTR("[非推奨] Real-CUGAN - アニメ・イラスト向け（ノイズ除去あり）"),
-    },
-    {
-        SR_TSTR("up4x-latest-denoise3x"),
-        SR_TSTR("models/realcugan/up4x-latest-denoise3x.onnx"),
-        SR_TSTR("Real-CUGAN - アニメ・イラスト向け（強いノイズ除去あり）"),
-        SR_TSTR("[非推奨] Real-CUGAN - アニメ・イラスト向け（強いノイズ除去あり）"),
-    },
-};
+static SR_CHAR_T const g_model_preset_placeholder_text[] = SR_TSTR("（プリセットから選ぶ）");
 
-static struct model_preset {
-  SR_CHAR_T const *name;
-  size_t rgb_index;
-  size_t alpha_index;
-} const g_model_presets[] = {
-    {SR_TSTR("（プリセットから選ぶ）"), 0, 0},
-    {SR_TSTR("写真 - イラストに比べて柔らかい出力になりやすい"), 0, 0},
-    {SR_TSTR("イラスト - 線などがハッキリするがグラデや細かい表現が失われることがある"), 2, 0},
-    {SR_TSTR("イラスト２ - ディティールが残りやすいが出力品質が安定しないことがある"), 4, 0},
-};
+static struct model_manifest g_manifest = {0};
 
 static struct provider {
   struct session_provider provider;
@@ -124,12 +77,35 @@ static thrd_t g_thrd;
 static struct session *g_session = NULL;
 static SR_CHAR_T *g_source_image_path = NULL;
 static uint8_t *g_source_image = NULL;
+static uint8_t *g_previous_source_image = NULL;
 static size_t g_source_width = 0;
 static size_t g_source_height = 0;
+static size_t g_destination_width = 0;
+static size_t g_destination_height = 0;
 static uint8_t *g_destination_image = NULL;
+static struct mapping g_destination_mapping = {0}; // backs g_destination_image when it does not fit in memory
+static bool g_destination_image_completed = false;
 static size_t g_active_provider_index = (size_t)-1;
-static size_t g_rgb_model_index = sizeof(g_models) / sizeof(g_models[0]);
-static size_t g_alpha_model_index = sizeof(g_models) / sizeof(g_models[0]);
+static size_t g_rgb_model_index = (size_t)-1;
+static size_t g_alpha_model_index = (size_t)-1;
+static struct session_tuning g_tuning = {0}; // the models were loaded with
+
+// Progress of the inference thread. It only touches these atomics per tile, and the UI thread drains them on
+// a timer, so inference never waits for painting and painting never waits for a tile.
+static atomic_bool g_cancel;
+static atomic_size_t g_progress;
+static atomic_size_t g_progress_total;
+// Single-producer single-consumer ring of destination rectangles written since the last drain.
+static struct dirty_rect {
+  size_t x;
+  size_t y;
+  size_t w;
+  size_t h;
+} g_dirty_rects[dirty_queue_size];
+static atomic_size_t g_dirty_head; // advanced by the UI thread
+static atomic_size_t g_dirty_tail; // advanced by the inference thread
+static atomic_bool g_dirty_overflow;
+static struct dirty_rect g_pending_rect; // inference thread only, between lock_buffer and unlock_buffer
 
 static HFONT g_font = NULL;
 static HWND g_window = NULL;
@@ -174,6 +150,8 @@ static enum sr_state inline set_state(enum sr_state const state) {
   return state;
 }
 
+static inline int imax(int const a, int const b) { return a > b ? a : b; }
+
 static LRESULT CALLBACK image_preview_proc(HWND window, UINT msg, WPARAM wparam, LPARAM lparam) {
   static bool dragging = false;
   static LPARAM dragging_pos = 0;
@@ -288,12 +266,12 @@ static LRESULT CALLBACK image_preview_proc(HWND window, UINT msg, WPARAM wparam,
                         ofsx,
                         ymax - r.bottom + r.top - ofsy,
                         0,
-                        (DWORD)g_source_height * 4,
+                        (DWORD)g_destination_height,
                         g_destination_image,
                         (BITMAPINFO *)&(BITMAPV4HEADER){
                             .bV4Size = sizeof(BITMAPV4HEADER),
-                            .bV4Width = (LONG)g_source_width * 4,
-                            .bV4Height = -(LONG)g_source_height * 4,
+                            .bV4Width = (LONG)g_destination_width,
+                            .bV4Height = -(LONG)g_destination_height,
                             .bV4Planes = 1,
                             .bV4BitCount = 32,
                             .bV4V4Compression = BI_BITFIELDS,
@@ -303,6 +281,15 @@ static LRESULT CALLBACK image_preview_proc(HWND window, UINT msg, WPARAM wparam,
                             .bV4AlphaMask = 0xFF000000,
                         },
                         DIB_RGB_COLORS);
+      // tiles in view are upscaled first, so follow the scroll position while processing
+      if (g_source_width && g_destination_width >= g_source_width) {
+        size_t const scale = g_destination_width / g_source_width;
+        session_set_viewport(g_session,
+                             (size_t)imax(ofsx, 0) / scale,
+                             (size_t)imax(ofsy, 0) / scale,
+                             (size_t)imax(r.right - r.left, 1) / scale + 1,
+                             (size_t)imax(r.bottom - r.top, 1) / scale + 1);
+      }
       mtx_unlock(&g_mtx);
     }
     EndPaint(window, &ps);
@@ -316,8 +303,6 @@ static LRESULT CALLBACK image_preview_proc(HWND window, UINT msg, WPARAM wparam,
   return DefWindowProcW(window, msg, wparam, lparam);
 }
 
-static inline int imax(int const a, int const b) { return a > b ? a : b; }
-
 static void update_preview(void) {
   RECT r;
   GetClientRect(g_image_preview, &r);
@@ -325,14 +310,14 @@ static void update_preview(void) {
                 SB_HORZ,
                 &(SCROLLINFO){.fMask = SIF_RANGE | SIF_PAGE | SIF_DISABLENOSCROLL,
                               .nMin = 0,
-                              .nMax = (int)g_source_width * 4,
+                              .nMax = (int)g_destination_width,
                               .nPage = (UINT)(r.right - r.left)},
                 TRUE);
   SetScrollInfo(g_image_preview,
                 SB_VERT,
                 &(SCROLLINFO){.fMask = SIF_RANGE | SIF_PAGE | SIF_DISABLENOSCROLL,
                               .nMin = 0,
-                              .nMax = (int)g_source_height * 4,
+                              .nMax = (int)g_destination_height,
                               .nPage = (UINT)(r.bottom - r.top)},
                 TRUE);
 }
@@ -418,13 +403,16 @@ static void on_dpi_changed(void) {
     model_label_max_width = imax(sz1.cx, sz2.cx);
 
     model_combo_box_width = 0;
-    for (size_t i = 0; i < sizeof(g_models) / sizeof(g_models[0]); ++i) {
-      GetTextExtentPoint32W(hdc, g_models[i].rgb_description, (int)SR_STRLEN(g_models[i].rgb_description), &sz1);
-      GetTextExtentPoint32W(hdc, g_models[i].alpha_description, (int)SR_STRLEN(g_models[i].alpha_description), &sz2);
+    for (size_t i = 0; i < g_manifest.num_models; ++i) {
+      struct model_info const *const m = &g_manifest.models[i];
+      GetTextExtentPoint32W(hdc, m->rgb_description, (int)SR_STRLEN(m->rgb_description), &sz1);
+      GetTextExtentPoint32W(hdc, m->alpha_description, (int)SR_STRLEN(m->alpha_description), &sz2);
       model_combo_box_width = imax(model_combo_box_width, imax(sz1.cx, sz2.cx));
     }
-    for (size_t i = 0; i < sizeof(g_model_presets) / sizeof(g_model_presets[0]); ++i) {
-      GetTextExtentPoint32W(hdc, g_model_presets[i].name, (int)SR_STRLEN(g_model_presets[i].name), &sz1);
+    GetTextExtentPoint32W(hdc, g_model_preset_placeholder_text, (int)SR_STRLEN(g_model_preset_placeholder_text), &sz1);
+    model_combo_box_width = imax(model_combo_box_width, model_group_label_width + sz1.cx);
+    for (size_t i = 0; i < g_manifest.num_presets; ++i) {
+      GetTextExtentPoint32W(hdc, g_manifest.presets[i].name, (int)SR_STRLEN(g_manifest.presets[i].name), &sz1);
       model_combo_box_width = imax(model_combo_box_width, model_group_label_width + sz1.cx);
     }
     model_combo_box_width += MulDiv(16, dpi, 96);
@@ -591,6 +579,14 @@ static bool enum_dml_device_callback(UINT const device_id, DXGI_ADAPTER_DESC con
 static bool on_create(void) {
   // DwmSetWindowAttribute(window, 20, &(BOOL){TRUE}, sizeof(BOOL));
 
+  {
+    SR_CHAR_T error_msg[256] = {0};
+    if (!manifest_load(&g_manifest, MANIFEST_DEFAULT_PATH, error_msg)) {
+      MessageBoxW(g_window, error_msg, SR_TSTR("Error"), MB_ICONERROR);
+      return false;
+    }
+  }
+
   {
     SR_CHAR_T error_msg[256] = {0};
     g_session = session_create(error_msg);
@@ -650,8 +646,9 @@ static bool on_create(void) {
                                   hinstance,
                                   NULL);
 
-  for (size_t i = 0; i < sizeof(g_model_presets) / sizeof(g_model_presets[0]); ++i) {
-    SendMessageW(g_model_preset_combo_box, CB_ADDSTRING, 0, (LPARAM)g_model_presets[i].name);
+  SendMessageW(g_model_preset_combo_box, CB_ADDSTRING, 0, (LPARAM)g_model_preset_placeholder_text);
+  for (size_t i = 0; i < g_manifest.num_presets; ++i) {
+    SendMessageW(g_model_preset_combo_box, CB_ADDSTRING, 0, (LPARAM)g_manifest.presets[i].name);
   }
   SendMessageW(g_model_preset_combo_box, CB_SETCURSEL, 0, 0);
 
@@ -704,9 +701,9 @@ static bool on_create(void) {
                                             hinstance,
                                             NULL);
 
-  for (size_t i = 0; i < sizeof(g_models) / sizeof(g_models[0]); ++i) {
-    SendMessageW(g_model_rgb_combo_box, CB_ADDSTRING, 0, (LPARAM)g_models[i].rgb_description);
-    SendMessageW(g_model_alpha_combo_box, CB_ADDSTRING, 0, (LPARAM)g_models[i].alpha_description);
+  for (size_t i = 0; i < g_manifest.num_models; ++i) {
+    SendMessageW(g_model_rgb_combo_box, CB_ADDSTRING, 0, (LPARAM)g_manifest.models[i].rgb_description);
+    SendMessageW(g_model_alpha_combo_box, CB_ADDSTRING, 0, (LPARAM)g_manifest.models[i].alpha_description);
   }
   SendMessageW(g_model_rgb_combo_box, CB_SETCURSEL, 0, 0);
   SendMessageW(g_model_alpha_combo_box, CB_SETCURSEL, 0, 0);
@@ -839,9 +836,10 @@ static void on_combo_box_notify(HWND const window, WORD const id, WORD notify, H
       break;
     case model_preset_combo_box_id: {
       size_t const idx = (size_t)(SendMessageW(g_model_preset_combo_box, CB_GETCURSEL, 0, 0));
-      if (idx && idx < sizeof(g_model_presets) / sizeof(g_model_presets[0])) {
-        SendMessageW(g_model_rgb_combo_box, CB_SETCURSEL, g_model_presets[idx].rgb_index, 0);
-        SendMessageW(g_model_alpha_combo_box, CB_SETCURSEL, g_model_presets[idx].alpha_index, 0);
+      // the first item is the placeholder
+      if (idx && idx <= g_manifest.num_presets) {
+        SendMessageW(g_model_rgb_combo_box, CB_SETCURSEL, g_manifest.presets[idx - 1].rgb_index, 0);
+        SendMessageW(g_model_alpha_combo_box, CB_SETCURSEL, g_manifest.presets[idx - 1].alpha_index, 0);
       }
     } break;
     }
@@ -987,7 +985,7 @@ static void save_image(HWND const window) {
   if (!filename) {
     return;
   }
-  if (!image_save(filename, g_destination_image, g_source_width * 4, g_source_height * 4)) {
+  if (!image_save(filename, g_destination_image, g_destination_width, g_destination_height)) {
     msg = SR_TSTR("failed to save image.");
     goto cleanup;
   }
@@ -1002,32 +1000,62 @@ cleanup:
 
 static bool lock_buffer(
     size_t const x, size_t const y, size_t const w, size_t const h, size_t const progress, size_t const total, void *const userdata) {
-  (void)x;
-  (void)y;
-  (void)w;
-  (void)h;
   (void)userdata;
-  PostMessageW(g_window, WM_UPDATE_PROGRESS, (WPARAM)progress, (LPARAM)total);
-  SR_CHAR_T buf[256];
-  ov_snprintf(buf, sizeof(buf) / sizeof(buf[0]), NULL, SR_TSTR("処理中... (%d/%d)"), (int)progress, (int)total);
-  SetWindowTextW(g_progress_description, buf);
-  mtx_lock(&g_mtx);
-  if (g_state != sr_processing) {
-    mtx_unlock(&g_mtx);
-    return false;
-  }
+  g_pending_rect = (struct dirty_rect){x, y, w, h};
+  atomic_store_explicit(&g_progress_total, total, memory_order_relaxed);
+  atomic_store_explicit(&g_progress, progress, memory_order_relaxed);
   return true;
 }
 
+// The destination is written without g_mtx, so a paint may catch a tile half-written;
+// its rectangle is queued here and repainted on the next tick.
 static void unlock_buffer(void *const userdata) {
   (void)userdata;
-  mtx_unlock(&g_mtx);
-  InvalidateRect(g_image_preview, NULL, TRUE);
+  size_t const tail = atomic_load_explicit(&g_dirty_tail, memory_order_relaxed);
+  if (tail - atomic_load_explicit(&g_dirty_head, memory_order_acquire) == dirty_queue_size) {
+    atomic_store_explicit(&g_dirty_overflow, true, memory_order_relaxed);
+    return;
+  }
+  g_dirty_rects[tail % dirty_queue_size] = g_pending_rect;
+  atomic_store_explicit(&g_dirty_tail, tail + 1, memory_order_release);
+}
+
+// Runs on the UI thread at a fixed rate while processing.
+static void drain_progress(void) {
+  static size_t last_total = 0;
+  size_t const total = atomic_load_explicit(&g_progress_total, memory_order_relaxed);
+  size_t const progress = atomic_load_explicit(&g_progress, memory_order_relaxed);
+  if (total) {
+    if (total != last_total) {
+      SendMessageW(g_window, WM_UPDATE_PROGRESS, 0, (LPARAM)total);
+      last_total = total;
+    }
+    SendMessageW(g_window, WM_UPDATE_PROGRESS, (WPARAM)progress, (LPARAM)total);
+    SR_CHAR_T buf[256];
+    ov_snprintf(buf, sizeof(buf) / sizeof(buf[0]), NULL, SR_TSTR("処理中... (%d/%d)"), (int)progress, (int)total);
+    SetWindowTextW(g_progress_description, buf);
+  }
+
+  size_t head = atomic_load_explicit(&g_dirty_head, memory_order_relaxed);
+  size_t const tail = atomic_load_explicit(&g_dirty_tail, memory_order_acquire);
+  if (atomic_exchange_explicit(&g_dirty_overflow, false, memory_order_relaxed)) {
+    InvalidateRect(g_image_preview, NULL, TRUE);
+    head = tail;
+  }
+  int const ofsx = GetScrollPos(g_image_preview, SB_HORZ);
+  int const ofsy = GetScrollPos(g_image_preview, SB_VERT);
+  for (; head != tail; ++head) {
+    struct dirty_rect const *const d = &g_dirty_rects[head % dirty_queue_size];
+    int const x = (int)d->x - ofsx, y = (int)d->y - ofsy;
+    InvalidateRect(g_image_preview, &(RECT){x, y, x + (int)d->w, y + (int)d->h}, FALSE);
+  }
+  atomic_store_explicit(&g_dirty_head, head, memory_order_release);
 }
 
 static int start(void *const userdata) {
   (void)userdata;
   error err = eok();
+  bool loading_models = false;
 
   PostMessageW(g_window, WM_UPDATE_PROGRESS, 0, 0);
 
@@ -1072,108 +1100,206 @@ static int start(void *const userdata) {
     goto cleanup;
   }
 
-  // load image and allocate memory for destination image
+  // models run with the tuning sr --autotune stored for the RGB model on this device, a different one reloads both
+  {
+    size_t const rgb_idx = (size_t)(SendMessageW(g_model_rgb_combo_box, CB_GETCURSEL, 0, 0));
+    struct session_tuning tuning = {0};
+    SR_CHAR_T path[MAX_PATH];
+    SR_CHAR_T error_msg[256] = {0};
+    struct profile profile = {0};
+    if (rgb_idx < g_manifest.num_models && profile_get_default_path(path, MAX_PATH) && profile_load(&profile, path, error_msg)) {
+      struct profile_entry const *const e = profile_find(&profile, g_manifest.models[rgb_idx].path, provider);
+      if (e != NULL) {
+        tuning = e->tuning;
+      }
+    }
+    profile_free(&profile);
+    if (tuning.tile_size != g_tuning.tile_size || tuning.batch_size != g_tuning.batch_size || tuning.threads != g_tuning.threads) {
+      // an unreadable or stale profile falls back to the defaults
+      if (!session_set_tuning(g_session, &tuning)) {
+        tuning = (struct session_tuning){0};
+        session_set_tuning(g_session, &tuning);
+      }
+      g_tuning = tuning;
+      g_rgb_model_index = (size_t)-1;
+      g_alpha_model_index = (size_t)-1;
+    }
+  }
+
+  size_t const rgb_idx = (size_t)(SendMessageW(g_model_rgb_combo_box, CB_GETCURSEL, 0, 0));
+  size_t const alpha_idx = (size_t)(SendMessageW(g_model_alpha_combo_box, CB_GETCURSEL, 0, 0));
+  if (rgb_idx >= g_manifest.num_models || alpha_idx >= g_manifest.num_models) {
+    err = emsg_i18nf(err_type_generic, err_unexpected, NULL, "invalid model index: %1$zu, %2$zu", rgb_idx, alpha_idx);
+    goto cleanup;
+  }
+  struct model_info const *const rgb_model = &g_manifest.models[rgb_idx];
+  struct model_info const *const alpha_model = &g_manifest.models[alpha_idx];
+
+  // the previous result can be patched instead of recomputed when only the image content changed
+  bool incremental =
+      g_destination_image_completed && !provider_changed && rgb_idx == g_rgb_model_index && alpha_idx == g_alpha_model_index;
+
+  // start building the models that changed, both at once and while the image is read
+  struct session_options const rgb_opts = {
+      .provider = *provider,
+      .input_name = rgb_model->input_name,
+      .output_name = rgb_model->output_name,
+      .scale = rgb_model->scale,
+      .channels = rgb_model->channels,
+      .fp16 = rgb_model->fp16,
+      .file =
+          {
+              .path = rgb_model->path,
+          },
+  };
+  struct session_options const alpha_opts = {
+      .provider = *provider,
+      .input_name = alpha_model->input_name,
+      .output_name = alpha_model->output_name,
+      .scale = alpha_model->scale,
+      .channels = alpha_model->channels,
+      .fp16 = alpha_model->fp16,
+      .file =
+          {
+              .path = alpha_model->path,
+          },
+  };
+  {
+    bool load_rgb = rgb_idx != g_rgb_model_index || provider_changed;
+    bool load_alpha = alpha_idx != g_alpha_model_index || provider_changed;
+    if (rgb_idx == alpha_idx && (load_rgb || load_alpha)) {
+      // loaded together, the session builds the model once and runs both on it
+      load_rgb = true;
+      load_alpha = true;
+    }
+    // an RGBA model takes both slots, so switching to or from one reloads both
+    bool const was_rgba = (g_rgb_model_index < g_manifest.num_models && g_manifest.models[g_rgb_model_index].channels == 4) ||
+                          (g_alpha_model_index < g_manifest.num_models && g_manifest.models[g_alpha_model_index].channels == 4);
+    if ((load_rgb || load_alpha) && (was_rgba || rgb_model->channels == 4 || alpha_model->channels == 4)) {
+      load_rgb = true;
+      load_alpha = true;
+    }
+    if (load_rgb || load_alpha) {
+      if (!session_load_models_async(g_session, load_rgb ? &rgb_opts : NULL, load_alpha ? &alpha_opts : NULL, NULL, NULL)) {
+        err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to load models: %ls", session_get_last_error(g_session));
+        goto cleanup;
+      }
+      loading_models = true;
+    }
+  }
+
+  // load image
   SetWindowTextW(g_progress_description, SR_TSTR("元画像を読み込み中..."));
   {
+    if (g_previous_source_image) {
+      image_free(g_previous_source_image);
+      g_previous_source_image = NULL;
+    }
     if (g_source_image) {
-      image_free(g_source_image);
+      if (incremental) {
+        g_previous_source_image = g_source_image;
+      } else {
+        image_free(g_source_image);
+      }
       g_source_image = NULL;
     }
+    g_destination_image_completed = false;
     size_t w, h;
     g_source_image = image_load(g_source_image_path, &w, &h);
     if (g_source_image == NULL) {
       err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to load image: %ls", g_source_image_path);
       goto cleanup;
     }
-    size_t const destination_pixels = w * 4 * 4 * h * 4;
-    err = OV_ARRAY_GROW(&g_destination_image, destination_pixels + 32);
-    if (efailed(err)) {
-      err = ethru(err);
-      goto cleanup;
+    if (w != g_source_width || h != g_source_height) {
+      incremental = false;
     }
-    OV_ARRAY_SET_LENGTH(g_destination_image, destination_pixels + 32);
     g_source_width = w;
     g_source_height = h;
-    update_preview();
-  }
-
-  if (get_state() != sr_processing) {
-    goto cleanup;
   }
 
-  // copy 4x
-  mtx_lock(&g_mtx);
-  image_nn4x(g_source_image, g_source_width, g_source_height, g_destination_image);
-  mtx_unlock(&g_mtx);
-  InvalidateRect(g_image_preview, NULL, TRUE);
-
   if (get_state() != sr_processing) {
     goto cleanup;
   }
 
-  // load rgb model
-  SetWindowTextW(g_progress_description, SR_TSTR("RGBモデルを読み込み中..."));
-  {
-    size_t const rgb_idx = (size_t)(SendMessageW(g_model_rgb_combo_box, CB_GETCURSEL, 0, 0));
-    if (rgb_idx >= sizeof(g_models) / sizeof(g_models[0])) {
-      err = emsg_i18nf(err_type_generic, err_unexpected, NULL, "invalid model index: %d", rgb_idx);
+  // wait for the models, they were built while the image was read
+  if (loading_models) {
+    SetWindowTextW(g_progress_description, SR_TSTR("モデルを読み込み中..."));
+    loading_models = false;
+    if (!session_wait_models(g_session)) {
+      err = emsg_i18nf(err_type_generic,
+                       err_fail,
+                       NULL,
+                       "failed to load models(%1$ls, %2$ls): %3$ls",
+                       rgb_model->path,
+                       alpha_model->path,
+                       session_get_last_error(g_session));
       goto cleanup;
     }
-    if (rgb_idx != g_rgb_model_index || provider_changed) {
-      if (!session_load_rgb_model(g_session,
-                                  &(struct session_options){
-                                      .provider = *provider,
-                                      .file =
-                                          {
-                                              .path = g_models[rgb_idx].path,
-                                          },
-
-                                  })) {
-        err = emsg_i18nf(err_type_generic,
-                         err_fail,
-                         NULL,
-                         "failed to load RGB model(%1$ls): %2$ls",
-                         g_models[rgb_idx].path,
-                         session_get_last_error(g_session));
-        goto cleanup;
-      }
-      g_rgb_model_index = rgb_idx;
-    }
+    g_rgb_model_index = rgb_idx;
+    g_alpha_model_index = alpha_idx;
   }
 
   if (get_state() != sr_processing) {
     goto cleanup;
   }
 
-  // load alpha model
-  SetWindowTextW(g_progress_description, SR_TSTR("Alphaモデルを読み込み中..."));
+  // allocate memory for destination image, its size depends on the scale of the loaded models
   {
-    size_t const alpha_idx = (size_t)(SendMessageW(g_model_alpha_combo_box, CB_GETCURSEL, 0, 0));
-    if (alpha_idx >= sizeof(g_models) / sizeof(g_models[0])) {
-      err = emsg_i18nf(err_type_generic, err_unexpected, NULL, "invalid model index: %d", alpha_idx);
+    size_t const scale = session_get_scale(g_session);
+    if (g_source_width > SIZE_MAX / 4 / scale / scale / g_source_height) {
+      err = emsg_i18nf(err_type_generic, err_fail, NULL, "image is too large: %zux%zu", g_source_width, g_source_height);
       goto cleanup;
     }
-    if (alpha_idx != g_alpha_model_index || provider_changed) {
-      if (!session_load_alpha_model(g_session,
-                                    &(struct session_options){
-                                        .provider = *provider,
-                                        .file =
-                                            {
-                                                .path = g_models[alpha_idx].path,
-                                            },
-
-                                    })) {
-        err = emsg_i18nf(err_type_generic,
-                         err_fail,
-                         NULL,
-                         "failed to load Alpha model(%1$ls): %2$ls",
-                         g_models[alpha_idx].path,
-                         session_get_last_error(g_session));
+    if (g_source_width * scale != g_destination_width || g_source_height * scale != g_destination_height) {
+      incremental = false;
+    }
+    size_t const destination_pixels = g_source_width * scale * 4 * g_source_height * scale;
+    // outputs larger than the available memory go to a temporary file instead, the OS pages tiles out as they
+    // are written and saving reads them back sequentially
+    MEMORYSTATUSEX ms = {.dwLength = sizeof(ms)};
+    bool const out_of_core = GlobalMemoryStatusEx(&ms) && destination_pixels + 32 > ms.ullAvailPhys / 2;
+    mtx_lock(&g_mtx);
+    if (out_of_core) {
+      if (g_destination_mapping.size != destination_pixels + 32) {
+        if (g_destination_mapping.ptr) {
+          mapping_close(&g_destination_mapping);
+        } else if (g_destination_image) {
+          OV_ARRAY_DESTROY(&g_destination_image);
+        }
+        g_destination_image = NULL;
+        incremental = false;
+        SR_CHAR_T error_msg[256];
+        if (!mapping_create_file(&g_destination_mapping, NULL, destination_pixels + 32, error_msg)) {
+          mtx_unlock(&g_mtx);
+          err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to create destination file: %ls", error_msg);
+          goto cleanup;
+        }
+        g_destination_image = g_destination_mapping.ptr;
+      }
+    } else {
+      if (g_destination_mapping.ptr) {
+        mapping_close(&g_destination_mapping);
+        g_destination_image = NULL;
+        incremental = false;
+      }
+      err = OV_ARRAY_GROW(&g_destination_image, destination_pixels + 32);
+      if (efailed(err)) {
+        mtx_unlock(&g_mtx);
+        err = ethru(err);
         goto cleanup;
       }
-      g_alpha_model_index = alpha_idx;
+      OV_ARRAY_SET_LENGTH(g_destination_image, destination_pixels + 32);
+    }
+    g_destination_width = g_source_width * scale;
+    g_destination_height = g_source_height * scale;
+    // fill with a nearest-neighbor upscale until inference replaces it
+    if (!incremental) {
+      image_nn(g_source_image, g_source_width, g_source_height, scale, g_destination_image);
     }
+    mtx_unlock(&g_mtx);
+    update_preview();
   }
+  InvalidateRect(g_image_preview, NULL, TRUE);
 
   if (get_state() != sr_processing) {
     goto cleanup;
@@ -1188,6 +1314,9 @@ static int start(void *const userdata) {
                                .channels = 4,
                                .source = g_source_image,
                                .destination = g_destination_image,
+                               .previous_source = incremental ? g_previous_source_image : NULL,
+                               .order = session_order_viewport,
+                               .cancel = &g_cancel,
                                .lock = lock_buffer,
                                .unlock = unlock_buffer,
                            })) {
@@ -1195,6 +1324,7 @@ static int start(void *const userdata) {
       goto cleanup;
     }
   }
+  g_destination_image_completed = get_state() == sr_processing;
   InvalidateRect(g_image_preview, NULL, TRUE);
 
 #if 0
@@ -1202,6 +1332,10 @@ static int start(void *const userdata) {
   printf("elapsed: %f\n", calc_elapsed(&start, &end));
 #endif
 cleanup:
+  if (loading_models) {
+    // the options live on this stack
+    session_wait_models(g_session);
+  }
   SetWindowTextW(g_progress_description, SR_TSTR(""));
   PostMessageW(g_window, WM_UPDATE_PROGRESS, 100, 100);
   if (efailed(err)) {
@@ -1225,10 +1359,14 @@ static void on_button_notify(HWND const window, WORD const id, WORD notify, HWND
       mtx_lock(&g_mtx);
       if (g_state == sr_processing) {
         g_state = sr_aborting;
+        atomic_store(&g_cancel, true);
         mtx_unlock(&g_mtx);
         SendMessageW(window, WM_CHANGE_STATE, (WPARAM)sr_aborting, 0);
       } else {
         g_state = sr_processing;
+        atomic_store(&g_cancel, false);
+        atomic_store(&g_progress, 0);
+        atomic_store(&g_progress_total, 0);
         mtx_unlock(&g_mtx);
         SendMessageW(window, WM_CHANGE_STATE, (WPARAM)sr_processing, 0);
         if (thrd_create(&g_thrd, start, (void *)window) == thrd_error) {
@@ -1250,13 +1388,20 @@ static void on_destroy(void) {
     DeleteObject(g_font);
     g_font = NULL;
   }
-  if (g_destination_image) {
+  if (g_destination_mapping.ptr) {
+    mapping_close(&g_destination_mapping);
+    g_destination_image = NULL;
+  } else if (g_destination_image) {
     OV_ARRAY_DESTROY(&g_destination_image);
   }
   if (g_source_image) {
     image_free(g_source_image);
     g_source_image = NULL;
   }
+  if (g_previous_source_image) {
+    image_free(g_previous_source_image);
+    g_previous_source_image = NULL;
+  }
   if (g_source_image_path) {
     OV_ARRAY_DESTROY(&g_source_image_path);
   }
@@ -1271,6 +1416,7 @@ static void on_destroy(void) {
     session_destroy(g_session);
     g_session = NULL;
   }
+  manifest_free(&g_manifest);
 }
 
 static LRESULT CALLBACK window_proc(HWND window, UINT msg, WPARAM wparam, LPARAM lparam) {
@@ -1290,6 +1436,7 @@ static LRESULT CALLBACK window_proc(HWND window, UINT msg, WPARAM wparam, LPARAM
     mtx_lock(&g_mtx);
     if (g_state == sr_processing) {
       g_state = sr_closing;
+      atomic_store(&g_cancel, true);
       mtx_unlock(&g_mtx);
       return 0;
     }
@@ -1318,8 +1465,14 @@ static LRESULT CALLBACK window_proc(HWND window, UINT msg, WPARAM wparam, LPARAM
   case WM_SIZE:
     on_dpi_changed();
     break;
+  case WM_TIMER:
+    if (wparam == progress_timer_id) {
+      drain_progress();
+    }
+    break;
   case WM_THREAD_COMPLETE:
     thrd_detach(g_thrd);
+    drain_progress();
     if (get_state() == sr_closing) {
       DestroyWindow(window);
     } else {
@@ -1363,6 +1516,11 @@ static LRESULT CALLBACK window_proc(HWND window, UINT msg, WPARAM wparam, LPARAM
     EnableWindow(g_start_button, s == sr_ready || s == sr_processing || s == sr_completed);
     SetWindowTextW(g_start_button, s == sr_processing ? g_abort_button_text : g_start_button_text);
     EnableWindow(g_save_button, s == sr_completed);
+    if (s == sr_processing) {
+      SetTimer(window, progress_timer_id, progress_timer_interval, NULL);
+    } else if (s != sr_aborting) {
+      KillTimer(window, progress_timer_id);
+    }
 
   } break;
   default:
@@ -1382,6 +1540,7 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCmdLi
   mtx_init(&g_mtx, mtx_plain);
 
   ATOM atom = 0;
+  int exit_code = 0;
 
   g_ort = OrtGetApiBase()->GetApi(ORT_API_VERSION);
   if (!g_ort) {
@@ -1389,6 +1548,19 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCmdLi
     goto cleanup;
   }
 
+  {
+    int argc = 0;
+    LPWSTR *argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+    if (argv != NULL && argc > 1) {
+      exit_code = cli_main(argc, argv);
+      LocalFree(argv);
+      goto cleanup;
+    }
+    if (argv != NULL) {
+      LocalFree(argv);
+    }
+  }
+
   static wchar_t const window_class_name[] = L"sr";
   atom = RegisterClassExW(&(WNDCLASSEXW){
       .cbSize = sizeof(WNDCLASSEXW),
@@ -1443,5 +1615,5 @@ cleanup:
   mtx_destroy(&g_mtx);
   CoUninitialize();
   ov_exit();
-  return 0;
+  return exit_code;
 }
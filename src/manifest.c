@@ -0,0 +1,739 @@
+#include "manifest.h"
+
+#include <ovprintf.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#  include <windows.h>
+#endif
+
+struct parser {
+  char const *begin;
+  char const *p;
+  char const *end;
+  SR_CHAR_T const *msg; // first error, NULL while parsing succeeds
+};
+
+static bool fail(struct parser *const ps, SR_CHAR_T const *const msg) {
+  if (ps->msg == NULL) {
+    ps->msg = msg;
+  }
+  return false;
+}
+
+static void skip_ws(struct parser *const ps) {
+  while (ps->p < ps->end && (*ps->p == ' ' || *ps->p == '\t' || *ps->p == '\n' || *ps->p == '\r')) {
+    ++ps->p;
+  }
+}
+
+static bool peek(struct parser *const ps, char const c) {
+  skip_ws(ps);
+  return ps->p < ps->end && *ps->p == c;
+}
+
+static bool expect(struct parser *const ps, char const c) {
+  if (!peek(ps, c)) {
+    return fail(ps, SR_TSTR("unexpected character."));
+  }
+  ++ps->p;
+  return true;
+}
+
+static int hex_digit(char const c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+static bool parse_hex4(struct parser *const ps, uint32_t *const v) {
+  if (ps->end - ps->p < 4) {
+    return fail(ps, SR_TSTR("invalid escape sequence."));
+  }
+  uint32_t r = 0;
+  for (size_t i = 0; i < 4; ++i) {
+    int const d = hex_digit(*ps->p++);
+    if (d < 0) {
+      return fail(ps, SR_TSTR("invalid escape sequence."));
+    }
+    r = (r << 4) | (uint32_t)d;
+  }
+  *v = r;
+  return true;
+}
+
+static size_t put_utf8(char *const d, uint32_t const cp) {
+  if (cp < 0x80) {
+    d[0] = (char)cp;
+    return 1;
+  }
+  if (cp < 0x800) {
+    d[0] = (char)(0xc0 | (cp >> 6));
+    d[1] = (char)(0x80 | (cp & 0x3f));
+    return 2;
+  }
+  if (cp < 0x10000) {
+    d[0] = (char)(0xe0 | (cp >> 12));
+    d[1] = (char)(0x80 | ((cp >> 6) & 0x3f));
+    d[2] = (char)(0x80 | (cp & 0x3f));
+    return 3;
+  }
+  d[0] = (char)(0xf0 | (cp >> 18));
+  d[1] = (char)(0x80 | ((cp >> 12) & 0x3f));
+  d[2] = (char)(0x80 | ((cp >> 6) & 0x3f));
+  d[3] = (char)(0x80 | (cp & 0x3f));
+  return 4;
+}
+
+// Parses a string into a newly allocated UTF-8 buffer, or skips it when out is NULL.
+static bool parse_string(struct parser *const ps, char **const out) {
+  if (!expect(ps, '"')) {
+    return false;
+  }
+  // decoded text is never longer than its source
+  char const *const start = ps->p;
+  char const *q = start;
+  while (q < ps->end && *q != '"') {
+    q += *q == '\\' && q + 1 < ps->end ? 2 : 1;
+  }
+  char *const s = malloc((size_t)(q - start) + 1);
+  if (s == NULL) {
+    return fail(ps, SR_TSTR("failed to allocate memory."));
+  }
+  size_t len = 0;
+  for (;;) {
+    if (ps->p >= ps->end) {
+      free(s);
+      return fail(ps, SR_TSTR("unterminated string."));
+    }
+    char const c = *ps->p++;
+    if (c == '"') {
+      break;
+    }
+    if ((unsigned char)c < 0x20) {
+      free(s);
+      return fail(ps, SR_TSTR("control character in string."));
+    }
+    if (c != '\\') {
+      s[len++] = c;
+      continue;
+    }
+    if (ps->p >= ps->end) {
+      free(s);
+      return fail(ps, SR_TSTR("unterminated string."));
+    }
+    char const e = *ps->p++;
+    switch (e) {
+    case '"':
+    case '\\':
+    case '/':
+      s[len++] = e;
+      break;
+    case 'b':
+      s[len++] = '\b';
+      break;
+    case 'f':
+      s[len++] = '\f';
+      break;
+    case 'n':
+      s[len++] = '\n';
+      break;
+    case 'r':
+      s[len++] = '\r';
+      break;
+    case 't':
+      s[len++] = '\t';
+      break;
+    case 'u': {
+      // \uXXXX is 6 bytes of source and at most 3 bytes of UTF-8, a surrogate pair is 12 and 4
+      uint32_t cp = 0;
+      if (!parse_hex4(ps, &cp)) {
+        free(s);
+        return false;
+      }
+      if (cp >= 0xd800 && cp < 0xdc00) {
+        uint32_t lo = 0;
+        if (ps->end - ps->p < 2 || ps->p[0] != '\\' || ps->p[1] != 'u') {
+          free(s);
+          return fail(ps, SR_TSTR("invalid surrogate pair."));
+        }
+        ps->p += 2;
+        if (!parse_hex4(ps, &lo)) {
+          free(s);
+          return false;
+        }
+        if (lo < 0xdc00 || lo >= 0xe000) {
+          free(s);
+          return fail(ps, SR_TSTR("invalid surrogate pair."));
+        }
+        cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+      } else if (cp >= 0xdc00 && cp < 0xe000) {
+        free(s);
+        return fail(ps, SR_TSTR("invalid surrogate pair."));
+      }
+      len += put_utf8(s + len, cp);
+    } break;
+    default:
+      free(s);
+      return fail(ps, SR_TSTR("invalid escape sequence."));
+    }
+  }
+  s[len] = '\0';
+  if (out) {
+    *out = s;
+  } else {
+    free(s);
+  }
+  return true;
+}
+
+static bool parse_size(struct parser *const ps, size_t *const v) {
+  skip_ws(ps);
+  size_t r = 0;
+  char const *const start = ps->p;
+  while (ps->p < ps->end && *ps->p >= '0' && *ps->p <= '9') {
+    size_t const d = (size_t)(*ps->p++ - '0');
+    if (r > (SIZE_MAX - d) / 10) {
+      return fail(ps, SR_TSTR("number is too large."));
+    }
+    r = r * 10 + d;
+  }
+  if (ps->p == start) {
+    return fail(ps, SR_TSTR("expected a non-negative integer."));
+  }
+  *v = r;
+  return true;
+}
+
+static bool parse_literal(struct parser *const ps, char const *const lit) {
+  skip_ws(ps);
+  size_t const len = strlen(lit);
+  if ((size_t)(ps->end - ps->p) < len || memcmp(ps->p, lit, len) != 0) {
+    return fail(ps, SR_TSTR("unexpected character."));
+  }
+  ps->p += len;
+  return true;
+}
+
+static bool parse_bool(struct parser *const ps, bool *const v) {
+  if (peek(ps, 't')) {
+    *v = true;
+    return parse_literal(ps, "true");
+  }
+  *v = false;
+  return parse_literal(ps, "false");
+}
+
+// Reads the next member name of an object whose '{' has been consumed.
+// Returns false at the closing '}' or on error, which the caller tells apart by ps->msg.
+static bool next_member(struct parser *const ps, size_t *const count, char **const key) {
+  if (peek(ps, '}')) {
+    ++ps->p;
+    return false;
+  }
+  if (*count && !expect(ps, ',')) {
+    return false;
+  }
+  if (!parse_string(ps, key)) {
+    return false;
+  }
+  if (!expect(ps, ':')) {
+    free(*key);
+    *key = NULL;
+    return false;
+  }
+  ++*count;
+  return true;
+}
+
+// Same as next_member for the elements of an array whose '[' has been consumed.
+static bool next_element(struct parser *const ps, size_t *const count) {
+  if (peek(ps, ']')) {
+    ++ps->p;
+    return false;
+  }
+  if (*count && !expect(ps, ',')) {
+    return false;
+  }
+  ++*count;
+  return true;
+}
+
+static bool skip_value(struct parser *const ps, size_t const depth) {
+  if (depth > 64) {
+    return fail(ps, SR_TSTR("nesting is too deep."));
+  }
+  skip_ws(ps);
+  if (ps->p >= ps->end) {
+    return fail(ps, SR_TSTR("unexpected end of file."));
+  }
+  size_t count = 0;
+  switch (*ps->p) {
+  case '"':
+    return parse_string(ps, NULL);
+  case '{': {
+    ++ps->p;
+    char *key = NULL;
+    while (next_member(ps, &count, &key)) {
+      free(key);
+      key = NULL;
+      if (!skip_value(ps, depth + 1)) {
+        return false;
+      }
+    }
+    return ps->msg == NULL;
+  }
+  case '[':
+    ++ps->p;
+    while (next_element(ps, &count)) {
+      if (!skip_value(ps, depth + 1)) {
+        return false;
+      }
+    }
+    return ps->msg == NULL;
+  case 't':
+    return parse_literal(ps, "true");
+  case 'f':
+    return parse_literal(ps, "false");
+  case 'n':
+    return parse_literal(ps, "null");
+  default:
+    break;
+  }
+  char const *const start = ps->p;
+  while (ps->p < ps->end && strchr("+-.0123456789eE", *ps->p) != NULL) {
+    ++ps->p;
+  }
+  return ps->p != start || fail(ps, SR_TSTR("unexpected character."));
+}
+
+static char *utf8_dup(char const *const s) {
+  size_t const n = strlen(s) + 1;
+  char *const r = malloc(n);
+  if (r) {
+    memcpy(r, s, n);
+  }
+  return r;
+}
+
+static SR_CHAR_T *tstr_dup(SR_CHAR_T const *const s) {
+  size_t const n = (SR_STRLEN(s) + 1) * sizeof(SR_CHAR_T);
+  SR_CHAR_T *const r = malloc(n);
+  if (r) {
+    memcpy(r, s, n);
+  }
+  return r;
+}
+
+static SR_CHAR_T *to_tstr(char const *const s) {
+#ifdef _WIN32
+  int const n = MultiByteToWideChar(CP_UTF8, 0, s, -1, NULL, 0);
+  if (n <= 0) {
+    return NULL;
+  }
+  SR_CHAR_T *const r = malloc((size_t)n * sizeof(SR_CHAR_T));
+  if (r == NULL) {
+    return NULL;
+  }
+  MultiByteToWideChar(CP_UTF8, 0, s, -1, r, n);
+  return r;
+#else
+  return utf8_dup(s);
+#endif
+}
+
+static bool parse_tstr(struct parser *const ps, SR_CHAR_T **const out) {
+  char *s = NULL;
+  if (!parse_string(ps, &s)) {
+    return false;
+  }
+  free(*out);
+  *out = to_tstr(s);
+  free(s);
+  return *out != NULL || fail(ps, SR_TSTR("invalid UTF-8 string."));
+}
+
+static bool parse_utf8(struct parser *const ps, char **const out) {
+  free(*out);
+  *out = NULL;
+  return parse_string(ps, out);
+}
+
+static bool is_absolute_path(SR_CHAR_T const *const path) {
+  if (path[0] == SR_TSTR('/') || path[0] == SR_TSTR('\\')) {
+    return true;
+  }
+  return path[0] != SR_TSTR('\0') && path[1] == SR_TSTR(':');
+}
+
+static SR_CHAR_T *resolve_path(SR_CHAR_T const *const manifest_path, SR_CHAR_T *const path) {
+  if (is_absolute_path(path)) {
+    return path;
+  }
+  SR_CHAR_T const *sep = SR_STRRCHR(manifest_path, SR_TSTR('/'));
+#ifdef _WIN32
+  SR_CHAR_T const *const bsep = SR_STRRCHR(manifest_path, SR_TSTR('\\'));
+  if (bsep != NULL && (sep == NULL || bsep > sep)) {
+    sep = bsep;
+  }
+#endif
+  if (sep == NULL) {
+    return path;
+  }
+  size_t const dirlen = (size_t)(sep - manifest_path) + 1;
+  size_t const len = SR_STRLEN(path);
+  SR_CHAR_T *const r = malloc((dirlen + len + 1) * sizeof(SR_CHAR_T));
+  if (r == NULL) {
+    free(path);
+    return NULL;
+  }
+  memcpy(r, manifest_path, dirlen * sizeof(SR_CHAR_T));
+  memcpy(r + dirlen, path, (len + 1) * sizeof(SR_CHAR_T));
+  free(path);
+  return r;
+}
+
+static void model_free(struct model_info *const m) {
+  free(m->name);
+  free(m->path);
+  free(m->rgb_description);
+  free(m->alpha_description);
+  free(m->input_name);
+  free(m->output_name);
+}
+
+static bool parse_model(struct parser *const ps, struct model_info *const m) {
+  *m = (struct model_info){
+      .scale = 4,
+      .channels = 3,
+  };
+  if (!expect(ps, '{')) {
+    return false;
+  }
+  size_t count = 0;
+  char *key = NULL;
+  while (next_member(ps, &count, &key)) {
+    bool ok = true;
+    if (strcmp(key, "name") == 0) {
+      ok = parse_tstr(ps, &m->name);
+    } else if (strcmp(key, "path") == 0) {
+      ok = parse_tstr(ps, &m->path);
+    } else if (strcmp(key, "rgb_description") == 0) {
+      ok = parse_tstr(ps, &m->rgb_description);
+    } else if (strcmp(key, "alpha_description") == 0) {
+      ok = parse_tstr(ps, &m->alpha_description);
+    } else if (strcmp(key, "input") == 0) {
+      ok = parse_utf8(ps, &m->input_name);
+    } else if (strcmp(key, "output") == 0) {
+      ok = parse_utf8(ps, &m->output_name);
+    } else if (strcmp(key, "scale") == 0) {
+      ok = parse_size(ps, &m->scale) && (m->scale != 0 || fail(ps, SR_TSTR("scale must not be 0.")));
+    } else if (strcmp(key, "tile_size") == 0) {
+      ok = parse_size(ps, &m->tile_size);
+    } else if (strcmp(key, "fp16") == 0) {
+      ok = parse_bool(ps, &m->fp16);
+    } else if (strcmp(key, "channels") == 0) {
+      char *s = NULL;
+      ok = parse_string(ps, &s);
+      if (ok) {
+        if (strcmp(s, "rgb") == 0) {
+          m->channels = 3;
+        } else if (strcmp(s, "rgba") == 0) {
+          m->channels = 4;
+        } else {
+          ok = fail(ps, SR_TSTR("unsupported channel layout."));
+        }
+        free(s);
+      }
+    } else if (strcmp(key, "speed") == 0) {
+      char *s = NULL;
+      ok = parse_string(ps, &s);
+      if (ok) {
+        if (strcmp(s, "normal") == 0) {
+          m->speed = model_speed_normal;
+        } else if (strcmp(s, "fast") == 0) {
+          m->speed = model_speed_fast;
+        } else if (strcmp(s, "slow") == 0) {
+          m->speed = model_speed_slow;
+        } else {
+          ok = fail(ps, SR_TSTR("unknown speed class."));
+        }
+        free(s);
+      }
+    } else {
+      ok = skip_value(ps, 0);
+    }
+    free(key);
+    key = NULL;
+    if (!ok) {
+      return false;
+    }
+  }
+  if (ps->msg != NULL) {
+    return false;
+  }
+  if (m->name == NULL || m->path == NULL) {
+    return fail(ps, SR_TSTR("model needs a name and a path."));
+  }
+  if (m->input_name == NULL) {
+    m->input_name = utf8_dup("input");
+  }
+  if (m->output_name == NULL) {
+    m->output_name = utf8_dup("output");
+  }
+  if (m->rgb_description == NULL) {
+    m->rgb_description = tstr_dup(m->name);
+  }
+  if (m->alpha_description == NULL && m->rgb_description != NULL) {
+    m->alpha_description = tstr_dup(m->rgb_description);
+  }
+  if (m->input_name == NULL || m->output_name == NULL || m->rgb_description == NULL || m->alpha_description == NULL) {
+    return fail(ps, SR_TSTR("failed to allocate memory."));
+  }
+  return true;
+}
+
+struct preset_names {
+  SR_CHAR_T *rgb;
+  SR_CHAR_T *alpha;
+};
+
+static bool parse_preset(struct parser *const ps, struct model_preset *const p, struct preset_names *const names) {
+  if (!expect(ps, '{')) {
+    return false;
+  }
+  size_t count = 0;
+  char *key = NULL;
+  while (next_member(ps, &count, &key)) {
+    bool ok = true;
+    if (strcmp(key, "name") == 0) {
+      ok = parse_tstr(ps, &p->name);
+    } else if (strcmp(key, "rgb") == 0) {
+      ok = parse_tstr(ps, &names->rgb);
+    } else if (strcmp(key, "alpha") == 0) {
+      ok = parse_tstr(ps, &names->alpha);
+    } else {
+      ok = skip_value(ps, 0);
+    }
+    free(key);
+    key = NULL;
+    if (!ok) {
+      return false;
+    }
+  }
+  if (ps->msg != NULL) {
+    return false;
+  }
+  if (p->name == NULL || names->rgb == NULL) {
+    return fail(ps, SR_TSTR("preset needs a name and an rgb model."));
+  }
+  return true;
+}
+
+static bool find_index(struct model_manifest const *const manifest, SR_CHAR_T const *const name, size_t *const index) {
+  struct model_info const *const m = manifest_find(manifest, name);
+  if (m == NULL) {
+    return false;
+  }
+  *index = (size_t)(m - manifest->models);
+  return true;
+}
+
+static bool parse_manifest(struct parser *const ps, struct model_manifest *const manifest, SR_CHAR_T const *const path) {
+  if (!expect(ps, '{')) {
+    return false;
+  }
+  size_t count = 0;
+  char *key = NULL;
+  bool seen_models = false, seen_presets = false;
+  while (next_member(ps, &count, &key)) {
+    bool const models = strcmp(key, "models") == 0;
+    bool const presets = strcmp(key, "presets") == 0;
+    free(key);
+    key = NULL;
+    if (!models && !presets) {
+      if (!skip_value(ps, 0)) {
+        return false;
+      }
+      continue;
+    }
+    // a second array would be appended from index 0 again, over entries the presets already point to
+    if ((models && seen_models) || (presets && seen_presets)) {
+      return fail(ps, models ? SR_TSTR("duplicate models key.") : SR_TSTR("duplicate presets key."));
+    }
+    seen_models = seen_models || models;
+    seen_presets = seen_presets || presets;
+    if (!expect(ps, '[')) {
+      return false;
+    }
+    size_t n = 0;
+    while (next_element(ps, &n)) {
+      if (models) {
+        struct model_info *const a = realloc(manifest->models, n * sizeof(struct model_info));
+        if (a == NULL) {
+          return fail(ps, SR_TSTR("failed to allocate memory."));
+        }
+        manifest->models = a;
+        bool const ok = parse_model(ps, &a[n - 1]);
+        manifest->num_models = n;
+        if (!ok) {
+          return false;
+        }
+        a[n - 1].path = resolve_path(path, a[n - 1].path);
+        if (a[n - 1].path == NULL) {
+          return fail(ps, SR_TSTR("failed to allocate memory."));
+        }
+        if (manifest_find(manifest, a[n - 1].name) != &a[n - 1]) {
+          return fail(ps, SR_TSTR("duplicate model name."));
+        }
+      } else {
+        struct model_preset *const a = realloc(manifest->presets, n * sizeof(struct model_preset));
+        if (a == NULL) {
+          return fail(ps, SR_TSTR("failed to allocate memory."));
+        }
+        manifest->presets = a;
+        a[n - 1] = (struct model_preset){0};
+        manifest->num_presets = n;
+        struct preset_names names = {0};
+        bool ok = parse_preset(ps, &a[n - 1], &names);
+        if (ok) {
+          ok = find_index(manifest, names.rgb, &a[n - 1].rgb_index) &&
+               find_index(manifest, names.alpha ? names.alpha : names.rgb, &a[n - 1].alpha_index);
+          if (!ok) {
+            fail(ps, SR_TSTR("preset refers to an unknown model, presets must follow the models."));
+          }
+        }
+        free(names.rgb);
+        free(names.alpha);
+        if (!ok) {
+          return false;
+        }
+      }
+    }
+    if (ps->msg != NULL) {
+      return false;
+    }
+  }
+  if (ps->msg != NULL) {
+    return false;
+  }
+  skip_ws(ps);
+  if (ps->p != ps->end) {
+    return fail(ps, SR_TSTR("trailing characters after the manifest."));
+  }
+  if (manifest->num_models == 0) {
+    return fail(ps, SR_TSTR("manifest has no models."));
+  }
+  return true;
+}
+
+static char *read_file(SR_CHAR_T const *const path, size_t *const len) {
+#ifdef _WIN32
+  FILE *f = _wfopen(path, L"rb");
+#else
+  FILE *f = fopen(path, "rb");
+#endif
+  if (f == NULL) {
+    return NULL;
+  }
+  char *buf = NULL;
+  if (fseek(f, 0, SEEK_END) != 0) {
+    goto cleanup;
+  }
+  long const size = ftell(f);
+  if (size < 0 || fseek(f, 0, SEEK_SET) != 0) {
+    goto cleanup;
+  }
+  buf = malloc((size_t)size + 1);
+  if (buf == NULL) {
+    goto cleanup;
+  }
+  if (fread(buf, 1, (size_t)size, f) != (size_t)size) {
+    free(buf);
+    buf = NULL;
+    goto cleanup;
+  }
+  buf[size] = '\0';
+  *len = (size_t)size;
+cleanup:
+  fclose(f);
+  return buf;
+}
+
+bool manifest_load(struct model_manifest *const manifest, SR_CHAR_T const *const path, SR_CHAR_T error_msg[256]) {
+  if (manifest == NULL || path == NULL) {
+    error_msg[sr_append(error_msg, SR_TSTR("invalid parameter."))] = SR_TSTR('\0');
+    return false;
+  }
+  *manifest = (struct model_manifest){0};
+  size_t len = 0;
+  char *const buf = read_file(path, &len);
+  if (buf == NULL) {
+    ov_snprintf(error_msg, 256, NULL, SR_TSTR("failed to read model manifest: %ls"), path);
+    return false;
+  }
+  struct parser ps = {
+      .begin = buf,
+      .p = buf,
+      .end = buf + len,
+  };
+  if (len >= 3 && memcmp(buf, "\xef\xbb\xbf", 3) == 0) {
+    ps.p += 3;
+  }
+  if (!parse_manifest(&ps, manifest, path)) {
+    size_t line = 1;
+    for (char const *c = ps.begin; c < ps.p && c < ps.end; ++c) {
+      if (*c == '\n') {
+        ++line;
+      }
+    }
+    ov_snprintf(error_msg, 256, NULL, SR_TSTR("%ls(%zu): %ls"), path, line, ps.msg);
+    manifest_free(manifest);
+    free(buf);
+    return false;
+  }
+  free(buf);
+  return true;
+}
+
+void manifest_free(struct model_manifest *const manifest) {
+  if (manifest == NULL) {
+    return;
+  }
+  for (size_t i = 0; i < manifest->num_models; ++i) {
+    model_free(&manifest->models[i]);
+  }
+  for (size_t i = 0; i < manifest->num_presets; ++i) {
+    free(manifest->presets[i].name);
+  }
+  free(manifest->models);
+  free(manifest->presets);
+  *manifest = (struct model_manifest){0};
+}
+
+struct model_info const *manifest_find(struct model_manifest const *const manifest, SR_CHAR_T const *const name) {
+  if (manifest == NULL || name == NULL) {
+    return NULL;
+  }
+  for (size_t i = 0; i < manifest->num_models; ++i) {
+#ifdef _WIN32
+    bool const same = wcscmp(manifest->models[i].name, name) == 0;
+#else
+    bool const same = strcmp(manifest->models[i].name, name) == 0;
+#endif
+    if (same) {
+      return &manifest->models[i];
+    }
+  }
+  return NULL;
+}
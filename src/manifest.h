@@ -0,0 +1,67 @@
+#pragma once
+
+#include "common.h"
+
+// Models and presets are described by a JSON manifest instead of being compiled in:
+//
+//   {
+//     "models": [
+//       {
+//         "name": "realesr-general-x4v3",
+//         "path": "realesrgan/realesr-general-x4v3.onnx",
+//         "rgb_description": "...",
+//         "alpha_description": "...",
+//         "scale": 4,
+//         "input": "input",
+//         "output": "output",
+//         "channels": "rgb",
+//         "tile_size": 128,
+//         "fp16": false,
+//         "speed": "normal"
+//       }
+//     ],
+//     "presets": [{"name": "...", "rgb": "realesr-general-x4v3", "alpha": "realesr-general-x4v3"}]
+//   }
+//
+// Only name and path are required, relative paths are resolved against the directory of the manifest.
+
+// The manifest shipped with the models, relative to the working directory.
+#define MANIFEST_DEFAULT_PATH SR_TSTR("models/models.json")
+
+enum model_speed {
+  model_speed_normal,
+  model_speed_fast,
+  model_speed_slow,
+};
+
+struct model_info {
+  SR_CHAR_T *name;
+  SR_CHAR_T *path;
+  SR_CHAR_T *rgb_description;   // defaults to name
+  SR_CHAR_T *alpha_description; // defaults to rgb_description
+  char *input_name;             // tensor names are UTF-8 as onnxruntime expects, defaults to "input"
+  char *output_name;            // defaults to "output"
+  size_t scale;                 // defaults to 4
+  size_t channels;              // channels per input tensor, "rgb" is 3, "rgba" is 4 and serves as RGB and Alpha model
+  size_t tile_size;             // preferred tile size, 0 when the model has no preference
+  bool fp16;                    // the model takes and returns float16 tensors
+  enum model_speed speed;
+};
+
+struct model_preset {
+  SR_CHAR_T *name;
+  size_t rgb_index;
+  size_t alpha_index;
+};
+
+struct model_manifest {
+  struct model_info *models;
+  size_t num_models;
+  struct model_preset *presets;
+  size_t num_presets;
+};
+
+bool manifest_load(struct model_manifest *const manifest, SR_CHAR_T const *const path, SR_CHAR_T error_msg[256]);
+void manifest_free(struct model_manifest *const manifest);
+// Returns NULL if there is no model with that name.
+struct model_info const *manifest_find(struct model_manifest const *const manifest, SR_CHAR_T const *const name);
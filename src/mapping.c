@@ -0,0 +1,189 @@
+#include "mapping.h"
+
+#include <ovprintf.h>
+
+#include <windows.h>
+
+static bool parse_handle(SR_CHAR_T const *const name, HANDLE *const handle) {
+  static SR_CHAR_T const prefix[] = SR_TSTR("handle:");
+  size_t const prefix_len = sizeof(prefix) / sizeof(prefix[0]) - 1;
+  if (wcsncmp(name, prefix, prefix_len) != 0) {
+    return false;
+  }
+  SR_CHAR_T *end = NULL;
+  unsigned long long const v = wcstoull(name + prefix_len, &end, 0);
+  if (end == name + prefix_len || *end != SR_TSTR('\0') || v == 0) {
+    return false;
+  }
+  *handle = (HANDLE)(uintptr_t)v;
+  return true;
+}
+
+bool mapping_open(struct mapping *const mapping,
+                  SR_CHAR_T const *const name,
+                  size_t const size,
+                  bool const writable,
+                  SR_CHAR_T error_msg[256]) {
+  HANDLE h = NULL;
+  void *ptr = NULL;
+  SR_CHAR_T const *msg = NULL;
+  DWORD const access = writable ? FILE_MAP_WRITE : FILE_MAP_READ;
+
+  if (mapping == NULL || name == NULL || size == 0) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    msg = SR_TSTR("invalid parameter.");
+    goto cleanup;
+  }
+
+  HANDLE inherited = NULL;
+  if (parse_handle(name, &inherited)) {
+    if (!DuplicateHandle(GetCurrentProcess(), inherited, GetCurrentProcess(), &h, access, FALSE, 0)) {
+      msg = SR_TSTR("failed to duplicate mapping handle.");
+      goto cleanup;
+    }
+  } else {
+    h = OpenFileMappingW(access, FALSE, name);
+    if (h == NULL) {
+      msg = SR_TSTR("failed to open file mapping.");
+      goto cleanup;
+    }
+  }
+
+  ptr = MapViewOfFile(h, access, 0, 0, size);
+  if (ptr == NULL) {
+    msg = SR_TSTR("failed to map view of file.");
+    goto cleanup;
+  }
+
+  *mapping = (struct mapping){
+      .handle = h,
+      .ptr = ptr,
+      .size = size,
+  };
+
+cleanup:
+  if (msg != NULL) {
+    SR_CHAR_T errmsg[128];
+    DWORD const code = GetLastError();
+    FormatMessageW(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
+                   NULL,
+                   code,
+                   0,
+                   errmsg,
+                   sizeof(errmsg) / sizeof(errmsg[0]),
+                   NULL);
+    ov_snprintf(error_msg, 256, NULL, SR_TSTR("%ls: %ls(%d)"), msg, errmsg, (int)code);
+    if (ptr != NULL) {
+      UnmapViewOfFile(ptr);
+    }
+    if (h != NULL) {
+      CloseHandle(h);
+    }
+    return false;
+  }
+  return true;
+}
+
+bool mapping_create_file(struct mapping *const mapping, SR_CHAR_T const *const path, size_t const size, SR_CHAR_T error_msg[256]) {
+  HANDLE file = INVALID_HANDLE_VALUE;
+  HANDLE h = NULL;
+  void *ptr = NULL;
+  SR_CHAR_T const *msg = NULL;
+
+  if (mapping == NULL || size == 0) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    msg = SR_TSTR("invalid parameter.");
+    goto cleanup;
+  }
+
+  if (path != NULL) {
+    file = CreateFileW(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  } else {
+    SR_CHAR_T dir[MAX_PATH];
+    SR_CHAR_T name[MAX_PATH];
+    DWORD const len = GetTempPathW(MAX_PATH, dir);
+    if (len == 0 || len > MAX_PATH || GetTempFileNameW(dir, SR_TSTR("sr"), 0, name) == 0) {
+      msg = SR_TSTR("failed to create temporary file name.");
+      goto cleanup;
+    }
+    file = CreateFileW(name,
+                       GENERIC_READ | GENERIC_WRITE,
+                       FILE_SHARE_READ | FILE_SHARE_DELETE,
+                       NULL,
+                       CREATE_ALWAYS,
+                       FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE,
+                       NULL);
+  }
+  if (file == INVALID_HANDLE_VALUE) {
+    msg = SR_TSTR("failed to create file.");
+    goto cleanup;
+  }
+
+  // not every file system supports sparse files, the mapping works either way
+  DWORD bytes = 0;
+  DeviceIoControl(file, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &bytes, NULL);
+
+  // the file is extended to the size of the mapping
+  h = CreateFileMappingW(file, NULL, PAGE_READWRITE, (DWORD)((uint64_t)size >> 32), (DWORD)(size & 0xffffffff), NULL);
+  if (h == NULL) {
+    msg = SR_TSTR("failed to create file mapping.");
+    goto cleanup;
+  }
+
+  ptr = MapViewOfFile(h, FILE_MAP_WRITE, 0, 0, size);
+  if (ptr == NULL) {
+    msg = SR_TSTR("failed to map view of file.");
+    goto cleanup;
+  }
+
+  *mapping = (struct mapping){
+      .handle = h,
+      .ptr = ptr,
+      .size = size,
+      .file = file,
+  };
+
+cleanup:
+  if (msg != NULL) {
+    SR_CHAR_T errmsg[128];
+    DWORD const code = GetLastError();
+    FormatMessageW(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
+                   NULL,
+                   code,
+                   0,
+                   errmsg,
+                   sizeof(errmsg) / sizeof(errmsg[0]),
+                   NULL);
+    ov_snprintf(error_msg, 256, NULL, SR_TSTR("%ls: %ls(%d)"), msg, errmsg, (int)code);
+    if (ptr != NULL) {
+      UnmapViewOfFile(ptr);
+    }
+    if (h != NULL) {
+      CloseHandle(h);
+    }
+    if (file != INVALID_HANDLE_VALUE) {
+      CloseHandle(file);
+    }
+    return false;
+  }
+  return true;
+}
+
+void mapping_close(struct mapping *const mapping) {
+  if (mapping == NULL) {
+    return;
+  }
+  if (mapping->ptr != NULL) {
+    UnmapViewOfFile(mapping->ptr);
+    mapping->ptr = NULL;
+  }
+  if (mapping->handle != NULL) {
+    CloseHandle(mapping->handle);
+    mapping->handle = NULL;
+  }
+  if (mapping->file != NULL) {
+    CloseHandle(mapping->file);
+    mapping->file = NULL;
+  }
+  mapping->size = 0;
+}
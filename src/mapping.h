@@ -0,0 +1,26 @@
+#pragma once
+
+#include "common.h"
+
+// A view of a file mapping object shared with another process.
+// The mapping is identified either by its name or, when the name has the form "handle:<value>",
+// by an inherited handle value (the Windows counterpart of passing a memfd to a child process).
+struct mapping {
+  void *handle;
+  void *ptr;
+  size_t size;
+  void *file; // backing file created by mapping_create_file
+};
+
+bool mapping_open(struct mapping *const mapping,
+                  SR_CHAR_T const *const name,
+                  size_t const size,
+                  bool const writable,
+                  SR_CHAR_T error_msg[256]);
+void mapping_close(struct mapping *const mapping);
+
+// Maps a file of size bytes for reading and writing, so that a buffer larger than physical memory is paged to
+// disk by the OS instead of failing to allocate. With path, the file is created (or truncated) there and keeps
+// the contents after mapping_close; without, a temporary file is used and deleted on close.
+// The file is made sparse where the file system allows it, so untouched pages take no disk space.
+bool mapping_create_file(struct mapping *const mapping, SR_CHAR_T const *const path, size_t const size, SR_CHAR_T error_msg[256]);
@@ -0,0 +1,292 @@
+#include "profile.h"
+
+#include <ovprintf.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#  include <windows.h>
+#else
+#  include <sys/stat.h>
+#endif
+
+static void provider_name(struct session_provider const *const provider, char name[16]) {
+  if (provider->type == PROVIDER_DML) {
+    snprintf(name, 16, "dml:%d", provider->dml.device_id);
+  } else {
+    strcpy(name, "cpu");
+  }
+}
+
+static SR_CHAR_T *tstr_dup(SR_CHAR_T const *const s) {
+  size_t const len = SR_STRLEN(s);
+  SR_CHAR_T *const r = malloc((len + 1) * sizeof(SR_CHAR_T));
+  if (r != NULL) {
+    memcpy(r, s, (len + 1) * sizeof(SR_CHAR_T));
+  }
+  return r;
+}
+
+static SR_CHAR_T *utf8_to_tstr(char const *const s) {
+#ifdef _WIN32
+  int const n = MultiByteToWideChar(CP_UTF8, 0, s, -1, NULL, 0);
+  if (n <= 0) {
+    return NULL;
+  }
+  SR_CHAR_T *const r = malloc((size_t)n * sizeof(SR_CHAR_T));
+  if (r != NULL) {
+    MultiByteToWideChar(CP_UTF8, 0, s, -1, r, n);
+  }
+  return r;
+#else
+  return tstr_dup(s);
+#endif
+}
+
+static bool write_tstr(FILE *const f, SR_CHAR_T const *const s) {
+#ifdef _WIN32
+  int const n = WideCharToMultiByte(CP_UTF8, 0, s, -1, NULL, 0, NULL, NULL);
+  if (n <= 0) {
+    return false;
+  }
+  char *const buf = malloc((size_t)n);
+  if (buf == NULL) {
+    return false;
+  }
+  WideCharToMultiByte(CP_UTF8, 0, s, -1, buf, n, NULL, NULL);
+  bool const r = fputs(buf, f) >= 0;
+  free(buf);
+  return r;
+#else
+  return fputs(s, f) >= 0;
+#endif
+}
+
+static FILE *open_file(SR_CHAR_T const *const path, bool const write) {
+#ifdef _WIN32
+  return _wfopen(path, write ? L"wb" : L"rb");
+#else
+  return fopen(path, write ? "wb" : "rb");
+#endif
+}
+
+static bool parse_field(char **const p, uint64_t *const v) {
+  char *end = NULL;
+  unsigned long long const n = strtoull(*p, &end, 10);
+  if (end == *p || *end != ' ') {
+    return false;
+  }
+  *v = (uint64_t)n;
+  *p = end + 1;
+  return true;
+}
+
+// Parses one line without its terminator, returns false for lines to skip.
+static bool parse_line(char *line, struct profile_entry *const e) {
+  uint64_t tile = 0, batch = 0, threads = 0, us = 0, stamp = 0;
+  if (!parse_field(&line, &tile) || !parse_field(&line, &batch) || !parse_field(&line, &threads) ||
+      !parse_field(&line, &us) || !parse_field(&line, &stamp)) {
+    return false;
+  }
+  char *const space = strchr(line, ' ');
+  if (space == NULL || space == line || (size_t)(space - line) >= sizeof(e->provider) || space[1] == '\0') {
+    return false;
+  }
+  if (tile > 1024 || batch > 64 || threads > 1024) {
+    return false;
+  }
+  *e = (struct profile_entry){
+      .tuning =
+          {
+              .tile_size = (size_t)tile,
+              .batch_size = (size_t)batch,
+              .threads = (size_t)threads,
+          },
+      .us_per_megapixel = us,
+      .stamp = stamp,
+  };
+  memcpy(e->provider, line, (size_t)(space - line));
+  e->model = utf8_to_tstr(space + 1);
+  return e->model != NULL;
+}
+
+bool profile_get_default_path(SR_CHAR_T *const path, size_t const len) {
+#ifdef _WIN32
+  SR_CHAR_T base[MAX_PATH];
+  DWORD const n = GetEnvironmentVariableW(L"LOCALAPPDATA", base, MAX_PATH);
+  if (n == 0 || n >= MAX_PATH) {
+    return false;
+  }
+  int const r = ov_snprintf(path, len, NULL, L"%ls\\sr\\profile.txt", base);
+#else
+  char const *const base = getenv("HOME");
+  if (base == NULL) {
+    return false;
+  }
+  int const r = snprintf(path, len, "%s/.cache/sr/profile.txt", base);
+#endif
+  return r > 0 && (size_t)r < len;
+}
+
+bool profile_load(struct profile *const profile, SR_CHAR_T const *const path, SR_CHAR_T error_msg[256]) {
+  if (profile == NULL || path == NULL) {
+    error_msg[sr_append(error_msg, SR_TSTR("invalid parameter."))] = SR_TSTR('\0');
+    return false;
+  }
+  *profile = (struct profile){0};
+  FILE *const f = open_file(path, false);
+  if (f == NULL) {
+    return true;
+  }
+  char line[1024];
+  bool ok = true;
+  while (fgets(line, sizeof(line), f) != NULL) {
+    size_t len = strlen(line);
+    while (len && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+      line[--len] = '\0';
+    }
+    struct profile_entry e;
+    if (!parse_line(line, &e)) {
+      continue;
+    }
+    struct profile_entry *const entries = realloc(profile->entries, (profile->num_entries + 1) * sizeof(*entries));
+    if (entries == NULL) {
+      free(e.model);
+      ok = false;
+      break;
+    }
+    profile->entries = entries;
+    profile->entries[profile->num_entries++] = e;
+  }
+  fclose(f);
+  if (!ok) {
+    profile_free(profile);
+    ov_snprintf(error_msg, 256, NULL, SR_TSTR("failed to read tuning profile: %ls"), path);
+  }
+  return ok;
+}
+
+static void create_parent_directories(SR_CHAR_T const *const path) {
+  SR_CHAR_T *const dir = tstr_dup(path);
+  if (dir == NULL) {
+    return;
+  }
+  // the first component is a drive or the root, creating it fails harmlessly
+  for (SR_CHAR_T *p = dir + 1; *p != SR_TSTR('\0'); ++p) {
+    if (*p != SR_TSTR('/') && *p != SR_TSTR('\\')) {
+      continue;
+    }
+    SR_CHAR_T const c = *p;
+    *p = SR_TSTR('\0');
+#ifdef _WIN32
+    CreateDirectoryW(dir, NULL);
+#else
+    mkdir(dir, 0755);
+#endif
+    *p = c;
+  }
+  free(dir);
+}
+
+bool profile_save(struct profile const *const profile, SR_CHAR_T const *const path, SR_CHAR_T error_msg[256]) {
+  if (profile == NULL || path == NULL) {
+    error_msg[sr_append(error_msg, SR_TSTR("invalid parameter."))] = SR_TSTR('\0');
+    return false;
+  }
+  create_parent_directories(path);
+  FILE *const f = open_file(path, true);
+  if (f == NULL) {
+    ov_snprintf(error_msg, 256, NULL, SR_TSTR("failed to create tuning profile: %ls"), path);
+    return false;
+  }
+  bool ok = true;
+  for (size_t i = 0; ok && i < profile->num_entries; ++i) {
+    struct profile_entry const *const e = &profile->entries[i];
+    ok = fprintf(f,
+                 "%llu %llu %llu %llu %llu %s ",
+                 (unsigned long long)e->tuning.tile_size,
+                 (unsigned long long)e->tuning.batch_size,
+                 (unsigned long long)e->tuning.threads,
+                 (unsigned long long)e->us_per_megapixel,
+                 (unsigned long long)e->stamp,
+                 e->provider) > 0 &&
+         write_tstr(f, e->model) && fputc('\n', f) != EOF;
+  }
+  if (fclose(f) != 0) {
+    ok = false;
+  }
+  if (!ok) {
+    ov_snprintf(error_msg, 256, NULL, SR_TSTR("failed to write tuning profile: %ls"), path);
+  }
+  return ok;
+}
+
+void profile_free(struct profile *const profile) {
+  if (profile == NULL) {
+    return;
+  }
+  for (size_t i = 0; i < profile->num_entries; ++i) {
+    free(profile->entries[i].model);
+  }
+  free(profile->entries);
+  *profile = (struct profile){0};
+}
+
+static struct profile_entry *
+find(struct profile const *const profile, SR_CHAR_T const *const model, struct session_provider const *const provider) {
+  char name[16];
+  provider_name(provider, name);
+  for (size_t i = 0; i < profile->num_entries; ++i) {
+    struct profile_entry *const e = &profile->entries[i];
+#ifdef _WIN32
+    bool const same_model = _wcsicmp(e->model, model) == 0;
+#else
+    bool const same_model = strcmp(e->model, model) == 0;
+#endif
+    if (same_model && strcmp(e->provider, name) == 0) {
+      return e;
+    }
+  }
+  return NULL;
+}
+
+struct profile_entry const *
+profile_find(struct profile const *const profile, SR_CHAR_T const *const model, struct session_provider const *const provider) {
+  if (profile == NULL || model == NULL || provider == NULL) {
+    return NULL;
+  }
+  struct profile_entry const *const e = find(profile, model, provider);
+  return e != NULL && e->stamp == session_get_file_stamp(model) ? e : NULL;
+}
+
+bool profile_set(struct profile *const profile,
+                 SR_CHAR_T const *const model,
+                 struct session_provider const *const provider,
+                 struct session_tuning const *const tuning,
+                 uint64_t const us_per_megapixel) {
+  if (profile == NULL || model == NULL || provider == NULL || tuning == NULL) {
+    return false;
+  }
+  struct profile_entry *e = find(profile, model, provider);
+  if (e == NULL) {
+    SR_CHAR_T *const dup = tstr_dup(model);
+    if (dup == NULL) {
+      return false;
+    }
+    struct profile_entry *const entries = realloc(profile->entries, (profile->num_entries + 1) * sizeof(*entries));
+    if (entries == NULL) {
+      free(dup);
+      return false;
+    }
+    profile->entries = entries;
+    e = &profile->entries[profile->num_entries++];
+    *e = (struct profile_entry){.model = dup};
+    provider_name(provider, e->provider);
+  }
+  e->tuning = *tuning;
+  e->us_per_megapixel = us_per_megapixel;
+  e->stamp = session_get_file_stamp(model);
+  return true;
+}
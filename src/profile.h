@@ -0,0 +1,43 @@
+#pragma once
+
+#include "common.h"
+#include "session.h"
+
+// Results of sr --autotune, stored per machine so that later command-line runs and the GUI load models with the fastest
+// tile size, batch size and thread count found for them.
+// The file is UTF-8 text with one line per model and execution provider:
+//
+//   <tile_size> <batch_size> <threads> <microseconds per source megapixel> <stamp> <provider> <model path>
+//
+// provider is "cpu" or "dml:<device id>"; lines that do not parse are skipped, so an old file never stops a run.
+// stamp is session_get_file_stamp of the model when it was tuned; an entry of a replaced model is not used.
+
+struct profile_entry {
+  SR_CHAR_T *model;
+  char provider[16];
+  struct session_tuning tuning;
+  uint64_t us_per_megapixel; // as measured by the autotuner, for reference
+  uint64_t stamp;
+};
+
+struct profile {
+  struct profile_entry *entries;
+  size_t num_entries;
+};
+
+// Writes the default location, %LOCALAPPDATA%\sr\profile.txt on Windows.
+bool profile_get_default_path(SR_CHAR_T *const path, size_t const len);
+// A missing file loads as an empty profile.
+bool profile_load(struct profile *const profile, SR_CHAR_T const *const path, SR_CHAR_T error_msg[256]);
+// Creates the directory of path when it does not exist.
+bool profile_save(struct profile const *const profile, SR_CHAR_T const *const path, SR_CHAR_T error_msg[256]);
+void profile_free(struct profile *const profile);
+// Returns NULL if the model was not tuned for that provider or has changed since.
+struct profile_entry const *
+profile_find(struct profile const *const profile, SR_CHAR_T const *const model, struct session_provider const *const provider);
+// Adds or replaces the entry of the model and provider.
+bool profile_set(struct profile *const profile,
+                 SR_CHAR_T const *const model,
+                 struct session_provider const *const provider,
+                 struct session_tuning const *const tuning,
+                 uint64_t const us_per_megapixel);
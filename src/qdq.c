@@ -0,0 +1,913 @@
+#include "qdq.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+  wire_varint = 0,
+  wire_fixed64 = 1,
+  wire_bytes = 2,
+  wire_fixed32 = 5,
+};
+
+// field numbers from onnx.proto
+enum {
+  field_model_graph = 7,
+  field_model_opset_import = 8,
+  field_opset_domain = 1,
+  field_opset_version = 2,
+  field_graph_node = 1,
+  field_graph_initializer = 5,
+  field_graph_input = 11,
+  field_graph_output = 12,
+  field_node_input = 1,
+  field_node_output = 2,
+  field_node_name = 3,
+  field_node_op_type = 4,
+  field_node_attribute = 5,
+  field_node_domain = 7,
+  field_attribute_name = 1,
+  field_attribute_i = 3,
+  field_attribute_type = 20,
+  field_tensor_dims = 1,
+  field_tensor_data_type = 2,
+  field_tensor_float_data = 4,
+  field_tensor_name = 8,
+  field_tensor_raw_data = 9,
+  field_value_info_name = 1,
+  field_value_info_type = 2,
+  field_type_tensor_type = 1,
+  field_tensor_type_elem_type = 1,
+};
+
+enum {
+  attribute_type_int = 2,
+  elem_float = 1,
+  elem_uint8 = 2,
+  elem_int8 = 3,
+  elem_int32 = 6,
+  max_dims = 8,
+};
+
+struct span {
+  uint8_t const *ptr;
+  size_t len;
+};
+
+struct node {
+  struct span raw; // NodeProto
+  struct span inputs[3];
+  size_t num_inputs;
+  struct span output;
+  bool conv; // the Conv is quantized, its weight and bias are replaced
+};
+
+struct initializer {
+  struct span field; // including the tag
+  struct span name;
+  uint64_t data_type;
+  int64_t dims[max_dims];
+  size_t num_dims;
+  struct span raw_data;
+  struct span raw; // TensorProto
+  size_t uses;
+  bool dropped; // replaced by its quantized form
+};
+
+struct value_info {
+  struct span field; // including the tag
+  struct span name;
+};
+
+struct qdq_graph {
+  struct span model;
+  struct span graph;
+  uint64_t opset;
+  struct node *nodes;
+  size_t num_nodes;
+  struct initializer *initializers;
+  size_t num_initializers;
+  struct value_info *inputs;
+  size_t num_inputs;
+  struct value_info *outputs;
+  size_t num_outputs;
+};
+
+struct reader {
+  uint8_t const *p;
+  uint8_t const *end;
+  bool failed;
+};
+
+struct field {
+  uint64_t number;
+  uint64_t wire;
+  uint64_t value;    // varint and fixed fields
+  struct span bytes; // length-delimited fields
+  struct span raw;   // the whole field including its tag
+};
+
+static uint64_t read_varint(struct reader *const r) {
+  uint64_t v = 0;
+  for (unsigned shift = 0; shift < 64 && r->p < r->end; shift += 7) {
+    uint8_t const b = *r->p++;
+    v |= (uint64_t)(b & 0x7f) << shift;
+    if ((b & 0x80) == 0) {
+      return v;
+    }
+  }
+  r->failed = true;
+  return 0;
+}
+
+static bool next_field(struct reader *const r, struct field *const f) {
+  if (r->failed || r->p >= r->end) {
+    return false;
+  }
+  uint8_t const *const start = r->p;
+  uint64_t const tag = read_varint(r);
+  *f = (struct field){.number = tag >> 3, .wire = tag & 7};
+  size_t const remaining = (size_t)(r->end - r->p);
+  switch (f->wire) {
+  case wire_varint:
+    f->value = read_varint(r);
+    break;
+  case wire_fixed64:
+    if (remaining < 8) {
+      r->failed = true;
+      break;
+    }
+    memcpy(&f->value, r->p, 8);
+    r->p += 8;
+    break;
+  case wire_fixed32: {
+    uint32_t v = 0;
+    if (remaining < 4) {
+      r->failed = true;
+      break;
+    }
+    memcpy(&v, r->p, 4);
+    f->value = v;
+    r->p += 4;
+    break;
+  }
+  case wire_bytes: {
+    uint64_t const len = read_varint(r);
+    if (r->failed || len > (uint64_t)(r->end - r->p)) {
+      r->failed = true;
+      break;
+    }
+    f->bytes = (struct span){r->p, (size_t)len};
+    r->p += len;
+    break;
+  }
+  default:
+    r->failed = true;
+    break;
+  }
+  if (r->failed) {
+    return false;
+  }
+  f->raw = (struct span){start, (size_t)(r->p - start)};
+  return true;
+}
+
+static struct reader reader_of(struct span const s) { return (struct reader){s.ptr, s.ptr + s.len, false}; }
+
+static bool span_equal(struct span const a, struct span const b) {
+  return a.len == b.len && (a.len == 0 || memcmp(a.ptr, b.ptr, a.len) == 0);
+}
+
+static bool span_equal_str(struct span const a, char const *const s) {
+  return span_equal(a, (struct span){(uint8_t const *)s, strlen(s)});
+}
+
+static struct initializer *find_initializer(struct qdq_graph const *const g, struct span const name) {
+  for (size_t i = 0; i < g->num_initializers; ++i) {
+    if (span_equal(g->initializers[i].name, name)) {
+      return &g->initializers[i];
+    }
+  }
+  return NULL;
+}
+
+static bool find_value_info(struct value_info const *const v, size_t const n, struct span const name) {
+  for (size_t i = 0; i < n; ++i) {
+    if (span_equal(v[i].name, name)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static struct qdq_tensor *find_tensor(struct qdq_model const *const model, struct span const name) {
+  for (size_t i = 0; i < model->num_tensors; ++i) {
+    if (span_equal_str(name, model->tensors[i].name)) {
+      return &model->tensors[i];
+    }
+  }
+  return NULL;
+}
+
+static bool parse_initializer(struct initializer *const init, struct field const *const f) {
+  *init = (struct initializer){.field = f->raw, .raw = f->bytes};
+  struct reader r = reader_of(f->bytes);
+  struct field tf;
+  while (next_field(&r, &tf)) {
+    switch (tf.number) {
+    case field_tensor_dims:
+      if (tf.wire == wire_bytes) {
+        // packed
+        struct reader pr = reader_of(tf.bytes);
+        while (pr.p < pr.end && !pr.failed && init->num_dims < max_dims) {
+          init->dims[init->num_dims++] = (int64_t)read_varint(&pr);
+        }
+        if (pr.failed || pr.p < pr.end) {
+          return false;
+        }
+      } else if (init->num_dims < max_dims) {
+        init->dims[init->num_dims++] = (int64_t)tf.value;
+      } else {
+        return false;
+      }
+      break;
+    case field_tensor_data_type:
+      init->data_type = tf.value;
+      break;
+    case field_tensor_name:
+      init->name = tf.bytes;
+      break;
+    case field_tensor_raw_data:
+      init->raw_data = tf.bytes;
+      break;
+    }
+  }
+  return !r.failed;
+}
+
+static bool parse_value_info(struct value_info *const v, struct field const *const f) {
+  *v = (struct value_info){.field = f->raw};
+  struct reader r = reader_of(f->bytes);
+  struct field vf;
+  while (next_field(&r, &vf)) {
+    if (vf.number == field_value_info_name) {
+      v->name = vf.bytes;
+    }
+  }
+  return !r.failed;
+}
+
+static bool parse_node(struct node *const n, struct field const *const f) {
+  *n = (struct node){.raw = f->bytes};
+  struct span op_type = {0};
+  struct span domain = {0};
+  struct reader r = reader_of(f->bytes);
+  struct field nf;
+  bool has_output = false;
+  while (next_field(&r, &nf)) {
+    switch (nf.number) {
+    case field_node_input:
+      if (n->num_inputs < 3) {
+        n->inputs[n->num_inputs] = nf.bytes;
+      }
+      ++n->num_inputs;
+      break;
+    case field_node_output:
+      if (!has_output) {
+        n->output = nf.bytes;
+        has_output = true;
+      }
+      break;
+    case field_node_op_type:
+      op_type = nf.bytes;
+      break;
+    case field_node_domain:
+      domain = nf.bytes;
+      break;
+    }
+  }
+  // mark candidates, qdq_parse decides whether their weights can be quantized
+  n->conv = span_equal_str(op_type, "Conv") && (domain.len == 0 || span_equal_str(domain, "ai.onnx")) && n->num_inputs >= 2 &&
+            n->num_inputs <= 3 && has_output;
+  return !r.failed;
+}
+
+static uint64_t parse_opset(struct span const model) {
+  uint64_t opset = 0;
+  struct reader r = reader_of(model);
+  struct field f;
+  while (next_field(&r, &f)) {
+    if (f.number != field_model_opset_import || f.wire != wire_bytes) {
+      continue;
+    }
+    struct span domain = {0};
+    uint64_t version = 0;
+    struct reader or = reader_of(f.bytes);
+    struct field of;
+    while (next_field(&or, &of)) {
+      if (of.number == field_opset_domain) {
+        domain = of.bytes;
+      } else if (of.number == field_opset_version) {
+        version = of.value;
+      }
+    }
+    if (domain.len == 0 || span_equal_str(domain, "ai.onnx")) {
+      opset = version;
+    }
+  }
+  return opset;
+}
+
+static bool add_tensor(struct qdq_model *const model, struct span const name, bool const graph_input) {
+  if (find_tensor(model, name) != NULL) {
+    return true;
+  }
+  char *const s = malloc(name.len + 1);
+  if (s == NULL) {
+    return false;
+  }
+  memcpy(s, name.ptr, name.len);
+  s[name.len] = '\0';
+  model->tensors[model->num_tensors++] = (struct qdq_tensor){
+      .name = s,
+      .graph_input = graph_input,
+      .min = INFINITY,
+      .max = -INFINITY,
+  };
+  return true;
+}
+
+bool qdq_parse(struct qdq_model *const model, uint8_t const *const data, size_t const size, SR_CHAR_T error_msg[256]) {
+  struct qdq_graph *g = NULL;
+  SR_CHAR_T const *msg = NULL;
+
+  *model = (struct qdq_model){0};
+  g = calloc(1, sizeof(struct qdq_graph));
+  if (g == NULL) {
+    msg = SR_TSTR("out of memory.");
+    goto cleanup;
+  }
+  model->graph = g;
+  g->model = (struct span){data, size};
+
+  {
+    struct reader r = reader_of(g->model);
+    struct field f;
+    while (next_field(&r, &f)) {
+      if (f.number == field_model_graph && f.wire == wire_bytes) {
+        g->graph = f.bytes;
+      }
+    }
+    if (r.failed || g->graph.ptr == NULL) {
+      msg = SR_TSTR("not an ONNX model.");
+      goto cleanup;
+    }
+  }
+  g->opset = parse_opset(g->model);
+  if (g->opset < 10) {
+    msg = SR_TSTR("QuantizeLinear requires opset 10 or later.");
+    goto cleanup;
+  }
+
+  // count first so that the arrays are allocated once
+  {
+    struct reader r = reader_of(g->graph);
+    struct field f;
+    while (next_field(&r, &f)) {
+      switch (f.number) {
+      case field_graph_node:
+        ++g->num_nodes;
+        break;
+      case field_graph_initializer:
+        ++g->num_initializers;
+        break;
+      case field_graph_input:
+        ++g->num_inputs;
+        break;
+      case field_graph_output:
+        ++g->num_outputs;
+        break;
+      }
+    }
+    if (r.failed) {
+      msg = SR_TSTR("malformed graph.");
+      goto cleanup;
+    }
+  }
+  g->nodes = calloc(g->num_nodes + 1, sizeof(struct node));
+  g->initializers = calloc(g->num_initializers + 1, sizeof(struct initializer));
+  g->inputs = calloc(g->num_inputs + 1, sizeof(struct value_info));
+  g->outputs = calloc(g->num_outputs + 1, sizeof(struct value_info));
+  // at most an input and an output per Conv
+  model->tensors = calloc(g->num_nodes * 2 + 1, sizeof(struct qdq_tensor));
+  if (g->nodes == NULL || g->initializers == NULL || g->inputs == NULL || g->outputs == NULL || model->tensors == NULL) {
+    msg = SR_TSTR("out of memory.");
+    goto cleanup;
+  }
+  {
+    size_t nn = 0, ni = 0, nin = 0, nout = 0;
+    bool ok = true;
+    struct reader r = reader_of(g->graph);
+    struct field f;
+    while (ok && next_field(&r, &f)) {
+      switch (f.number) {
+      case field_graph_node:
+        ok = parse_node(&g->nodes[nn++], &f);
+        break;
+      case field_graph_initializer:
+        ok = parse_initializer(&g->initializers[ni++], &f);
+        break;
+      case field_graph_input:
+        ok = parse_value_info(&g->inputs[nin++], &f);
+        break;
+      case field_graph_output:
+        ok = parse_value_info(&g->outputs[nout++], &f);
+        break;
+      }
+    }
+    if (!ok || r.failed) {
+      msg = SR_TSTR("malformed graph.");
+      goto cleanup;
+    }
+  }
+
+  // an initializer shared with other nodes must stay as it is
+  for (size_t i = 0; i < g->num_nodes; ++i) {
+    struct reader r = reader_of(g->nodes[i].raw);
+    struct field f;
+    while (next_field(&r, &f)) {
+      if (f.number == field_node_input) {
+        struct initializer *const init = find_initializer(g, f.bytes);
+        if (init != NULL) {
+          ++init->uses;
+        }
+      }
+    }
+  }
+
+  size_t num_convs = 0;
+  for (size_t i = 0; i < g->num_nodes; ++i) {
+    struct node *const n = &g->nodes[i];
+    if (!n->conv) {
+      continue;
+    }
+    struct initializer *const w = find_initializer(g, n->inputs[1]);
+    struct initializer *const b = n->num_inputs == 3 && n->inputs[2].len ? find_initializer(g, n->inputs[2]) : NULL;
+    bool const has_bias = n->num_inputs == 3 && n->inputs[2].len;
+    n->conv = n->inputs[0].len && find_initializer(g, n->inputs[0]) == NULL && w != NULL && w->data_type == elem_float &&
+              w->num_dims >= 3 && w->dims[0] > 0 && w->uses == 1 &&
+              (!has_bias || (b != NULL && b->data_type == elem_float && b->num_dims == 1 && b->dims[0] == w->dims[0] && b->uses == 1));
+    if (!n->conv) {
+      continue;
+    }
+    w->dropped = true;
+    if (b != NULL) {
+      b->dropped = true;
+    }
+    // the output of the model is left in float, quantizing it costs precision for no speedup
+    if (!add_tensor(model, n->inputs[0], find_value_info(g->inputs, g->num_inputs, n->inputs[0])) ||
+        (!find_value_info(g->outputs, g->num_outputs, n->output) && !add_tensor(model, n->output, false))) {
+      msg = SR_TSTR("out of memory.");
+      goto cleanup;
+    }
+    ++num_convs;
+  }
+  if (num_convs == 0) {
+    msg = SR_TSTR("the model has no Conv that can be quantized.");
+    goto cleanup;
+  }
+
+cleanup:
+  if (msg != NULL) {
+    error_msg[sr_append(error_msg, msg)] = SR_TSTR('\0');
+    qdq_free(model);
+    return false;
+  }
+  return true;
+}
+
+void qdq_free(struct qdq_model *const model) {
+  if (model->graph != NULL) {
+    free(model->graph->nodes);
+    free(model->graph->initializers);
+    free(model->graph->inputs);
+    free(model->graph->outputs);
+    free(model->graph);
+  }
+  if (model->tensors != NULL) {
+    for (size_t i = 0; i < model->num_tensors; ++i) {
+      free(model->tensors[i].name);
+    }
+    free(model->tensors);
+  }
+  *model = (struct qdq_model){0};
+}
+
+void qdq_observe(struct qdq_tensor *const tensor, float const *const values, size_t const n) {
+  float lo = tensor->min, hi = tensor->max;
+  for (size_t i = 0; i < n; ++i) {
+    float const v = values[i];
+    // NaN compares false and is skipped
+    if (v < lo) {
+      lo = v;
+    }
+    if (v > hi) {
+      hi = v;
+    }
+  }
+  tensor->min = lo;
+  tensor->max = hi;
+}
+
+struct writer {
+  uint8_t *ptr;
+  size_t len;
+  size_t cap;
+  bool failed;
+};
+
+static void put(struct writer *const w, void const *const p, size_t const n) {
+  if (w->failed) {
+    return;
+  }
+  if (w->len + n > w->cap) {
+    size_t cap = w->cap ? w->cap : 4096;
+    while (cap < w->len + n) {
+      cap *= 2;
+    }
+    uint8_t *const ptr = realloc(w->ptr, cap);
+    if (ptr == NULL) {
+      w->failed = true;
+      return;
+    }
+    w->ptr = ptr;
+    w->cap = cap;
+  }
+  memcpy(w->ptr + w->len, p, n);
+  w->len += n;
+}
+
+static void put_span(struct writer *const w, struct span const s) { put(w, s.ptr, s.len); }
+
+static void put_varint(struct writer *const w, uint64_t v) {
+  uint8_t buf[10];
+  size_t n = 0;
+  do {
+    uint8_t const b = (uint8_t)(v & 0x7f);
+    v >>= 7;
+    buf[n++] = v ? (uint8_t)(b | 0x80) : b;
+  } while (v);
+  put(w, buf, n);
+}
+
+static void put_uint(struct writer *const w, uint64_t const field, uint64_t const v) {
+  put_varint(w, field << 3 | wire_varint);
+  put_varint(w, v);
+}
+
+static void put_bytes(struct writer *const w, uint64_t const field, void const *const p, size_t const n) {
+  put_varint(w, field << 3 | wire_bytes);
+  put_varint(w, n);
+  put(w, p, n);
+}
+
+static void put_str(struct writer *const w, uint64_t const field, char const *const s) { put_bytes(w, field, s, strlen(s)); }
+
+// Writes name followed by suffix1 and suffix2 as one string field.
+static void put_name(struct writer *const w,
+                     uint64_t const field,
+                     struct span const name,
+                     char const *const suffix1,
+                     char const *const suffix2) {
+  size_t const len1 = strlen(suffix1), len2 = strlen(suffix2);
+  put_varint(w, field << 3 | wire_bytes);
+  put_varint(w, name.len + len1 + len2);
+  put_span(w, name);
+  put(w, suffix1, len1);
+  put(w, suffix2, len2);
+}
+
+// Writes inner as a message field and frees it.
+static void put_message(struct writer *const w, uint64_t const field, struct writer *const inner) {
+  if (inner->failed) {
+    w->failed = true;
+  } else {
+    put_bytes(w, field, inner->ptr, inner->len);
+  }
+  free(inner->ptr);
+  *inner = (struct writer){0};
+}
+
+static void put_initializer(struct writer *const w,
+                            struct span const name,
+                            char const *const suffix,
+                            uint64_t const data_type,
+                            int64_t const *const dims,
+                            size_t const num_dims,
+                            void const *const data,
+                            size_t const bytes) {
+  struct writer t = {0};
+  for (size_t i = 0; i < num_dims; ++i) {
+    put_uint(&t, field_tensor_dims, (uint64_t)dims[i]);
+  }
+  put_uint(&t, field_tensor_data_type, data_type);
+  put_name(&t, field_tensor_name, name, suffix, "");
+  put_bytes(&t, field_tensor_raw_data, data, bytes);
+  put_message(w, field_graph_initializer, &t);
+}
+
+// QuantizeLinear or DequantizeLinear of name, reading name + input_suffix and writing name + output_suffix.
+static void put_linear_node(struct writer *const w,
+                            char const *const op_type,
+                            struct span const name,
+                            char const *const input_suffix,
+                            char const *const output_suffix,
+                            bool const per_channel) {
+  struct writer n = {0};
+  put_name(&n, field_node_input, name, input_suffix, "");
+  put_name(&n, field_node_input, name, "_scale", "");
+  put_name(&n, field_node_input, name, "_zero_point", "");
+  put_name(&n, field_node_output, name, output_suffix, "");
+  put_name(&n, field_node_name, name, "_", op_type);
+  put_str(&n, field_node_op_type, op_type);
+  if (per_channel) {
+    struct writer a = {0};
+    put_str(&a, field_attribute_name, "axis");
+    put_uint(&a, field_attribute_i, 0);
+    put_uint(&a, field_attribute_type, attribute_type_int);
+    put_message(&n, field_node_attribute, &a);
+  }
+  put_message(w, field_graph_node, &n);
+}
+
+static float *initializer_floats(struct initializer const *const init, size_t *const count) {
+  size_t n = 1;
+  for (size_t i = 0; i < init->num_dims; ++i) {
+    n *= (size_t)init->dims[i];
+  }
+  float *const values = malloc(n * sizeof(float) + 1);
+  if (values == NULL) {
+    return NULL;
+  }
+  if (init->raw_data.ptr != NULL) {
+    if (init->raw_data.len != n * sizeof(float)) {
+      free(values);
+      return NULL;
+    }
+    memcpy(values, init->raw_data.ptr, n * sizeof(float));
+    *count = n;
+    return values;
+  }
+  size_t got = 0;
+  struct reader r = reader_of(init->raw);
+  struct field f;
+  while (next_field(&r, &f)) {
+    if (f.number != field_tensor_float_data) {
+      continue;
+    }
+    if (f.wire == wire_bytes) {
+      // packed
+      size_t const k = f.bytes.len / sizeof(float);
+      if (got + k > n) {
+        break;
+      }
+      memcpy(values + got, f.bytes.ptr, k * sizeof(float));
+      got += k;
+    } else if (f.wire == wire_fixed32 && got < n) {
+      uint32_t const bits = (uint32_t)f.value;
+      memcpy(values + got++, &bits, sizeof(float));
+    }
+  }
+  if (r.failed || got != n) {
+    free(values);
+    return NULL;
+  }
+  *count = n;
+  return values;
+}
+
+static void activation_params(struct qdq_tensor const *const t, float *const scale, uint8_t *const zero_point) {
+  // the range must contain zero so that zero padding is exact
+  float const lo = t->min < 0.f ? t->min : 0.f;
+  float const hi = t->max > 0.f ? t->max : 0.f;
+  float const s = hi > lo ? (hi - lo) / 255.f : 1.f;
+  float const zp = roundf(-lo / s);
+  *scale = s;
+  *zero_point = (uint8_t)(zp < 0.f ? 0.f : zp > 255.f ? 255.f : zp);
+}
+
+// Weights are int8 and symmetric, biases int32 with the scale of input times weight, both per output channel
+// when per_channel is set.
+static bool put_conv_initializers(struct writer *const w,
+                                  struct qdq_model const *const model,
+                                  struct node const *const n,
+                                  bool const per_channel) {
+  struct qdq_graph const *const g = model->graph;
+  struct initializer const *const wi = find_initializer(g, n->inputs[1]);
+  struct initializer const *const bi = n->num_inputs == 3 && n->inputs[2].len ? find_initializer(g, n->inputs[2]) : NULL;
+  size_t wn = 0, bn = 0;
+  float *const weights = initializer_floats(wi, &wn);
+  float *const bias = bi ? initializer_floats(bi, &bn) : NULL;
+  size_t const channels = (size_t)wi->dims[0];
+  size_t const groups = per_channel ? channels : 1;
+  int8_t *const qw = malloc(wn + 1);
+  float *const ws = malloc(groups * sizeof(float));
+  int8_t *const wzp = calloc(groups, 1);
+  int32_t *const qb = malloc(channels * sizeof(int32_t) + 1);
+  float *const bs = malloc(groups * sizeof(float));
+  int32_t *const bzp = calloc(groups, sizeof(int32_t));
+  bool const ok = weights != NULL && (bi == NULL || bias != NULL) && qw != NULL && ws != NULL && wzp != NULL && qb != NULL &&
+                  bs != NULL && bzp != NULL && wn % channels == 0;
+  if (ok) {
+    size_t const k = wn / groups;
+    for (size_t c = 0; c < groups; ++c) {
+      float m = 0.f;
+      for (size_t i = 0; i < k; ++i) {
+        m = fmaxf(m, fabsf(weights[c * k + i]));
+      }
+      ws[c] = m > 0.f ? m / 127.f : 1.f;
+      for (size_t i = 0; i < k; ++i) {
+        float const q = roundf(weights[c * k + i] / ws[c]);
+        qw[c * k + i] = (int8_t)(q < -127.f ? -127.f : q > 127.f ? 127.f : q);
+      }
+    }
+    int64_t const dims[1] = {(int64_t)groups};
+    size_t const num_dims = per_channel ? 1 : 0;
+    put_initializer(w, wi->name, "_quantized", elem_int8, wi->dims, wi->num_dims, qw, wn);
+    put_initializer(w, wi->name, "_scale", elem_float, dims, num_dims, ws, groups * sizeof(float));
+    put_initializer(w, wi->name, "_zero_point", elem_int8, dims, num_dims, wzp, groups);
+    if (bi != NULL) {
+      float xs = 0.f;
+      uint8_t xzp = 0;
+      activation_params(find_tensor(model, n->inputs[0]), &xs, &xzp);
+      for (size_t c = 0; c < groups; ++c) {
+        bs[c] = xs * ws[c];
+      }
+      for (size_t c = 0; c < channels; ++c) {
+        double const q = round((double)bias[c] / (double)bs[per_channel ? c : 0]);
+        qb[c] = (int32_t)(q < (double)INT32_MIN ? (double)INT32_MIN : q > (double)INT32_MAX ? (double)INT32_MAX : q);
+      }
+      put_initializer(w, bi->name, "_quantized", elem_int32, bi->dims, bi->num_dims, qb, channels * sizeof(int32_t));
+      put_initializer(w, bi->name, "_scale", elem_float, dims, num_dims, bs, groups * sizeof(float));
+      put_initializer(w, bi->name, "_zero_point", elem_int32, dims, num_dims, bzp, groups * sizeof(int32_t));
+    }
+  }
+  free(bzp);
+  free(bs);
+  free(qb);
+  free(wzp);
+  free(ws);
+  free(qw);
+  free(bias);
+  free(weights);
+  return ok;
+}
+
+// Copies a node, reading the dequantized form of every input that was quantized.
+static void put_node(struct writer *const w, struct qdq_model const *const model, struct node const *const n) {
+  struct writer inner = {0};
+  struct reader r = reader_of(n->raw);
+  struct field f;
+  size_t input = 0;
+  while (next_field(&r, &f)) {
+    if (f.number != field_node_input) {
+      put_span(&inner, f.raw);
+      continue;
+    }
+    if ((n->conv && (input == 1 || input == 2) && f.bytes.len) || find_tensor(model, f.bytes) != NULL) {
+      put_name(&inner, field_node_input, f.bytes, "_dequantized", "");
+    } else {
+      put_span(&inner, f.raw);
+    }
+    ++input;
+  }
+  put_message(w, field_graph_node, &inner);
+}
+
+static void put_activation_nodes(struct writer *const w, struct span const name) {
+  put_linear_node(w, "QuantizeLinear", name, "", "_quantized", false);
+  put_linear_node(w, "DequantizeLinear", name, "_quantized", "_dequantized", false);
+}
+
+static bool build_model(struct qdq_model const *const model, bool const quantize, uint8_t **const data, size_t *const size) {
+  struct qdq_graph const *const g = model->graph;
+  bool const per_channel = g->opset >= 13;
+  struct writer gw = {0};
+  bool ok = true;
+
+  // fields that are not rewritten are copied as they are
+  {
+    struct reader r = reader_of(g->graph);
+    struct field f;
+    while (next_field(&r, &f)) {
+      if (f.number != field_graph_node && f.number != field_graph_initializer && f.number != field_graph_input &&
+          f.number != field_graph_output) {
+        put_span(&gw, f.raw);
+      }
+    }
+  }
+
+  for (size_t i = 0; i < g->num_inputs; ++i) {
+    struct initializer const *const init = find_initializer(g, g->inputs[i].name);
+    // models before IR version 4 also list initializers as inputs
+    if (!quantize || init == NULL || !init->dropped) {
+      put_span(&gw, g->inputs[i].field);
+    }
+  }
+  for (size_t i = 0; i < g->num_initializers; ++i) {
+    if (!quantize || !g->initializers[i].dropped) {
+      put_span(&gw, g->initializers[i].field);
+    }
+  }
+
+  if (quantize) {
+    for (size_t i = 0; i < model->num_tensors; ++i) {
+      struct span const name = {(uint8_t const *)model->tensors[i].name, strlen(model->tensors[i].name)};
+      float scale = 0.f;
+      uint8_t zero_point = 0;
+      activation_params(&model->tensors[i], &scale, &zero_point);
+      put_initializer(&gw, name, "_scale", elem_float, NULL, 0, &scale, sizeof(scale));
+      put_initializer(&gw, name, "_zero_point", elem_uint8, NULL, 0, &zero_point, sizeof(zero_point));
+      if (model->tensors[i].graph_input) {
+        put_activation_nodes(&gw, name);
+      }
+    }
+    for (size_t i = 0; i < g->num_nodes && ok; ++i) {
+      struct node const *const n = &g->nodes[i];
+      if (!n->conv) {
+        continue;
+      }
+      ok = put_conv_initializers(&gw, model, n, per_channel);
+      put_linear_node(&gw, "DequantizeLinear", n->inputs[1], "_quantized", "_dequantized", per_channel);
+      if (n->num_inputs == 3 && n->inputs[2].len) {
+        put_linear_node(&gw, "DequantizeLinear", n->inputs[2], "_quantized", "_dequantized", per_channel);
+      }
+    }
+  }
+
+  for (size_t i = 0; i < g->num_nodes; ++i) {
+    struct node const *const n = &g->nodes[i];
+    if (!quantize) {
+      put_bytes(&gw, field_graph_node, n->raw.ptr, n->raw.len);
+      continue;
+    }
+    put_node(&gw, model, n);
+    // quantize what the node computes right after it, so that the graph stays topologically sorted
+    struct reader r = reader_of(n->raw);
+    struct field f;
+    while (next_field(&r, &f)) {
+      struct qdq_tensor const *const t = f.number == field_node_output ? find_tensor(model, f.bytes) : NULL;
+      if (t != NULL && !t->graph_input) {
+        put_activation_nodes(&gw, f.bytes);
+      }
+    }
+  }
+
+  for (size_t i = 0; i < g->num_outputs; ++i) {
+    put_span(&gw, g->outputs[i].field);
+  }
+  if (!quantize) {
+    for (size_t i = 0; i < model->num_tensors; ++i) {
+      struct span const name = {(uint8_t const *)model->tensors[i].name, strlen(model->tensors[i].name)};
+      if (model->tensors[i].graph_input || find_value_info(g->outputs, g->num_outputs, name)) {
+        continue;
+      }
+      struct writer tt = {0}, type = {0}, vi = {0};
+      put_uint(&tt, field_tensor_type_elem_type, elem_float);
+      put_message(&type, field_type_tensor_type, &tt);
+      put_name(&vi, field_value_info_name, name, "", "");
+      put_message(&vi, field_value_info_type, &type);
+      put_message(&gw, field_graph_output, &vi);
+    }
+  }
+
+  struct writer mw = {0};
+  {
+    struct reader r = reader_of(g->model);
+    struct field f;
+    while (next_field(&r, &f)) {
+      if (f.number == field_model_graph) {
+        put_message(&mw, field_model_graph, &gw);
+      } else {
+        put_span(&mw, f.raw);
+      }
+    }
+  }
+  free(gw.ptr);
+  if (!ok || mw.failed) {
+    free(mw.ptr);
+    return false;
+  }
+  *data = mw.ptr;
+  *size = mw.len;
+  return true;
+}
+
+bool qdq_build_calibration_model(struct qdq_model const *const model, uint8_t **const data, size_t *const size) {
+  return build_model(model, false, data, size);
+}
+
+bool qdq_build_quantized_model(struct qdq_model const *const model, uint8_t **const data, size_t *const size) {
+  return build_model(model, true, data, size);
+}
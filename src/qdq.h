@@ -0,0 +1,36 @@
+#pragma once
+
+#include "common.h"
+
+// Static int8 quantization of ONNX models in the QDQ format, used by sr-quantize.
+// The model is edited at the protobuf level. Activations entering and leaving each Conv get a
+// QuantizeLinear/DequantizeLinear pair (uint8, asymmetric) with a range measured on calibration data,
+// and Conv weights and biases are stored as int8/int32 behind a DequantizeLinear, per output channel from
+// opset 13 on. onnxruntime fuses these groups into integer kernels, the result loads like any other model.
+
+// An activation that is quantized, with the range observed so far.
+struct qdq_tensor {
+  char *name;
+  bool graph_input; // not computed by the model, its range comes from the data fed to it
+  float min;
+  float max;
+};
+
+struct qdq_model {
+  struct qdq_graph *graph;
+  struct qdq_tensor *tensors;
+  size_t num_tensors;
+};
+
+// data must outlive the model.
+bool qdq_parse(struct qdq_model *const model, uint8_t const *const data, size_t const size, SR_CHAR_T error_msg[256]);
+void qdq_free(struct qdq_model *const model);
+
+// The model with every tensor that is not a graph input also available as an output under its own name.
+// The result is freed with free().
+bool qdq_build_calibration_model(struct qdq_model const *const model, uint8_t **const data, size_t *const size);
+
+void qdq_observe(struct qdq_tensor *const tensor, float const *const values, size_t const n);
+
+// The quantized model for the observed ranges. The result is freed with free().
+bool qdq_build_quantized_model(struct qdq_model const *const model, uint8_t **const data, size_t *const size);
@@ -0,0 +1,642 @@
+#include <ovbase.h>
+#include <ovprintf.h>
+
+#include "common.h"
+
+#include "image.h"
+#include "manifest.h"
+#include "onnx.h"
+#include "qdq.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// sr-quantize: converts a float32 model into a QDQ int8 model calibrated on a set of images,
+// then reports how far its output is from the float32 model on tiles it was not calibrated on and how much faster
+// it runs.
+
+static SR_CHAR_T const g_usage[] =
+    SR_TSTR("usage:\n")
+    SR_TSTR("  sr-quantize --model <name|path> --calibration <image> [--calibration <image>...] --output <path>\n")
+    SR_TSTR("              [--evaluation <image>...] [--manifest <path>] [--channels rgb|alpha] [--tiles <n>]\n")
+    SR_TSTR("\n")
+    SR_TSTR("  --model        model name from the manifest, or the path of a float32 ONNX model.\n")
+    SR_TSTR("  --calibration  image whose tiles are used to measure activation ranges.\n")
+    SR_TSTR("  --evaluation   image whose tiles are used to compare the models (default: every fourth calibration tile,\n")
+    SR_TSTR("                 which is then left out of the calibration).\n")
+    SR_TSTR("  --output       path of the quantized model, which can be used in place of the original.\n")
+    SR_TSTR("  --channels     feed the color (default) or the alpha channel, as the model is used for.\n")
+    SR_TSTR("  --tiles        tiles taken from each image, spread over it (default: 16).\n");
+
+// same as the tiles of session.c
+enum {
+  tile_size = 128,
+};
+
+struct options {
+  SR_CHAR_T const *model;
+  SR_CHAR_T const *manifest;
+  SR_CHAR_T const *output;
+  SR_CHAR_T const **images;
+  size_t num_images;
+  SR_CHAR_T const **evaluation_images;
+  size_t num_evaluation_images;
+  bool alpha;
+  size_t tiles;
+};
+
+static bool parse_size(SR_CHAR_T const *const s, size_t *const v) {
+  SR_CHAR_T *end = NULL;
+  unsigned long long const n = wcstoull(s, &end, 10);
+  if (end == s || *end != SR_TSTR('\0') || n == 0 || n > SIZE_MAX) {
+    return false;
+  }
+  *v = (size_t)n;
+  return true;
+}
+
+static bool parse_options(int const argc, SR_CHAR_T *const *const argv, struct options *const opts) {
+  for (int i = 1; i < argc; ++i) {
+    SR_CHAR_T const *const name = argv[i];
+    SR_CHAR_T const *const value = i + 1 < argc ? argv[i + 1] : NULL;
+    if (value == NULL) {
+      return false;
+    }
+    if (wcscmp(name, SR_TSTR("--model")) == 0) {
+      opts->model = value;
+    } else if (wcscmp(name, SR_TSTR("--manifest")) == 0) {
+      opts->manifest = value;
+    } else if (wcscmp(name, SR_TSTR("--output")) == 0) {
+      opts->output = value;
+    } else if (wcscmp(name, SR_TSTR("--calibration")) == 0) {
+      opts->images[opts->num_images++] = value;
+    } else if (wcscmp(name, SR_TSTR("--evaluation")) == 0) {
+      opts->evaluation_images[opts->num_evaluation_images++] = value;
+    } else if (wcscmp(name, SR_TSTR("--channels")) == 0) {
+      if (wcscmp(value, SR_TSTR("rgb")) == 0) {
+        opts->alpha = false;
+      } else if (wcscmp(value, SR_TSTR("alpha")) == 0) {
+        opts->alpha = true;
+      } else {
+        return false;
+      }
+    } else if (wcscmp(name, SR_TSTR("--tiles")) == 0) {
+      if (!parse_size(value, &opts->tiles)) {
+        return false;
+      }
+    } else {
+      return false;
+    }
+    ++i;
+  }
+  return opts->model != NULL && opts->output != NULL && opts->num_images != 0;
+}
+
+static uint8_t *read_file(SR_CHAR_T const *const path, size_t *const size) {
+  uint8_t *data = NULL;
+  FILE *f = _wfopen(path, L"rb");
+  if (f == NULL) {
+    return NULL;
+  }
+  long len = 0;
+  if (fseek(f, 0, SEEK_END) == 0 && (len = ftell(f)) > 0 && fseek(f, 0, SEEK_SET) == 0) {
+    data = malloc((size_t)len);
+    if (data != NULL && fread(data, 1, (size_t)len, f) != (size_t)len) {
+      free(data);
+      data = NULL;
+    }
+  }
+  fclose(f);
+  *size = (size_t)len;
+  return data;
+}
+
+static bool write_file(SR_CHAR_T const *const path, uint8_t const *const data, size_t const size) {
+  FILE *f = _wfopen(path, L"wb");
+  if (f == NULL) {
+    return false;
+  }
+  bool const r = fwrite(data, 1, size, f) == size;
+  return fclose(f) == 0 && r;
+}
+
+static error create_session(OrtEnv *const env, uint8_t const *const data, size_t const size, OrtSession **const sess) {
+  OrtSessionOptions *session_options = NULL;
+  OrtStatus *st = NULL;
+  error err = eok();
+
+  st = g_ort->CreateSessionOptions(&session_options);
+  if (st == NULL) {
+    st = g_ort->AddFreeDimensionOverrideByName(session_options, "batch_size", 1);
+  }
+  if (st == NULL) {
+    st = g_ort->AddFreeDimensionOverrideByName(session_options, "height", tile_size);
+  }
+  if (st == NULL) {
+    st = g_ort->AddFreeDimensionOverrideByName(session_options, "width", tile_size);
+  }
+  if (st == NULL) {
+    st = g_ort->CreateSessionFromArray(env, data, size, session_options, sess);
+  }
+  if (st != NULL) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to create session: %hs", g_ort->GetErrorMessage(st));
+    g_ort->ReleaseStatus(st);
+  }
+  if (session_options != NULL) {
+    g_ort->ReleaseSessionOptions(session_options);
+  }
+  return err;
+}
+
+// Runs one tile, outputs are allocated by onnxruntime and released by the caller.
+static error run_tile(OrtSession *const sess,
+                      char const *const input_name,
+                      float *const tile,
+                      char const *const *const output_names,
+                      size_t const num_outputs,
+                      OrtValue **const outputs) {
+  OrtMemoryInfo *memory_info = NULL;
+  OrtValue *input = NULL;
+  OrtStatus *st = NULL;
+  error err = eok();
+
+  st = g_ort->CreateCpuMemoryInfo(OrtDeviceAllocator, OrtMemTypeDefault, &memory_info);
+  if (st == NULL) {
+    st = g_ort->CreateTensorWithDataAsOrtValue(memory_info,
+                                               tile,
+                                               3 * tile_size * tile_size * sizeof(float),
+                                               (int64_t[4]){1, 3, tile_size, tile_size},
+                                               4,
+                                               ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT,
+                                               &input);
+  }
+  if (st == NULL) {
+    st = g_ort->Run(sess, NULL, &input_name, (OrtValue const *const *)&input, 1, output_names, num_outputs, outputs);
+  }
+  if (st != NULL) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to run model: %hs", g_ort->GetErrorMessage(st));
+    g_ort->ReleaseStatus(st);
+  }
+  if (input != NULL) {
+    g_ort->ReleaseValue(input);
+  }
+  if (memory_info != NULL) {
+    g_ort->ReleaseMemoryInfo(memory_info);
+  }
+  return err;
+}
+
+static float const *tensor_floats(OrtValue *const value, size_t *const count) {
+  OrtTensorTypeAndShapeInfo *info = NULL;
+  float *data = NULL;
+  *count = 0;
+  OrtStatus *st = g_ort->GetTensorTypeAndShape(value, &info);
+  if (st == NULL) {
+    st = g_ort->GetTensorShapeElementCount(info, count);
+    g_ort->ReleaseTensorTypeAndShapeInfo(info);
+  }
+  if (st == NULL) {
+    st = g_ort->GetTensorMutableData(value, (void **)&data);
+  }
+  if (st != NULL) {
+    g_ort->ReleaseStatus(st);
+    return NULL;
+  }
+  return data;
+}
+
+static float clamp01(float const v) { return v < 0.f ? 0.f : v > 1.f ? 1.f : v; }
+
+// Mean SSIM over 8x8 windows with a stride of 4 on each channel of a CHW image in [0, 1].
+static double ssim(float const *const a, float const *const b, size_t const channels, size_t const width, size_t const height) {
+  enum { window = 8, stride = 4 };
+  double const c1 = 0.01 * 0.01, c2 = 0.03 * 0.03;
+  double sum = 0.;
+  size_t n = 0;
+  for (size_t c = 0; c < channels; ++c) {
+    for (size_t y = 0; y + window <= height; y += stride) {
+      for (size_t x = 0; x + window <= width; x += stride) {
+        double sa = 0., sb = 0., saa = 0., sbb = 0., sab = 0.;
+        for (size_t wy = 0; wy < window; ++wy) {
+          size_t const row = (c * height + y + wy) * width + x;
+          for (size_t wx = 0; wx < window; ++wx) {
+            double const va = (double)clamp01(a[row + wx]), vb = (double)clamp01(b[row + wx]);
+            sa += va;
+            sb += vb;
+            saa += va * va;
+            sbb += vb * vb;
+            sab += va * vb;
+          }
+        }
+        double const k = 1. / (window * window);
+        double const ma = sa * k, mb = sb * k;
+        double const va = saa * k - ma * ma, vb = sbb * k - mb * mb, cov = sab * k - ma * mb;
+        sum += ((2. * ma * mb + c1) * (2. * cov + c2)) / ((ma * ma + mb * mb + c1) * (va + vb + c2));
+        ++n;
+      }
+    }
+  }
+  return n ? sum / (double)n : 1.;
+}
+
+static double elapsed_ms(struct timespec const *const start, struct timespec const *const end) {
+  return (double)(end->tv_sec - start->tv_sec) * 1000. + (double)(end->tv_nsec - start->tv_nsec) / 1000000.;
+}
+
+// Cuts up to max_tiles tiles spread over the image, each tile_size square and inside the image when it is large enough.
+static error cut_tiles(SR_CHAR_T const *const path,
+                       bool const alpha,
+                       size_t const max_tiles,
+                       float **const tiles,
+                       size_t *const num_tiles) {
+  size_t const plane = 3 * tile_size * tile_size;
+  size_t w = 0, h = 0;
+  float *scratch = NULL;
+  error err = eok();
+  uint8_t *const image = image_load(path, &w, &h);
+  if (image == NULL) {
+    return emsg_i18nf(err_type_generic, err_fail, NULL, "failed to load image: %ls", path);
+  }
+  size_t const cols = (w + tile_size - 1) / tile_size, rows = (h + tile_size - 1) / tile_size;
+  size_t const step = (cols * rows + max_tiles - 1) / max_tiles;
+  size_t const n = (cols * rows + step - 1) / step;
+  float *const grown = realloc(*tiles, (*num_tiles + n) * plane * sizeof(float));
+  scratch = malloc(plane * sizeof(float));
+  if (grown == NULL || scratch == NULL) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to allocate tiles");
+    goto cleanup;
+  }
+  *tiles = grown;
+  for (size_t i = 0; i < cols * rows; i += step) {
+    size_t const x = i % cols * tile_size, y = i / cols * tile_size;
+    size_t const sx = w < tile_size ? 0 : x + tile_size > w ? w - tile_size : x;
+    size_t const sy = h < tile_size ? 0 : y + tile_size > h ? h - tile_size : y;
+    float *const tile = *tiles + (*num_tiles)++ * plane;
+    memset(tile, 0, plane * sizeof(float));
+    memset(scratch, 0, plane * sizeof(float));
+    hwc_to_chw32(image, w, h, sx, sy, tile_size, alpha ? scratch : tile, alpha ? tile : scratch);
+  }
+cleanup:
+  if (scratch) {
+    free(scratch);
+  }
+  image_free(image);
+  return err;
+}
+
+// Moves every fourth tile, or the last of fewer than four, behind the others, which are left for calibration.
+static error hold_out(float *const tiles, size_t const num_tiles, size_t *const num_calibration) {
+  size_t const plane = 3 * tile_size * tile_size;
+  *num_calibration = num_tiles;
+  if (num_tiles < 2) {
+    return eok();
+  }
+  float *const held = malloc((num_tiles / 4 + 1) * plane * sizeof(float));
+  if (held == NULL) {
+    return emsg_i18nf(err_type_generic, err_fail, NULL, "failed to allocate tiles");
+  }
+  size_t kept = 0, num_held = 0;
+  for (size_t i = 0; i < num_tiles; ++i) {
+    bool const evaluation = num_tiles < 4 ? i == num_tiles - 1 : i % 4 == 3;
+    float *const dst = evaluation ? held + num_held++ * plane : tiles + kept++ * plane;
+    if (dst != tiles + i * plane) {
+      memmove(dst, tiles + i * plane, plane * sizeof(float));
+    }
+  }
+  memcpy(tiles + kept * plane, held, num_held * plane * sizeof(float));
+  free(held);
+  *num_calibration = kept;
+  return eok();
+}
+
+static error calibrate(OrtEnv *const env,
+                       struct qdq_model *const model,
+                       char const *const input_name,
+                       float *const tiles,
+                       size_t const num_tiles) {
+  size_t const plane = 3 * tile_size * tile_size;
+  uint8_t *data = NULL;
+  size_t size = 0;
+  OrtSession *sess = NULL;
+  char const **names = NULL;
+  struct qdq_tensor **observed = NULL;
+  OrtValue **outputs = NULL;
+  size_t n = 0;
+  error err = eok();
+
+  if (!qdq_build_calibration_model(model, &data, &size)) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to build calibration model");
+    goto cleanup;
+  }
+  err = create_session(env, data, size, &sess);
+  if (efailed(err)) {
+    err = ethru(err);
+    goto cleanup;
+  }
+  names = calloc(model->num_tensors + 1, sizeof(char const *));
+  observed = calloc(model->num_tensors + 1, sizeof(struct qdq_tensor *));
+  outputs = calloc(model->num_tensors + 1, sizeof(OrtValue *));
+  if (names == NULL || observed == NULL || outputs == NULL) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to allocate calibration outputs");
+    goto cleanup;
+  }
+  for (size_t i = 0; i < model->num_tensors; ++i) {
+    if (!model->tensors[i].graph_input) {
+      names[n] = model->tensors[i].name;
+      observed[n++] = &model->tensors[i];
+    }
+  }
+  for (size_t t = 0; t < num_tiles; ++t) {
+    float *const tile = tiles + t * plane;
+    for (size_t i = 0; i < model->num_tensors; ++i) {
+      if (model->tensors[i].graph_input) {
+        qdq_observe(&model->tensors[i], tile, plane);
+      }
+    }
+    err = run_tile(sess, input_name, tile, names, n, outputs);
+    if (efailed(err)) {
+      err = ethru(err);
+      goto cleanup;
+    }
+    for (size_t i = 0; i < n; ++i) {
+      size_t count = 0;
+      float const *const values = tensor_floats(outputs[i], &count);
+      if (values != NULL) {
+        qdq_observe(observed[i], values, count);
+      }
+      g_ort->ReleaseValue(outputs[i]);
+      outputs[i] = NULL;
+    }
+  }
+cleanup:
+  if (outputs) {
+    free(outputs);
+  }
+  if (observed) {
+    free(observed);
+  }
+  if (names) {
+    free(names);
+  }
+  if (sess) {
+    g_ort->ReleaseSession(sess);
+  }
+  if (data) {
+    free(data);
+  }
+  return err;
+}
+
+// Compares the quantized model with the original on tiles, which in_sample marks as calibration tiles.
+static error evaluate(OrtEnv *const env,
+                      uint8_t const *const original,
+                      size_t const original_size,
+                      uint8_t const *const quantized,
+                      size_t const quantized_size,
+                      char const *const input_name,
+                      char const *const output_name,
+                      float *const tiles,
+                      size_t const num_tiles,
+                      bool const in_sample) {
+  size_t const plane = 3 * tile_size * tile_size;
+  OrtSession *sess[2] = {NULL};
+  OrtValue *outputs[2] = {NULL};
+  double ms[2] = {0};
+  double se = 0., ssim_sum = 0.;
+  size_t samples = 0;
+  error err = eok();
+
+  err = create_session(env, original, original_size, &sess[0]);
+  if (efailed(err)) {
+    err = ethru(err);
+    goto cleanup;
+  }
+  err = create_session(env, quantized, quantized_size, &sess[1]);
+  if (efailed(err)) {
+    err = ethru(err);
+    goto cleanup;
+  }
+  // one untimed run per session pays for its one-time setup, so that every evaluated tile is timed
+  for (size_t i = 0; i < 2; ++i) {
+    err = run_tile(sess[i], input_name, tiles, &output_name, 1, &outputs[i]);
+    if (efailed(err)) {
+      err = ethru(err);
+      goto cleanup;
+    }
+    g_ort->ReleaseValue(outputs[i]);
+    outputs[i] = NULL;
+  }
+  for (size_t t = 0; t < num_tiles; ++t) {
+    for (size_t i = 0; i < 2; ++i) {
+      struct timespec start, end;
+      timespec_get(&start, TIME_UTC);
+      err = run_tile(sess[i], input_name, tiles + t * plane, &output_name, 1, &outputs[i]);
+      timespec_get(&end, TIME_UTC);
+      if (efailed(err)) {
+        err = ethru(err);
+        goto cleanup;
+      }
+      ms[i] += elapsed_ms(&start, &end);
+    }
+    size_t count[2] = {0};
+    float const *const a = tensor_floats(outputs[0], &count[0]);
+    float const *const b = tensor_floats(outputs[1], &count[1]);
+    if (a == NULL || b == NULL || count[0] != count[1] || count[0] % 3 != 0) {
+      err = emsg_i18nf(err_type_generic, err_fail, NULL, "unexpected model output");
+      goto cleanup;
+    }
+    for (size_t i = 0; i < count[0]; ++i) {
+      double const d = (double)(clamp01(a[i]) - clamp01(b[i]));
+      se += d * d;
+    }
+    size_t const side = (size_t)sqrt((double)(count[0] / 3));
+    ssim_sum += ssim(a, b, 3, side, side);
+    samples += count[0];
+    for (size_t i = 0; i < 2; ++i) {
+      g_ort->ReleaseValue(outputs[i]);
+      outputs[i] = NULL;
+    }
+  }
+  {
+    double const mse = se / (double)samples;
+    double const psnr = mse > 0. ? 10. * log10(1. / mse) : (double)INFINITY;
+    SR_CHAR_T buf[512];
+    ov_snprintf(buf,
+                sizeof(buf) / sizeof(buf[0]),
+                NULL,
+                SR_TSTR("tiles: %1$zu (%7$ls)\nfloat32: %2$.2f ms/tile\nint8: %3$.2f ms/tile (%4$.2fx)\n")
+                    SR_TSTR("int8 vs float32: PSNR %5$.2f dB, SSIM %6$.4f\n"),
+                num_tiles,
+                ms[0] / (double)num_tiles,
+                ms[1] / (double)num_tiles,
+                ms[1] > 0. ? ms[0] / ms[1] : 0.,
+                psnr,
+                ssim_sum / (double)num_tiles,
+                in_sample ? SR_TSTR("calibration tiles, too few to hold any out") : SR_TSTR("held out from calibration"));
+    fputws(buf, stdout);
+  }
+cleanup:
+  for (size_t i = 0; i < 2; ++i) {
+    if (outputs[i]) {
+      g_ort->ReleaseValue(outputs[i]);
+    }
+    if (sess[i]) {
+      g_ort->ReleaseSession(sess[i]);
+    }
+  }
+  return err;
+}
+
+static error run(struct options const *const opts) {
+  struct model_manifest manifest = {0};
+  struct qdq_model model = {0};
+  OrtEnv *env = NULL;
+  uint8_t *original = NULL, *quantized = NULL;
+  size_t original_size = 0, quantized_size = 0;
+  float *tiles = NULL;
+  size_t num_tiles = 0, num_calibration = 0;
+  SR_CHAR_T error_msg[256] = {0};
+  error err = eok();
+
+  SR_CHAR_T const *const manifest_path = opts->manifest ? opts->manifest : MANIFEST_DEFAULT_PATH;
+  if ((opts->manifest || GetFileAttributesW(manifest_path) != INVALID_FILE_ATTRIBUTES) &&
+      !manifest_load(&manifest, manifest_path, error_msg)) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "%ls", error_msg);
+    goto cleanup;
+  }
+  // a manifest entry wins over a file of the same name
+  struct model_info const *const m = manifest_find(&manifest, opts->model);
+  SR_CHAR_T const *const path = m ? m->path : opts->model;
+  char const *const input_name = m ? m->input_name : "input";
+  char const *const output_name = m ? m->output_name : "output";
+  if (m && m->fp16) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "only float32 models can be quantized: %ls", path);
+    goto cleanup;
+  }
+
+  original = read_file(path, &original_size);
+  if (original == NULL) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to read model: %ls", path);
+    goto cleanup;
+  }
+  if (!qdq_parse(&model, original, original_size, error_msg)) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to parse model(%1$ls): %2$ls", path, error_msg);
+    goto cleanup;
+  }
+  for (size_t i = 0; i < opts->num_images; ++i) {
+    err = cut_tiles(opts->images[i], opts->alpha, opts->tiles, &tiles, &num_tiles);
+    if (efailed(err)) {
+      err = ethru(err);
+      goto cleanup;
+    }
+  }
+  // quality measured on the tiles the ranges came from would be optimistic
+  if (opts->num_evaluation_images) {
+    num_calibration = num_tiles;
+    for (size_t i = 0; i < opts->num_evaluation_images; ++i) {
+      err = cut_tiles(opts->evaluation_images[i], opts->alpha, opts->tiles, &tiles, &num_tiles);
+      if (efailed(err)) {
+        err = ethru(err);
+        goto cleanup;
+      }
+    }
+  } else {
+    err = hold_out(tiles, num_tiles, &num_calibration);
+    if (efailed(err)) {
+      err = ethru(err);
+      goto cleanup;
+    }
+  }
+
+  OrtStatus *const st = g_ort->CreateEnv(ORT_LOGGING_LEVEL_WARNING, "sr-quantize", &env);
+  if (st != NULL) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to create environment: %hs", g_ort->GetErrorMessage(st));
+    g_ort->ReleaseStatus(st);
+    goto cleanup;
+  }
+  err = calibrate(env, &model, input_name, tiles, num_calibration);
+  if (efailed(err)) {
+    err = ethru(err);
+    goto cleanup;
+  }
+  if (!qdq_build_quantized_model(&model, &quantized, &quantized_size)) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to build quantized model");
+    goto cleanup;
+  }
+  if (!write_file(opts->output, quantized, quantized_size)) {
+    err = emsg_i18nf(err_type_generic, err_fail, NULL, "failed to write model: %ls", opts->output);
+    goto cleanup;
+  }
+  {
+    size_t const plane = 3 * tile_size * tile_size;
+    bool const in_sample = num_calibration == num_tiles;
+    err = evaluate(env,
+                   original,
+                   original_size,
+                   quantized,
+                   quantized_size,
+                   input_name,
+                   output_name,
+                   in_sample ? tiles : tiles + num_calibration * plane,
+                   in_sample ? num_tiles : num_tiles - num_calibration,
+                   in_sample);
+  }
+  if (efailed(err)) {
+    err = ethru(err);
+    goto cleanup;
+  }
+cleanup:
+  if (tiles) {
+    free(tiles);
+  }
+  if (quantized) {
+    free(quantized);
+  }
+  if (env) {
+    g_ort->ReleaseEnv(env);
+  }
+  qdq_free(&model);
+  if (original) {
+    free(original);
+  }
+  manifest_free(&manifest);
+  return err;
+}
+
+int wmain(int const argc, wchar_t **const argv) {
+  int exit_code = 0;
+  struct options opts = {
+      .images = calloc((size_t)argc, sizeof(SR_CHAR_T const *)),
+      .evaluation_images = calloc((size_t)argc, sizeof(SR_CHAR_T const *)),
+      .tiles = 16,
+  };
+  ov_init();
+  g_ort = OrtGetApiBase()->GetApi(ORT_API_VERSION);
+  if (!g_ort) {
+    fputws(L"failed to get onnxruntime api.\n", stderr);
+    exit_code = 1;
+    goto cleanup;
+  }
+  if (opts.images == NULL || opts.evaluation_images == NULL || !parse_options(argc, argv, &opts)) {
+    fputws(g_usage, stderr);
+    exit_code = 2;
+    goto cleanup;
+  }
+  error err = run(&opts);
+  if (efailed(err)) {
+    ereport(err);
+    exit_code = 1;
+  }
+cleanup:
+  if (opts.images) {
+    free(opts.images);
+  }
+  if (opts.evaluation_images) {
+    free(opts.evaluation_images);
+  }
+  ov_exit();
+  return exit_code;
+}
@@ -1,44 +1,97 @@
 #include "session.h"
 
+#include "arena.h"
 #include "image.h"
+#include "tile_cache.h"
 
 #include <ovprintf.h>
 #include <ovthreads.h>
 
+#include <sys/stat.h>
+
 enum {
-  tile_size = 128,
-  batch_size = 1,
+  default_tile_size = 128,
+  default_batch_size = 1,
+  max_batch_size = 8,
+  max_scale = 16,
+  tile_overlap = 8,
 };
 
+static size_t tensor_bytes(size_t const batch_size, size_t const channels, size_t const width, size_t const height) {
+  return batch_size * channels * width * height * sizeof(FLOAT_TYPE);
+}
+
+// The tensor does not own data, which must outlive it.
+static OrtValue *wrap_tensor(FLOAT_TYPE *const ptr,
+                             OrtMemoryInfo const *const memory_info,
+                             size_t const batch_size,
+                             size_t const channels,
+                             size_t const width,
+                             size_t const height) {
+  OrtStatus *st = NULL;
+  OrtValue *tensor = NULL;
+  size_t const bytes = tensor_bytes(batch_size, channels, width, height);
+  st = g_ort->CreateTensorWithDataAsOrtValue(memory_info,
+                                             ptr,
+                                             bytes,
+                                             (int64_t[4]){
+                                                 (int64_t)batch_size,
+                                                 (int64_t)channels,
+                                                 (int64_t)height,
+                                                 (int64_t)width,
+                                             },
+                                             4,
+                                             TENSOR_TYPE,
+                                             &tensor);
+  if (st != NULL) {
+    g_ort->ReleaseStatus(st);
+    return NULL;
+  }
+  return tensor;
+}
+
+// The tensor wraps memory taken from arena, it must be released before the arena is reset.
 static OrtValue *create_tensor(FLOAT_TYPE **const data,
-                               OrtAllocator *const allocator,
+                               struct arena *const arena,
+                               OrtMemoryInfo const *const memory_info,
                                size_t const batch_size,
                                size_t const channels,
                                size_t const width,
                                size_t const height) {
-  OrtStatus *st = NULL;
-  OrtValue *tensor = NULL;
-  st = g_ort->CreateTensorAsOrtValue(allocator,
-                                     (int64_t[4]){
-                                         (int64_t)batch_size,
-                                         (int64_t)channels,
-                                         (int64_t)height,
-                                         (int64_t)width,
-                                     },
-                                     4,
-                                     TENSOR_TYPE,
-                                     &tensor);
-  if (st != NULL) {
+  FLOAT_TYPE *const ptr = arena_alloc(arena, tensor_bytes(batch_size, channels, width, height));
+  if (ptr == NULL) {
     return NULL;
   }
-  st = g_ort->GetTensorMutableData(tensor, (void **)data);
-  if (st != NULL) {
-    g_ort->ReleaseValue(tensor);
-    return NULL;
+  OrtValue *const tensor = wrap_tensor(ptr, memory_info, batch_size, channels, width, height);
+  if (tensor != NULL) {
+    *data = ptr;
   }
   return tensor;
 }
 
+// Per-model tensor names and scale, taken from the model manifest.
+struct model_io {
+  char input_name[64];
+  char output_name[64];
+  size_t scale;
+  size_t channels;  // 4 for an RGBA model, which runs in both slots as one session
+  size_t tile_size; // the input shape the model was loaded for, see session_set_tuning
+  size_t batch_size;
+  bool shared;        // one session runs RGB and Alpha tiles as a single batch, so the batch size is left free
+  bool dynamic_batch; // the model accepts any batch size
+};
+
+// A model session built on any thread, see install_model.
+struct built_model {
+  struct session const *session;
+  struct session_options const *opts; // NULL if the model is not loaded
+  OrtSession *sess;
+  struct model_io io;
+  uint64_t id;
+  bool shared; // build for both slots, see model_io.shared
+  SR_CHAR_T error_msg[256];
+};
+
 struct session {
   OrtEnv *env;
   OrtSession *rgb_session;
@@ -51,6 +104,67 @@ struct session {
   FLOAT_TYPE *output_rgb_tensors_data[2];
   FLOAT_TYPE *input_alpha_tensors_data[2];
   FLOAT_TYPE *output_alpha_tensors_data[2];
+  // RGB and Alpha tensors of a set as one batch of twice the size, views of the same memory for a shared model;
+  // for an RGBA model one batch of four channels over the same memory
+  OrtValue *input_tensors[2];
+  OrtValue *output_tensors[2];
+  struct arena arena; // backs all tensors, see prepare_outputs
+  size_t tile_size;   // of the tensors
+  size_t batch_size;
+  size_t channels;
+  struct session_tuning tuning; // for models loaded next
+  OrtMemoryInfo *memory_info;
+  uint64_t rgb_model_id;
+  uint64_t alpha_model_id;
+  struct model_io rgb_io;
+  struct model_io alpha_io;
+  size_t scale;            // of the tensors, 0 until the first inference
+  size_t output_numerator; // requested output scale, 0 for the scale of the model
+  size_t output_denominator;
+  struct image_resample resample; // reduces model output tiles to the output scale
+  struct tile_cache *cache;
+  size_t cache_capacity;
+  size_t cache_batch_size; // the cache was sized for
+  SR_CHAR_T *cache_directory;
+  struct session_stats stats;
+  bool cold; // the models have not run since they were loaded
+  struct warm_up {
+    size_t runs;
+    uint64_t cold_us;
+    uint64_t warm_us;
+    OrtStatus *status;
+  } warm_up; // owned by warm_up_thread while warm_up_running, see session_warm_up
+  thrd_t warm_up_thread;
+  bool warm_up_running;
+  struct model_load {
+    struct built_model models[2]; // RGB and Alpha
+    void (*done)(bool const succeeded, void *const userdata);
+    void *userdata;
+    bool succeeded;
+  } load; // owned by load_thread while load_running, see session_load_models_async
+  thrd_t load_thread;
+  bool load_running;
+  struct tile *tiles;
+  uint8_t *tiles_done;    // per grid cell, non-zero once the destination holds its output
+  uint8_t *tiles_changed; // per grid cell with previous_source, non-zero where its input differs
+  uint8_t *patch_tile;    // RGBA8 output of a rerun tile with previous_source and no tile cache
+  size_t patch_tile_bytes;
+  size_t tiles_capacity;
+  size_t grid_width;
+  size_t grid_height;
+  struct viewport {
+    size_t x;
+    size_t y;
+    size_t width; // 0 for the whole region of interest
+    size_t height;
+  } viewport; // guarded by mtx, see session_set_viewport
+  OrtRunOptions *run_options; // shared by all runs so that session_cancel can terminate them
+  atomic_bool cancel_requested;
+  struct {
+    atomic_size_t tiles_written;
+    atomic_size_t tiles_total;
+    atomic_int stop; // enum session_stop
+  } progress; // written by session_inference, read by session_get_progress from any thread
   mtx_t mtx;
   cnd_t cnd;
   SR_CHAR_T last_error[256];
@@ -58,7 +172,6 @@ struct session {
 
 struct session *session_create(SR_CHAR_T error_msg[256]) {
   struct session *session = NULL;
-  OrtAllocator *allocator = NULL;
   OrtStatus *st = NULL;
   SR_CHAR_T const *msg = NULL;
 
@@ -69,6 +182,7 @@ struct session *session_create(SR_CHAR_T error_msg[256]) {
     goto cleanup;
   }
   memset(session, 0, sizeof(struct session));
+  session->load.succeeded = true;
 
   mtx_init(&session->mtx, mtx_plain);
   cnd_init(&session->cnd);
@@ -79,35 +193,16 @@ struct session *session_create(SR_CHAR_T error_msg[256]) {
     goto cleanup;
   }
 
-  st = g_ort->GetAllocatorWithDefaultOptions(&allocator);
+  st = g_ort->CreateCpuMemoryInfo(OrtDeviceAllocator, OrtMemTypeDefault, &session->memory_info);
   if (st != NULL) {
-    msg = SR_TSTR("failed to get default allocator.");
+    msg = SR_TSTR("failed to create memory info.");
     goto cleanup;
   }
 
-  for (size_t i = 0; i < 2; ++i) {
-    session->input_rgb_tensors[i] = create_tensor(&session->input_rgb_tensors_data[i], allocator, batch_size, 3, tile_size, tile_size);
-    if (session->input_rgb_tensors[i] == NULL) {
-      msg = SR_TSTR("failed to input rgb tensor.");
-      goto cleanup;
-    }
-    session->input_alpha_tensors[i] = create_tensor(&session->input_alpha_tensors_data[i], allocator, batch_size, 3, tile_size, tile_size);
-    if (session->input_alpha_tensors[i] == NULL) {
-      msg = SR_TSTR("failed to input alpha tensor.");
-      goto cleanup;
-    }
-    session->output_rgb_tensors[i] =
-        create_tensor(&session->output_rgb_tensors_data[i], allocator, batch_size, 3, tile_size * 4, tile_size * 4);
-    if (session->output_rgb_tensors[i] == NULL) {
-      msg = SR_TSTR("failed to output rgb tensor.");
-      goto cleanup;
-    }
-    session->output_alpha_tensors[i] =
-        create_tensor(&session->output_alpha_tensors_data[i], allocator, batch_size, 3, tile_size * 4, tile_size * 4);
-    if (session->output_alpha_tensors[i] == NULL) {
-      msg = SR_TSTR("failed to output alpha tensor.");
-      goto cleanup;
-    }
+  st = g_ort->CreateRunOptions(&session->run_options);
+  if (st != NULL) {
+    msg = SR_TSTR("failed to create run options.");
+    goto cleanup;
   }
 
 cleanup:
@@ -122,11 +217,49 @@ cleanup:
   return session;
 }
 
+static bool finish_warm_up(struct session *const session, bool const report);
+static bool finish_load(struct session *const session);
+
 void session_destroy(struct session *const session) {
   if (session == NULL) {
     return;
   }
+  finish_load(session);
+  finish_warm_up(session, false);
+  if (session->cache != NULL) {
+    tile_cache_destroy(session->cache);
+    session->cache = NULL;
+  }
+  if (session->cache_directory != NULL) {
+    free(session->cache_directory);
+    session->cache_directory = NULL;
+  }
+  if (session->tiles != NULL) {
+    free(session->tiles);
+    session->tiles = NULL;
+  }
+  if (session->tiles_done != NULL) {
+    free(session->tiles_done);
+    session->tiles_done = NULL;
+  }
+  if (session->tiles_changed != NULL) {
+    free(session->tiles_changed);
+    session->tiles_changed = NULL;
+  }
+  if (session->patch_tile != NULL) {
+    free(session->patch_tile);
+    session->patch_tile = NULL;
+  }
+  image_resample_free(&session->resample);
   for (size_t i = 0; i < 2; ++i) {
+    if (session->output_tensors[i] != NULL) {
+      g_ort->ReleaseValue(session->output_tensors[i]);
+      session->output_tensors[i] = NULL;
+    }
+    if (session->input_tensors[i] != NULL) {
+      g_ort->ReleaseValue(session->input_tensors[i]);
+      session->input_tensors[i] = NULL;
+    }
     if (session->output_alpha_tensors[i] != NULL) {
       g_ort->ReleaseValue(session->output_alpha_tensors[i]);
       session->output_alpha_tensors[i] = NULL;
@@ -148,14 +281,23 @@ void session_destroy(struct session *const session) {
       session->input_rgb_tensors_data[i] = NULL;
     }
   }
-  if (session->alpha_session != NULL) {
+  arena_destroy(&session->arena);
+  if (session->memory_info) {
+    g_ort->ReleaseMemoryInfo(session->memory_info);
+    session->memory_info = NULL;
+  }
+  if (session->alpha_session != NULL && session->alpha_session != session->rgb_session) {
     g_ort->ReleaseSession(session->alpha_session);
-    session->alpha_session = NULL;
   }
+  session->alpha_session = NULL;
   if (session->rgb_session != NULL) {
     g_ort->ReleaseSession(session->rgb_session);
     session->rgb_session = NULL;
   }
+  if (session->run_options) {
+    g_ort->ReleaseRunOptions(session->run_options);
+    session->run_options = NULL;
+  }
   if (session->env) {
     g_ort->ReleaseEnv(session->env);
     session->env = NULL;
@@ -193,7 +335,11 @@ static OrtStatus *append_dml_related_options(OrtSessionOptions *session_options,
   return NULL;
 }
 
-static OrtSession *load_model(struct session_options const *const opts, OrtEnv *const env, SR_CHAR_T error_msg[256]) {
+static OrtSession *load_model(struct session_options const *const opts,
+                              struct model_io const *const io,
+                              size_t const threads,
+                              OrtEnv *const env,
+                              SR_CHAR_T error_msg[256]) {
   OrtSessionOptions *session_options = NULL;
   OrtSession *sess = NULL;
   OrtStatus *st = NULL;
@@ -223,17 +369,27 @@ static OrtSession *load_model(struct session_options const *const opts, OrtEnv *
 #endif
   }
 
-  st = g_ort->AddFreeDimensionOverrideByName(session_options, "batch_size", (int64_t)batch_size);
-  if (st != NULL) {
-    msg = SR_TSTR("failed to add batch size override.");
-    goto cleanup;
+  if (threads) {
+    st = g_ort->SetIntraOpNumThreads(session_options, (int)threads);
+    if (st != NULL) {
+      msg = SR_TSTR("failed to set thread count.");
+      goto cleanup;
+    }
   }
-  st = g_ort->AddFreeDimensionOverrideByName(session_options, "height", (int64_t)tile_size);
+
+  if (!io->shared) {
+    st = g_ort->AddFreeDimensionOverrideByName(session_options, "batch_size", (int64_t)io->batch_size);
+    if (st != NULL) {
+      msg = SR_TSTR("failed to add batch size override.");
+      goto cleanup;
+    }
+  }
+  st = g_ort->AddFreeDimensionOverrideByName(session_options, "height", (int64_t)io->tile_size);
   if (st != NULL) {
     msg = SR_TSTR("failed to add height override.");
     goto cleanup;
   }
-  st = g_ort->AddFreeDimensionOverrideByName(session_options, "width", (int64_t)tile_size);
+  st = g_ort->AddFreeDimensionOverrideByName(session_options, "width", (int64_t)io->tile_size);
   if (st != NULL) {
     msg = SR_TSTR("failed to add width override.");
     goto cleanup;
@@ -266,40 +422,380 @@ cleanup:
   return sess;
 }
 
-bool session_load_rgb_model(struct session *const session, struct session_options const *const opts) {
-  OrtSession *sess = NULL;
-  if (session == NULL) {
-    session->last_error[sr_append(session->last_error, SR_TSTR("session is NULL."))] = SR_TSTR('\0');
+uint64_t session_get_file_stamp(SR_CHAR_T const *const path) {
+#ifdef _WIN32
+  struct _stat64 st;
+  if (path == NULL || _wstat64(path, &st) != 0) {
+    return 0;
+  }
+#else
+  struct stat st;
+  if (path == NULL || stat(path, &st) != 0) {
+    return 0;
+  }
+#endif
+  struct hash h;
+  hash_init(&h, 0);
+  hash_word(&h, (uint64_t)st.st_size);
+  hash_word(&h, (uint64_t)st.st_mtime);
+  hash_final(&h);
+  return h.v[0] ? h.v[0] : 1;
+}
+
+static uint64_t model_identity(struct session_options const *const opts) {
+  struct hash h;
+  hash_init(&h, (uint64_t)opts->provider.type);
+  if (opts->memory.len) {
+    hash_update(&h, opts->memory.ptr, opts->memory.len);
+  } else {
+    // a file replaced in place keeps its path, so its size and time tell the versions apart
+    hash_update(&h, opts->file.path, SR_STRLEN(opts->file.path) * sizeof(SR_CHAR_T));
+    hash_word(&h, session_get_file_stamp(opts->file.path));
+  }
+  hash_final(&h);
+  return h.v[0];
+}
+
+static bool copy_tensor_name(char dst[64], char const *const src) {
+  size_t const len = strlen(src);
+  if (len == 0 || len >= 64) {
     return false;
   }
-  sess = load_model(opts, session->env, session->last_error);
-  if (sess == NULL) {
+  memcpy(dst, src, len + 1);
+  return true;
+}
+
+static bool get_model_io(struct session_options const *const opts, struct model_io *const io, SR_CHAR_T error_msg[256]) {
+  SR_CHAR_T const *msg = NULL;
+  if (!copy_tensor_name(io->input_name, opts->input_name ? opts->input_name : "input") ||
+      !copy_tensor_name(io->output_name, opts->output_name ? opts->output_name : "output")) {
+    msg = SR_TSTR("invalid tensor name.");
+    goto cleanup;
+  }
+  io->scale = opts->scale ? opts->scale : 4;
+  if (io->scale > max_scale) {
+    msg = SR_TSTR("unsupported model scale.");
+    goto cleanup;
+  }
+  if (opts->fp16 != (bool)USE_HALF) {
+    msg = SR_TSTR("the model precision does not match the tensor type of this build.");
+    goto cleanup;
+  }
+  io->channels = opts->channels ? opts->channels : 3;
+  if (io->channels != 3 && io->channels != 4) {
+    msg = SR_TSTR("unsupported channel count.");
+    goto cleanup;
+  }
+cleanup:
+  if (msg != NULL) {
+    error_msg[sr_append(error_msg, msg)] = SR_TSTR('\0');
     return false;
   }
-  if (session->rgb_session != NULL) {
-    g_ort->ReleaseSession(session->rgb_session);
+  return true;
+}
+
+// Takes the scale from the output shape when the model has a fixed one after the free dimension overrides,
+// otherwise keeps the scale given by the model metadata.
+static bool resolve_model_scale(OrtSession *const sess, struct model_io *const io, SR_CHAR_T error_msg[256]) {
+  OrtAllocator *allocator = NULL;
+  OrtTypeInfo *type_info = NULL;
+  OrtStatus *st = NULL;
+  SR_CHAR_T const *msg = NULL;
+  size_t count = 0;
+  size_t index = SIZE_MAX;
+
+  st = g_ort->GetAllocatorWithDefaultOptions(&allocator);
+  if (st != NULL) {
+    msg = SR_TSTR("failed to get default allocator.");
+    goto cleanup;
+  }
+  st = g_ort->SessionGetOutputCount(sess, &count);
+  if (st != NULL) {
+    msg = SR_TSTR("failed to get output count.");
+    goto cleanup;
+  }
+  for (size_t i = 0; i < count && index == SIZE_MAX; ++i) {
+    char *name = NULL;
+    st = g_ort->SessionGetOutputName(sess, i, allocator, &name);
+    if (st != NULL) {
+      msg = SR_TSTR("failed to get output name.");
+      goto cleanup;
+    }
+    if (strcmp(name, io->output_name) == 0) {
+      index = i;
+    }
+    g_ort->AllocatorFree(allocator, name);
+  }
+  if (index == SIZE_MAX) {
+    st = g_ort->CreateStatus(ORT_INVALID_ARGUMENT, io->output_name);
+    msg = SR_TSTR("model has no output with this name");
+    goto cleanup;
+  }
+  st = g_ort->SessionGetOutputTypeInfo(sess, index, &type_info);
+  if (st != NULL) {
+    msg = SR_TSTR("failed to get output type info.");
+    goto cleanup;
+  }
+  OrtTensorTypeAndShapeInfo const *tensor_info = NULL;
+  st = g_ort->CastTypeInfoToTensorInfo(type_info, &tensor_info);
+  if (st == NULL && tensor_info == NULL) {
+    st = g_ort->CreateStatus(ORT_INVALID_ARGUMENT, io->output_name);
+  }
+  if (st != NULL) {
+    msg = SR_TSTR("output is not a tensor");
+    goto cleanup;
+  }
+  size_t num_dims = 0;
+  st = g_ort->GetDimensionsCount(tensor_info, &num_dims);
+  if (st != NULL) {
+    msg = SR_TSTR("failed to get output dimensions.");
+    goto cleanup;
+  }
+  if (num_dims != 4) {
+    st = g_ort->CreateStatus(ORT_INVALID_ARGUMENT, "output must be NCHW.");
+    msg = SR_TSTR("unsupported output shape");
+    goto cleanup;
+  }
+  int64_t dims[4] = {0};
+  st = g_ort->GetDimensions(tensor_info, dims, 4);
+  if (st != NULL) {
+    msg = SR_TSTR("failed to get output dimensions.");
+    goto cleanup;
+  }
+  if (dims[1] > 0 && dims[1] != (int64_t)io->channels) {
+    st = g_ort->CreateStatus(ORT_INVALID_ARGUMENT, "output channels do not match the channel layout of the model.");
+    msg = SR_TSTR("unsupported output shape");
+    goto cleanup;
+  }
+  if (dims[2] > 0) {
+    int64_t const tile_size = (int64_t)io->tile_size;
+    if (dims[2] % tile_size != 0 || dims[2] / tile_size > (int64_t)max_scale) {
+      st = g_ort->CreateStatus(ORT_INVALID_ARGUMENT, "output height is not a supported multiple of the input height.");
+      msg = SR_TSTR("unsupported output shape");
+      goto cleanup;
+    }
+    io->scale = (size_t)(dims[2] / tile_size);
+  }
+  io->dynamic_batch = dims[0] <= 0;
+cleanup:
+  if (type_info != NULL) {
+    g_ort->ReleaseTypeInfo(type_info);
+  }
+  if (st != NULL) {
+    ov_snprintf(error_msg, 256, NULL, SR_TSTR("%ls: %hs(%d)"), msg, g_ort->GetErrorMessage(st), g_ort->GetErrorCode(st));
+    g_ort->ReleaseStatus(st);
+    return false;
   }
-  session->rgb_session = sess;
   return true;
 }
 
-bool session_load_alpha_model(struct session *const session, struct session_options const *const opts) {
-  OrtSession *sess = NULL;
+// Only reads the tuning and environment of the session, so both models can be built at the same time.
+static bool build_model(struct built_model *const m) {
+  struct session const *const session = m->session;
+  if (!get_model_io(m->opts, &m->io, m->error_msg)) {
+    return false;
+  }
+  m->io.tile_size = session->tuning.tile_size ? session->tuning.tile_size : default_tile_size;
+  m->io.batch_size = session->tuning.batch_size ? session->tuning.batch_size : default_batch_size;
+  m->io.shared = m->shared;
+  m->sess = load_model(m->opts, &m->io, session->tuning.threads, session->env, m->error_msg);
+  if (m->sess == NULL) {
+    return false;
+  }
+  if (!resolve_model_scale(m->sess, &m->io, m->error_msg)) {
+    g_ort->ReleaseSession(m->sess);
+    m->sess = NULL;
+    return false;
+  }
+  m->id = model_identity(m->opts);
+  return true;
+}
+
+static int build_model_main(void *const userdata) { return build_model(userdata) ? 1 : 0; }
+
+static void install_model(struct session *const session, struct built_model *const m, bool const alpha) {
+  finish_warm_up(session, false);
+  session->cold = true;
+  OrtSession **const slot = alpha ? &session->alpha_session : &session->rgb_session;
+  OrtSession *const other = alpha ? session->rgb_session : session->alpha_session;
+  // a shared model stays with the other slot, it runs any batch size on its own
+  if (*slot != NULL && *slot != other) {
+    g_ort->ReleaseSession(*slot);
+  }
+  *slot = m->sess;
+  m->sess = NULL;
+  if (alpha) {
+    session->alpha_model_id = m->id;
+    session->alpha_io = m->io;
+  } else {
+    session->rgb_model_id = m->id;
+    session->rgb_io = m->io;
+  }
+}
+
+// An RGBA model fills both slots, RGB and Alpha come out of the same run.
+static void install_built_model(struct session *const session, struct built_model *const m, bool const alpha) {
+  if (m->io.channels != 4) {
+    install_model(session, m, alpha);
+    return;
+  }
+  struct built_model other = *m;
+  install_model(session, m, false);
+  install_model(session, &other, true);
+}
+
+static bool load_one(struct session *const session, struct session_options const *const opts, bool const alpha) {
   if (session == NULL) {
-    session->last_error[sr_append(session->last_error, SR_TSTR("session is NULL."))] = SR_TSTR('\0');
     return false;
   }
-  sess = load_model(opts, session->env, session->last_error);
-  if (sess == NULL) {
+  finish_load(session);
+  struct built_model m = {
+      .session = session,
+      .opts = opts,
+  };
+  if (!build_model(&m)) {
+    memcpy(session->last_error, m.error_msg, sizeof(m.error_msg));
     return false;
   }
-  if (session->alpha_session != NULL) {
-    g_ort->ReleaseSession(session->alpha_session);
+  install_built_model(session, &m, alpha);
+  return true;
+}
+
+bool session_load_rgb_model(struct session *const session, struct session_options const *const opts) {
+  return load_one(session, opts, false);
+}
+
+bool session_load_alpha_model(struct session *const session, struct session_options const *const opts) {
+  return load_one(session, opts, true);
+}
+
+static bool same_model(struct session_options const *const a, struct session_options const *const b) {
+  struct model_io x = {0}, y = {0};
+  SR_CHAR_T error_msg[256];
+  return model_identity(a) == model_identity(b) && a->provider.type == b->provider.type &&
+         (a->provider.type != PROVIDER_DML || a->provider.dml.device_id == b->provider.dml.device_id) && a->fp16 == b->fp16 &&
+         get_model_io(a, &x, error_msg) && get_model_io(b, &y, error_msg) && strcmp(x.input_name, y.input_name) == 0 &&
+         strcmp(x.output_name, y.output_name) == 0 && x.scale == y.scale && x.channels == y.channels;
+}
+
+// The same model in both slots is built once, without a batch override, and runs the RGB and Alpha tiles of a
+// batch together. Models with a fixed batch size in the file are built twice as before.
+static bool build_shared_model(struct built_model *const rgb, struct built_model *const alpha) {
+  rgb->shared = true;
+  if (build_model(rgb) && rgb->io.dynamic_batch) {
+    alpha->sess = rgb->sess;
+    alpha->io = rgb->io;
+    alpha->id = rgb->id;
+    return true;
+  }
+  if (rgb->sess != NULL) {
+    g_ort->ReleaseSession(rgb->sess);
   }
-  session->alpha_session = sess;
+  *rgb = (struct built_model){
+      .session = rgb->session,
+      .opts = rgb->opts,
+  };
+  return false;
+}
+
+// Builds the Alpha model on a thread of its own while this one builds the RGB model, and installs both only if
+// both succeed, so a failure leaves the previous models in place.
+static int load_main(void *const userdata) {
+  struct session *const session = userdata;
+  struct model_load *const l = &session->load;
+  struct built_model *const rgb = &l->models[0], *const alpha = &l->models[1];
+  // an RGBA model takes both slots, the other model is not needed
+  if (rgb->opts && rgb->opts->channels == 4) {
+    alpha->opts = NULL;
+  } else if (alpha->opts && alpha->opts->channels == 4) {
+    rgb->opts = NULL;
+  }
+  if (rgb->opts && alpha->opts && same_model(rgb->opts, alpha->opts) && build_shared_model(rgb, alpha)) {
+    install_model(session, rgb, false);
+    install_model(session, alpha, true);
+    l->succeeded = true;
+    if (l->done) {
+      l->done(true, l->userdata);
+    }
+    return 0;
+  }
+  thrd_t thrd;
+  bool const concurrent = rgb->opts && alpha->opts && thrd_create(&thrd, build_model_main, alpha) == thrd_success;
+  bool ok = rgb->opts == NULL || build_model(rgb);
+  if (concurrent) {
+    int r = 0;
+    thrd_join(thrd, &r);
+    ok = ok && r;
+  } else if (ok && alpha->opts) {
+    ok = build_model(alpha);
+  }
+  if (ok) {
+    if (rgb->opts) {
+      install_built_model(session, rgb, false);
+    }
+    if (alpha->opts) {
+      install_built_model(session, alpha, true);
+    }
+  } else {
+    struct built_model const *const failed = rgb->error_msg[0] != SR_TSTR('\0') ? rgb : alpha;
+    memcpy(session->last_error, failed->error_msg, sizeof(failed->error_msg));
+    for (size_t i = 0; i < 2; ++i) {
+      if (l->models[i].sess != NULL) {
+        g_ort->ReleaseSession(l->models[i].sess);
+        l->models[i].sess = NULL;
+      }
+    }
+  }
+  l->succeeded = ok;
+  if (l->done) {
+    l->done(ok, l->userdata);
+  }
+  return 0;
+}
+
+// Waits for session_load_models_async, returns false if it failed.
+static bool finish_load(struct session *const session) {
+  if (session->load_running) {
+    thrd_join(session->load_thread, NULL);
+    session->load_running = false;
+  }
+  return session->load.succeeded;
+}
+
+bool session_load_models_async(struct session *const session,
+                               struct session_options const *const rgb,
+                               struct session_options const *const alpha,
+                               void (*const done)(bool const succeeded, void *const userdata),
+                               void *const userdata) {
+  if (session == NULL) {
+    return false;
+  }
+  finish_load(session);
+  session->load = (struct model_load){
+      .models =
+          {
+              {.session = session, .opts = rgb},
+              {.session = session, .opts = alpha},
+          },
+      .done = done,
+      .userdata = userdata,
+  };
+  if (thrd_create(&session->load_thread, load_main, session) != thrd_success) {
+    session->last_error[sr_append(session->last_error, SR_TSTR("failed to start loading models"))] = SR_TSTR('\0');
+    session->load.succeeded = false;
+    return false;
+  }
+  session->load_running = true;
   return true;
 }
 
+bool session_wait_models(struct session *const session) {
+  if (session == NULL) {
+    return false;
+  }
+  return finish_load(session);
+}
+
 struct async_context {
   struct session *session;
   size_t n;
@@ -323,6 +819,12 @@ static void async_callback(void *user_data, OrtValue **outputs, size_t num_outpu
   mtx_unlock(&ctx->session->mtx);
 }
 
+static inline void swap_tensor(OrtValue **const a, OrtValue **const b) {
+  OrtValue *const tmp = *a;
+  *a = *b;
+  *b = tmp;
+}
+
 static inline void swap_tensor_and_data(OrtValue **const a, OrtValue **const b, FLOAT_TYPE **const c, FLOAT_TYPE **const d) {
   OrtValue *tmp1 = *a;
   FLOAT_TYPE *tmp2 = *c;
@@ -332,9 +834,20 @@ static inline void swap_tensor_and_data(OrtValue **const a, OrtValue **const b,
   *d = tmp2;
 }
 
+struct tile {
+  size_t x;
+  size_t y;
+  size_t cell; // index in the grid, see tiles_done
+  bool skip;
+};
+
 struct position {
   size_t x;
   size_t y;
+  size_t cell;
+  size_t slot;           // index in the batch tensors
+  uint8_t const *cached; // non-NULL when the tile is served from the tile cache
+  struct hash key;
 };
 
 static inline void swap_position(struct position *const a, struct position *const b) {
@@ -343,27 +856,689 @@ static inline void swap_position(struct position *const a, struct position *cons
   *b = tmp;
 }
 
+static void tile_key(struct session const *const session,
+                     uint8_t const *const source,
+                     size_t const sw,
+                     size_t const sh,
+                     size_t const sx,
+                     size_t const sy,
+                     size_t const overlap,
+                     size_t const tile_out,
+                     bool const premultiply,
+                     struct hash *const key) {
+  hash_init(key, session->rgb_model_id);
+  hash_word(key, session->alpha_model_id);
+  size_t const tile_size = session->tile_size;
+  hash_word(key, (uint64_t)tile_size << 32 | (uint64_t)overlap);
+  if (tile_out != tile_size * session->scale) {
+    // tiles reduced to an output scale below the model's, native tiles keep their old keys
+    hash_word(key, (uint64_t)tile_out);
+  }
+  if (premultiply) {
+    hash_word(key, UINT64_C(0x7072656d756c));
+  }
+  image_hash_tile(source, sw, sh, sx, sy, tile_size, key);
+  hash_final(key);
+}
+
+// Returns the range [*begin, *end) of grid tiles whose window along an axis intersects [roi, roi + len).
+static void tile_span(size_t const roi,
+                      size_t const len,
+                      size_t const size,
+                      size_t const tile_size,
+                      size_t const step,
+                      size_t *const begin,
+                      size_t *const end) {
+  size_t const n = (size + step - 1) / step;
+  size_t const e = (roi + len + step - 1) / step;
+  *begin = roi < tile_size ? 0 : (roi - tile_size) / step + 1;
+  *end = e < n ? e : n;
+}
+
+// Reports whether a tile in columns [x0, x1) and rows [y0, y1) of the grid, clipped to it, has changed input.
+static bool any_changed(struct session const *const session, size_t const x0, size_t const y0, size_t x1, size_t y1) {
+  size_t const nx = session->grid_width;
+  x1 = x1 < nx ? x1 : nx;
+  y1 = y1 < session->grid_height ? y1 : session->grid_height;
+  for (size_t y = y0; y < y1; ++y) {
+    for (size_t x = x0; x < x1; ++x) {
+      if (session->tiles_changed[y * nx + x]) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// Lists the tiles to process in raster order.
+// Tiles keep their place in the grid of the whole image, so a region of interest gets the same pixels as a full run.
+// A range of tiles, already checked against the grid, replaces the region of interest.
+// With image->previous_source, only tiles whose input window changed and their eight neighbors run, see
+// write_patch; the others are dropped and the destination is expected to still hold their previous output,
+// so they start out done.
+static struct tile *build_schedule(struct session *const session,
+                                   struct session_image const *const image,
+                                   size_t const roi_x,
+                                   size_t const roi_y,
+                                   size_t const roi_width,
+                                   size_t const roi_height,
+                                   size_t const overlap,
+                                   size_t *const num_tiles) {
+  size_t const tile_size = session->tile_size;
+  size_t const step = tile_size - overlap;
+  size_t x0 = 0, x1 = 0, y0 = 0, y1 = 0;
+  if (image->tile_columns) {
+    x0 = image->tile_x;
+    x1 = image->tile_x + image->tile_columns;
+    y0 = image->tile_y;
+    y1 = image->tile_y + image->tile_rows;
+  } else {
+    tile_span(roi_x, roi_width, image->width, tile_size, step, &x0, &x1);
+    tile_span(roi_y, roi_height, image->height, tile_size, step, &y0, &y1);
+  }
+  size_t const nx = x1 - x0;
+  size_t const ny = y1 - y0;
+  if (nx * ny > session->tiles_capacity) {
+    struct tile *const tiles = realloc(session->tiles, nx * ny * sizeof(struct tile));
+    if (tiles == NULL) {
+      return NULL;
+    }
+    session->tiles = tiles;
+    uint8_t *const done = realloc(session->tiles_done, nx * ny);
+    if (done == NULL) {
+      return NULL;
+    }
+    session->tiles_done = done;
+    uint8_t *const changed = realloc(session->tiles_changed, nx * ny);
+    if (changed == NULL) {
+      return NULL;
+    }
+    session->tiles_changed = changed;
+    session->tiles_capacity = nx * ny;
+  }
+  session->grid_width = nx;
+  session->grid_height = ny;
+  struct tile *const tiles = session->tiles;
+  bool const patch = image->previous_source != NULL;
+  for (size_t iy = 0; patch && iy < ny; ++iy) {
+    for (size_t ix = 0; ix < nx; ++ix) {
+      session->tiles_changed[iy * nx + ix] = !image_region_equal(
+          image->previous_source, image->source, image->width, image->height, (x0 + ix) * step, (y0 + iy) * step, tile_size);
+    }
+  }
+  size_t n = 0;
+  for (size_t iy = 0; iy < ny; ++iy) {
+    for (size_t ix = 0; ix < nx; ++ix) {
+      size_t const cell = iy * nx + ix;
+      struct tile const t = {
+          .x = (x0 + ix) * step,
+          .y = (y0 + iy) * step,
+          .cell = cell,
+          .skip = patch && !any_changed(session, ix == 0 ? 0 : ix - 1, iy == 0 ? 0 : iy - 1, ix + 2, iy + 2),
+      };
+      session->tiles_done[cell] = t.skip;
+      if (t.skip) {
+        ++session->stats.tiles_unchanged;
+        continue;
+      }
+      tiles[n++] = t;
+    }
+  }
+  *num_tiles = n;
+  return tiles;
+}
+
+// A tile blends into the neighbors that are already in the destination, written earlier in this run, and
+// overwrites the rest. Leading and trailing ramps are complements, so any write order gives the same seams up to
+// the rounding of each 8-bit blend.
+static unsigned tile_blend_edges(struct session const *const session, size_t const cell) {
+  size_t const nx = session->grid_width, ny = session->grid_height;
+  size_t const ix = cell % nx, iy = cell / nx;
+  uint8_t const *const done = session->tiles_done;
+  unsigned edges = 0;
+  if (ix > 0 && done[cell - 1]) {
+    edges |= image_blend_left;
+  }
+  if (iy > 0 && done[cell - nx]) {
+    edges |= image_blend_top;
+  }
+  if (ix + 1 < nx && done[cell + 1]) {
+    edges |= image_blend_right;
+  }
+  if (iy + 1 < ny && done[cell + nx]) {
+    edges |= image_blend_bottom;
+  }
+  return edges;
+}
+
+// Writes a rerun tile of a previous_source run. The destination is split into step x step squares at the tile
+// origins; the square at column i, row j is covered only by tiles i - 1 and i of rows j - 1 and j. A square next
+// to a changed tile therefore only holds output of tiles that rerun, and writing each of them there in raster
+// order with the edges of a whole run gives exactly what a whole run writes, blend rounding included. The other
+// squares are left alone, so the previous output of the unchanged tiles around them is kept as is.
+static void write_patch(struct session const *const session,
+                        size_t const cell,
+                        uint8_t const *const tile,
+                        size_t const tile_out,
+                        uint8_t *const destination,
+                        size_t const dw,
+                        size_t const dh,
+                        ptrdiff_t const x,
+                        ptrdiff_t const y,
+                        size_t const overlap_out) {
+  size_t const nx = session->grid_width;
+  size_t const ix = cell % nx, iy = cell / nx;
+  size_t const step = tile_out - overlap_out;
+  unsigned const edges = (ix > 0 ? image_blend_left : 0u) | (iy > 0 ? image_blend_top : 0u);
+  for (size_t b = 0; b < 2; ++b) {
+    for (size_t a = 0; a < 2; ++a) {
+      size_t const sx = ix + a, sy = iy + b;
+      if (!any_changed(session, sx == 0 ? 0 : sx - 1, sy == 0 ? 0 : sy - 1, sx + 1, sy + 1)) {
+        continue;
+      }
+      rgba_to_hwc_rect(
+          tile, tile_out, destination, dw, dh, x, y, overlap_out, edges, a * step, b * step, a ? tile_out : step, b ? tile_out : step);
+    }
+  }
+}
+
+// Lower is sooner: tiles that intersect the viewport come first, then by distance of their center from its center.
+static uint64_t tile_priority(struct tile const *const t, struct viewport const *const v, size_t const tile_size) {
+  size_t const cx = t->x + tile_size / 2, cy = t->y + tile_size / 2;
+  size_t const vx = v->x + v->width / 2, vy = v->y + v->height / 2;
+  uint64_t const dx = cx > vx ? cx - vx : vx - cx;
+  uint64_t const dy = cy > vy ? cy - vy : vy - cy;
+  bool const visible = t->x < v->x + v->width && t->x + tile_size > v->x && t->y < v->y + v->height && t->y + tile_size > v->y;
+  return (visible ? 0 : UINT64_C(1) << 63) | ((dx * dx + dy * dy) >> 1);
+}
+
+// Moves the tile that should run next to tiles[next]. The viewport is read again for every tile,
+// so a host that scrolls during inference gets the newly visible tiles next.
+static void pick_next_tile(struct session *const session,
+                           struct tile *const tiles,
+                           size_t const next,
+                           size_t const num_tiles,
+                           struct viewport const *const region) {
+  mtx_lock(&session->mtx);
+  struct viewport v = session->viewport;
+  mtx_unlock(&session->mtx);
+  if (v.width == 0 || v.height == 0) {
+    v = *region;
+  }
+  size_t best = next;
+  uint64_t best_priority = tile_priority(&tiles[next], &v, session->tile_size);
+  for (size_t i = next + 1; i < num_tiles; ++i) {
+    uint64_t const p = tile_priority(&tiles[i], &v, session->tile_size);
+    if (p < best_priority) {
+      best = i;
+      best_priority = p;
+    }
+  }
+  struct tile const tmp = tiles[next];
+  tiles[next] = tiles[best];
+  tiles[best] = tmp;
+}
+
+static void release_tensors(struct session *const session) {
+  for (size_t i = 0; i < 2; ++i) {
+    if (session->input_tensors[i] != NULL) {
+      g_ort->ReleaseValue(session->input_tensors[i]);
+      session->input_tensors[i] = NULL;
+    }
+    if (session->output_tensors[i] != NULL) {
+      g_ort->ReleaseValue(session->output_tensors[i]);
+      session->output_tensors[i] = NULL;
+    }
+    OrtValue **const tensors[] = {
+        &session->input_rgb_tensors[i],
+        &session->input_alpha_tensors[i],
+        &session->output_rgb_tensors[i],
+        &session->output_alpha_tensors[i],
+    };
+    FLOAT_TYPE **const data[] = {
+        &session->input_rgb_tensors_data[i],
+        &session->input_alpha_tensors_data[i],
+        &session->output_rgb_tensors_data[i],
+        &session->output_alpha_tensors_data[i],
+    };
+    for (size_t j = 0; j < sizeof(tensors) / sizeof(tensors[0]); ++j) {
+      if (*tensors[j] != NULL) {
+        g_ort->ReleaseValue(*tensors[j]);
+        *tensors[j] = NULL;
+        *data[j] = NULL;
+      }
+    }
+  }
+  arena_reset(&session->arena);
+  session->scale = 0;
+}
+
+// Tensors depend on the scale and tuning of the loaded models, so they are (re)created here.
+// All tensors share the session arena, which only grows, so a model reload at the same or a smaller scale
+// reuses its memory. The RGB and alpha tensors of a buffer are adjacent.
+// An RGBA model runs on four-channel views of them, which take two thirds of that memory.
+static bool prepare_tensors(struct session *const session,
+                            size_t const scale,
+                            size_t const tile_size,
+                            size_t const batch_size,
+                            size_t const channels) {
+  if (session->scale != scale || session->tile_size != tile_size || session->batch_size != batch_size ||
+      session->channels != channels) {
+    release_tensors(session);
+    size_t const input_bytes = arena_aligned_size(tensor_bytes(batch_size, 3, tile_size, tile_size));
+    size_t const output_bytes = arena_aligned_size(tensor_bytes(batch_size, 3, tile_size * scale, tile_size * scale));
+    if (!arena_reserve(&session->arena, (input_bytes + output_bytes) * 2 * 2)) {
+      return false;
+    }
+    struct arena *const arena = &session->arena;
+    OrtMemoryInfo const *const mi = session->memory_info;
+    for (size_t i = 0; i < 2; ++i) {
+      session->input_rgb_tensors[i] =
+          create_tensor(&session->input_rgb_tensors_data[i], arena, mi, batch_size, 3, tile_size, tile_size);
+      session->input_alpha_tensors[i] =
+          create_tensor(&session->input_alpha_tensors_data[i], arena, mi, batch_size, 3, tile_size, tile_size);
+    }
+    for (size_t i = 0; i < 2; ++i) {
+      session->output_rgb_tensors[i] =
+          create_tensor(&session->output_rgb_tensors_data[i], arena, mi, batch_size, 3, tile_size * scale, tile_size * scale);
+      session->output_alpha_tensors[i] =
+          create_tensor(&session->output_alpha_tensors_data[i], arena, mi, batch_size, 3, tile_size * scale, tile_size * scale);
+    }
+    for (size_t i = 0; i < 2; ++i) {
+      if (session->input_rgb_tensors[i] == NULL || session->input_alpha_tensors[i] == NULL ||
+          session->output_rgb_tensors[i] == NULL || session->output_alpha_tensors[i] == NULL) {
+        release_tensors(session);
+        return false;
+      }
+    }
+    // the Alpha tensors follow the RGB ones without padding, tile sizes are multiples of 8
+    size_t const input_elements = tensor_bytes(batch_size, 3, tile_size, tile_size) / sizeof(FLOAT_TYPE);
+    size_t const output_elements = tensor_bytes(batch_size, 3, tile_size * scale, tile_size * scale) / sizeof(FLOAT_TYPE);
+    for (size_t i = 0; i < 2; ++i) {
+      if (session->input_alpha_tensors_data[i] == session->input_rgb_tensors_data[i] + input_elements &&
+          session->output_alpha_tensors_data[i] == session->output_rgb_tensors_data[i] + output_elements) {
+        size_t const n = channels == 4 ? batch_size : batch_size * 2;
+        session->input_tensors[i] = wrap_tensor(session->input_rgb_tensors_data[i], mi, n, channels, tile_size, tile_size);
+        session->output_tensors[i] =
+            wrap_tensor(session->output_rgb_tensors_data[i], mi, n, channels, tile_size * scale, tile_size * scale);
+      }
+      // an RGBA model has no other way to run
+      if (channels == 4 && (session->input_tensors[i] == NULL || session->output_tensors[i] == NULL)) {
+        release_tensors(session);
+        return false;
+      }
+    }
+    session->scale = scale;
+    session->tile_size = tile_size;
+    session->batch_size = batch_size;
+    session->channels = channels;
+  }
+  return true;
+}
+
+// Also sets up the resampler and the tile cache, which depend on the output scale.
+// tile_out is the size of a tile at the output scale, the model output is resampled to it when they differ.
+static bool prepare_outputs(struct session *const session,
+                            size_t const scale,
+                            size_t const tile_size,
+                            size_t const batch_size,
+                            size_t const channels,
+                            size_t const tile_out) {
+  if (!prepare_tensors(session, scale, tile_size, batch_size, channels)) {
+    return false;
+  }
+  if (tile_out == tile_size * scale) {
+    image_resample_free(&session->resample);
+  } else if (session->resample.src_size != tile_size * scale || session->resample.dst_size != tile_out) {
+    image_resample_free(&session->resample);
+    if (!image_resample_init(&session->resample, tile_size * scale, tile_out)) {
+      return false;
+    }
+  }
+  size_t const tile_bytes = tile_out * tile_out * 4;
+  // the minimum capacity below depends on the batch size
+  if (session->cache != NULL && (tile_cache_get_tile_bytes(session->cache) != tile_bytes || session->cache_batch_size != batch_size)) {
+    tile_cache_destroy(session->cache);
+    session->cache = NULL;
+  }
+  if (session->cache == NULL && session->cache_capacity) {
+    // A hit is looked up when its batch is scheduled but copied two batches later,
+    // so the cache must be able to absorb that many insertions before the entry can be evicted.
+    size_t const min_capacity = batch_size * 4;
+    size_t const capacity = session->cache_capacity < min_capacity ? min_capacity : session->cache_capacity;
+    session->cache = tile_cache_create(capacity, tile_bytes, session->cache_directory);
+    if (session->cache == NULL) {
+      return false;
+    }
+    session->cache_batch_size = batch_size;
+  }
+  return true;
+}
+
+// Returns why inference should stop now, if it should.
+static enum session_stop check_stop(struct session *const session, struct session_image const *const image) {
+  if (atomic_load_explicit(&session->cancel_requested, memory_order_relaxed) ||
+      (image->cancel && atomic_load_explicit(image->cancel, memory_order_relaxed))) {
+    return session_stop_cancelled;
+  }
+  if (image->deadline.tv_sec || image->deadline.tv_nsec) {
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    if (now.tv_sec > image->deadline.tv_sec || (now.tv_sec == image->deadline.tv_sec && now.tv_nsec >= image->deadline.tv_nsec)) {
+      return session_stop_deadline;
+    }
+  }
+  return session_stop_none;
+}
+
+// Waits until running model runs have called back. The cancel flag and the deadline are polled meanwhile,
+// and in-flight runs are terminated through the run options as soon as either trips.
+static void wait_for_runs(struct session *const session,
+                          struct async_context *const ctx,
+                          size_t const running,
+                          struct session_image const *const image) {
+  enum { poll_interval_ns = 10 * 1000 * 1000 };
+  bool terminated = false;
+  mtx_lock(&session->mtx);
+  while (ctx->n < running) {
+    if (!terminated) {
+      if (atomic_load(&session->progress.stop) == session_stop_none) {
+        atomic_store(&session->progress.stop, (int)check_stop(session, image));
+      }
+      if (atomic_load(&session->progress.stop) != session_stop_none) {
+        OrtStatus *const st = g_ort->RunOptionsSetTerminate(session->run_options);
+        if (st != NULL) {
+          g_ort->ReleaseStatus(st);
+        }
+        terminated = true;
+      }
+    }
+    struct timespec t;
+    timespec_get(&t, TIME_UTC);
+    t.tv_nsec += poll_interval_ns;
+    if (t.tv_nsec >= 1000 * 1000 * 1000) {
+      t.tv_nsec -= 1000 * 1000 * 1000;
+      ++t.tv_sec;
+    }
+    cnd_timedwait(&session->cnd, &session->mtx, &t);
+  }
+  mtx_unlock(&session->mtx);
+}
+
+// The output scale as a fraction of the source size.
+static void output_ratio(struct session const *const session, size_t *const numerator, size_t *const denominator) {
+  if (session->output_numerator == 0) {
+    *numerator = session->rgb_io.scale;
+    *denominator = 1;
+    return;
+  }
+  *numerator = session->output_numerator;
+  *denominator = session->output_denominator;
+}
+
+// Both models must be loaded for the same scale and tuning to run on the same tiles.
+static bool check_models(struct session *const session) {
+  if (session->rgb_session == NULL || session->alpha_session == NULL) {
+    session->last_error[sr_append(session->last_error, SR_TSTR("model is not loaded"))] = SR_TSTR('\0');
+    return false;
+  }
+  if (session->alpha_io.scale != session->rgb_io.scale) {
+    session->last_error[sr_append(session->last_error, SR_TSTR("RGB and Alpha models must have the same scale"))] = SR_TSTR('\0');
+    return false;
+  }
+  if (session->alpha_io.channels != session->rgb_io.channels) {
+    session->last_error[sr_append(session->last_error, SR_TSTR("an RGBA model must be loaded for both RGB and Alpha"))] =
+        SR_TSTR('\0');
+    return false;
+  }
+  if (session->alpha_io.tile_size != session->rgb_io.tile_size || session->alpha_io.batch_size != session->rgb_io.batch_size) {
+    session->last_error[sr_append(session->last_error, SR_TSTR("RGB and Alpha models must be loaded with the same tuning"))] =
+        SR_TSTR('\0');
+    return false;
+  }
+  return true;
+}
+
+static uint64_t elapsed_us(struct timespec const *const start) {
+  struct timespec end;
+  timespec_get(&end, TIME_UTC);
+  return (uint64_t)(end.tv_sec - start->tv_sec) * 1000000 + (uint64_t)((end.tv_nsec - start->tv_nsec) / 1000);
+}
+
+static void wait_for_count(struct session *const session, struct async_context *const ctx, size_t const running) {
+  mtx_lock(&session->mtx);
+  while (ctx->n < running) {
+    cnd_wait(&session->cnd, &session->mtx);
+  }
+  mtx_unlock(&session->mtx);
+}
+
+// Runs both models on blank tiles, alternating between the two tensor sets so that all of their pages are touched.
+// Besides reading the models it only touches the tensors, cold and warm_up, so it can run while the caller prepares
+// its image.
+static int warm_up_main(void *const userdata) {
+  struct session *const session = userdata;
+  struct warm_up *const w = &session->warm_up;
+  size_t const scale = session->rgb_io.scale, tile_size = session->rgb_io.tile_size, batch_size = session->rgb_io.batch_size;
+  if (!prepare_tensors(session, scale, tile_size, batch_size, session->rgb_io.channels)) {
+    w->status = g_ort->CreateStatus(ORT_FAIL, "failed to allocate tensors");
+    return 0;
+  }
+  for (size_t i = 0; i < 2; ++i) {
+    memset(session->input_rgb_tensors_data[i], 0, tensor_bytes(batch_size, 3, tile_size, tile_size));
+    memset(session->input_alpha_tensors_data[i], 0, tensor_bytes(batch_size, 3, tile_size, tile_size));
+  }
+  {
+    OrtStatus *const unset = g_ort->RunOptionsUnsetTerminate(session->run_options);
+    if (unset != NULL) {
+      g_ort->ReleaseStatus(unset);
+    }
+  }
+  struct async_context ctx = {session, 0, NULL};
+  for (size_t i = 0; i < w->runs; ++i) {
+    size_t const set = i % 2;
+    struct timespec start;
+    timespec_get(&start, TIME_UTC);
+    ctx.n = 0;
+    OrtStatus *st = NULL;
+    size_t running = 0;
+    if (session->rgb_session == session->alpha_session && session->input_tensors[set] && session->output_tensors[set]) {
+      st = g_ort->RunAsync(session->rgb_session,
+                           session->run_options,
+                           (const char *const[]){session->rgb_io.input_name},
+                           (OrtValue const *const[]){session->input_tensors[set]},
+                           1,
+                           (const char *const[]){session->rgb_io.output_name},
+                           1,
+                           (OrtValue *[]){session->output_tensors[set]},
+                           async_callback,
+                           &ctx);
+      if (st == NULL) {
+        ++running;
+      }
+    } else {
+      st = g_ort->RunAsync(session->rgb_session,
+                           session->run_options,
+                           (const char *const[]){session->rgb_io.input_name},
+                           (OrtValue const *const[]){session->input_rgb_tensors[set]},
+                           1,
+                           (const char *const[]){session->rgb_io.output_name},
+                           1,
+                           (OrtValue *[]){session->output_rgb_tensors[set]},
+                           async_callback,
+                           &ctx);
+      if (st == NULL) {
+        ++running;
+        st = g_ort->RunAsync(session->alpha_session,
+                             session->run_options,
+                             (const char *const[]){session->alpha_io.input_name},
+                             (OrtValue const *const[]){session->input_alpha_tensors[set]},
+                             1,
+                             (const char *const[]){session->alpha_io.output_name},
+                             1,
+                             (OrtValue *[]){session->output_alpha_tensors[set]},
+                             async_callback,
+                             &ctx);
+        if (st == NULL) {
+          ++running;
+        }
+      }
+    }
+    wait_for_count(session, &ctx, running);
+    if (st != NULL || ctx.status != NULL) {
+      if (st == NULL) {
+        st = ctx.status;
+      } else if (ctx.status != NULL) {
+        g_ort->ReleaseStatus(ctx.status);
+      }
+      w->status = st;
+      return 0;
+    }
+    uint64_t const us = elapsed_us(&start);
+    if (session->cold) {
+      w->cold_us = us;
+      session->cold = false;
+    } else if (w->warm_us == 0 || us < w->warm_us) {
+      w->warm_us = us;
+    }
+  }
+  return 0;
+}
+
+// Waits for a warm-up started in the background and publishes its latencies.
+// Returns false if the warm-up failed, with last_error set when report is true.
+static bool finish_warm_up(struct session *const session, bool const report) {
+  struct warm_up *const w = &session->warm_up;
+  if (session->warm_up_running) {
+    thrd_join(session->warm_up_thread, NULL);
+    session->warm_up_running = false;
+  }
+  if (w->cold_us) {
+    session->stats.cold_run_us = w->cold_us;
+  }
+  if (w->warm_us) {
+    session->stats.warm_run_us = w->warm_us;
+  }
+  OrtStatus *const st = w->status;
+  *w = (struct warm_up){0};
+  if (st != NULL) {
+    if (report) {
+      ov_snprintf(
+          session->last_error, 256, NULL, SR_TSTR("failed to warm up: %hs(%d)"), g_ort->GetErrorMessage(st), g_ort->GetErrorCode(st));
+    }
+    g_ort->ReleaseStatus(st);
+    return false;
+  }
+  return true;
+}
+
+bool session_warm_up(struct session *const session, size_t const runs, bool const background) {
+  if (session == NULL) {
+    return false;
+  }
+  finish_load(session);
+  if (!finish_warm_up(session, true) || !check_models(session)) {
+    return false;
+  }
+  if (runs == 0) {
+    return true;
+  }
+  session->warm_up.runs = runs;
+  if (background && thrd_create(&session->warm_up_thread, warm_up_main, session) == thrd_success) {
+    session->warm_up_running = true;
+    return true;
+  }
+  warm_up_main(session);
+  return finish_warm_up(session, true);
+}
+
 bool session_inference(struct session *const session, struct session_image *const image) {
   if (session == NULL) {
     session->last_error[sr_append(session->last_error, SR_TSTR("session is NULL"))] = SR_TSTR('\0');
     return false;
   }
-  if (session->rgb_session == NULL || session->alpha_session == NULL) {
-    session->last_error[sr_append(session->last_error, SR_TSTR("model is not loaded"))] = SR_TSTR('\0');
+  // a warm-up that failed in the background is not an error here, the runs below report it if it persists
+  finish_load(session);
+  finish_warm_up(session, false);
+  if (!check_models(session)) {
     return false;
   }
 
   OrtSession *const session_rgb = session->rgb_session;
   OrtSession *const session_alpha = session->alpha_session;
 
+  size_t const scale = session->rgb_io.scale;
+  size_t num = 0, den = 0;
+  output_ratio(session, &num, &den);
+  if (num > scale * den) {
+    session->last_error[sr_append(session->last_error, SR_TSTR("output scale exceeds the scale of the model"))] = SR_TSTR('\0');
+    return false;
+  }
+  size_t const tile_size = session->rgb_io.tile_size;
+  size_t const batch_size = session->rgb_io.batch_size;
+  // den divides tile_overlap, so tile origins, tiles and overlaps all land on whole output pixels
+  size_t const tile_out = tile_size * num / den;
+  size_t const channels = session->rgb_io.channels;
+  if (!prepare_outputs(session, scale, tile_size, batch_size, channels, tile_out)) {
+    session->last_error[sr_append(session->last_error, SR_TSTR("failed to allocate tensors"))] = SR_TSTR('\0');
+    return false;
+  }
+
   uint8_t const *const source = image->source;
   size_t const source_width = image->width;
   size_t const source_height = image->height;
   uint8_t *destination = image->destination;
-  if (source == NULL || source_width == 0 || source_height == 0 || destination == NULL) {
+  bool const has_roi = image->roi_width && image->roi_height;
+  size_t const roi_x = has_roi ? image->roi_x : 0, roi_y = has_roi ? image->roi_y : 0;
+  size_t const roi_width = has_roi ? image->roi_width : source_width, roi_height = has_roi ? image->roi_height : source_height;
+  size_t destination_width = 0, destination_height = 0;
+  // Anything but RGBA8 output skips the RGBA8 tile cache; previous_source and mip compare and reduce RGBA8 and
+  // are not supported with it.
+  bool const wide = image->bits_per_channel == 16;
+  bool const floats = image->destination_format != session_destination_rgba;
+  bool const planar = image->destination_format == session_destination_f32_chw;
+  bool const rgba8 = !wide && !floats;
+  if ((image->bits_per_channel != 0 && image->bits_per_channel != 8 && !wide) ||
+      (!rgba8 && (image->previous_source != NULL || image->mip != NULL))) {
+    session->last_error[sr_append(session->last_error, SR_TSTR("unsupported sample format"))] = SR_TSTR('\0');
+    return false;
+  }
+  // a range of grid tiles stores them packed instead of placing them, see session_image.tile_columns
+  bool const shard = image->tile_columns != 0 || image->tile_rows != 0;
+  if (shard) {
+    struct session_tile_grid grid = {0};
+    if (!rgba8 || has_roi || image->previous_source != NULL || image->mip != NULL || image->lock != NULL ||
+        !session_get_tile_grid(session, image->width, image->height, &grid) || image->tile_columns == 0 || image->tile_rows == 0 ||
+        image->tile_x >= grid.columns || image->tile_columns > grid.columns - image->tile_x || image->tile_y >= grid.rows ||
+        image->tile_rows > grid.rows - image->tile_y) {
+      session->last_error[sr_append(session->last_error, SR_TSTR("invalid tile range"))] = SR_TSTR('\0');
+      return false;
+    }
+  }
+  uint16_t const *const source16 = wide ? (uint16_t const *)(void const *)source : NULL;
+  uint16_t *const destination16 = wide && !floats ? (uint16_t *)(void *)destination : NULL;
+  float *const destination32 = floats ? (float *)(void *)destination : NULL;
+  if (source == NULL || destination == NULL || roi_x >= source_width || roi_y >= source_height ||
+      roi_width > source_width - roi_x || roi_height > source_height - roi_y ||
+      !session_get_output_size(session, roi_width, roi_height, &destination_width, &destination_height)) {
     session->last_error[sr_append(session->last_error, SR_TSTR("invalid parameter"))] = SR_TSTR('\0');
     return false;
   }
+  struct viewport const roi = {roi_x, roi_y, roi_width, roi_height};
+  // output position of the region, tiles are written relative to it
+  ptrdiff_t const origin_x = (ptrdiff_t)(roi_x * num / den), origin_y = (ptrdiff_t)(roi_y * num / den);
+  struct image_resample *const resample = session->resample.dst_size ? &session->resample : NULL;
+
+  atomic_store(&session->cancel_requested, false);
+  atomic_store(&session->progress.tiles_written, 0);
+  atomic_store(&session->progress.tiles_total, 0);
+  atomic_store(&session->progress.stop, (int)session_stop_none);
+  {
+    OrtStatus *const unset = g_ort->RunOptionsUnsetTerminate(session->run_options);
+    if (unset != NULL) {
+      g_ort->ReleaseStatus(unset);
+    }
+  }
 
   OrtStatus *st = NULL;
   SR_CHAR_T const *msg = NULL;
@@ -377,85 +1552,242 @@ bool session_inference(struct session *const session, struct session_image *cons
   FLOAT_TYPE *output_rgb_tensors_data[2] = {session->output_rgb_tensors_data[0], session->output_rgb_tensors_data[1]};
   FLOAT_TYPE *input_alpha_tensors_data[2] = {session->input_alpha_tensors_data[0], session->input_alpha_tensors_data[1]};
   FLOAT_TYPE *output_alpha_tensors_data[2] = {session->output_alpha_tensors_data[0], session->output_alpha_tensors_data[1]};
+  OrtValue *input_tensors[2] = {session->input_tensors[0], session->input_tensors[1]};
+  OrtValue *output_tensors[2] = {session->output_tensors[0], session->output_tensors[1]};
+  bool const shared = session_rgb == session_alpha && input_tensors[0] && input_tensors[1] && output_tensors[0] && output_tensors[1];
 
   struct async_context ctx = {session, 0, NULL};
+  struct tile_cache *const cache = rgba8 ? session->cache : NULL;
 
-  size_t const overlap = 8;
-  size_t const num_tiles_x = (source_width + tile_size - overlap - 1) / (tile_size - overlap);
-  size_t const num_tiles_y = (source_height + tile_size - overlap - 1) / (tile_size - overlap);
-  size_t const num_tiles = num_tiles_x * num_tiles_y;
+  size_t const overlap = tile_overlap;
+  size_t const overlap_out = overlap * num / den;
+  size_t num_tiles = 0;
+  struct tile *const tiles = build_schedule(session, image, roi_x, roi_y, roi_width, roi_height, overlap, &num_tiles);
+  if (tiles == NULL) {
+    session->last_error[sr_append(session->last_error, SR_TSTR("failed to allocate tile schedule"))] = SR_TSTR('\0');
+    return false;
+  }
+  bool const patch = image->previous_source != NULL;
+  if (patch && !cache && session->patch_tile_bytes < tile_out * tile_out * 4) {
+    uint8_t *const p = realloc(session->patch_tile, tile_out * tile_out * 4);
+    if (p == NULL) {
+      session->last_error[sr_append(session->last_error, SR_TSTR("failed to allocate tile buffer"))] = SR_TSTR('\0');
+      return false;
+    }
+    session->patch_tile = p;
+    session->patch_tile_bytes = tile_out * tile_out * 4;
+  }
 
-  struct position target[batch_size * 2] = {0};
+  struct position target[max_batch_size * 2] = {0};
+  struct timespec first_batch_start = {0};
+  bool first_batch_running = false, first_batch_launched = false;
   size_t completed = 0, processed = 0, processing = 0;
-  size_t y = 0, x = 0;
+  size_t next = 0;
+  atomic_store(&session->progress.tiles_total, num_tiles);
   while (completed < num_tiles) {
+    atomic_store(&session->progress.stop, (int)check_stop(session, image));
+    if (atomic_load(&session->progress.stop) != session_stop_none) {
+      goto cleanup;
+    }
     if (processed > 0) {
       size_t const n = processed - completed;
       for (size_t i = 0; i < n; ++i) {
-        if (!image->lock(target[i].x * 4, target[i].y * 4, tile_size * 4, tile_size * 4, completed + i, num_tiles, image->userdata)) {
+        struct position const *const t = &target[i];
+        ptrdiff_t const x = (ptrdiff_t)(t->x * num / den) - origin_x, y = (ptrdiff_t)(t->y * num / den) - origin_y;
+        size_t const lx = x < 0 ? 0 : (size_t)x, ly = y < 0 ? 0 : (size_t)y;
+        size_t const lw = (size_t)((ptrdiff_t)tile_out + x - (ptrdiff_t)lx), lh = (size_t)((ptrdiff_t)tile_out + y - (ptrdiff_t)ly);
+        unsigned const edges = tile_blend_edges(session, t->cell);
+        size_t const plane = tile_size * scale * tile_size * scale;
+        FLOAT_TYPE *const pixels = output_rgb_tensors_data[0] + t->slot * channels * plane;
+        // the alpha plane of an RGBA model follows its colour planes
+        FLOAT_TYPE *const pixels_alpha = channels == 4 ? pixels + 3 * plane : output_alpha_tensors_data[0] + t->slot * 3 * plane;
+        if (image->premultiply_alpha && !t->cached) {
+          chw_unpremultiply(pixels, pixels_alpha, plane, !floats);
+        }
+        uint8_t *tile = NULL;
+        if (image->lock && !image->lock(lx, ly, lw, lh, completed + i, num_tiles, image->userdata)) {
           st = g_ort->CreateStatus(ORT_OK, "aborted by user");
           msg = SR_TSTR("interrupted");
           goto cleanup;
         }
-        chw_to_hwc(output_rgb_tensors_data[0] + i * 3 * tile_size * 4 * tile_size * 4,
-                   output_alpha_tensors_data[0] + i * 3 * tile_size * 4 * tile_size * 4,
-                   tile_size * 4,
-                   destination,
-                   source_width * 4,
-                   source_height * 4,
-                   target[i].x * 4,
-                   target[i].y * 4,
-                   overlap * 4);
-        image->unlock(image->userdata);
+        if (patch) {
+          uint8_t const *out = t->cached;
+          if (out == NULL) {
+            uint8_t *const raw = cache ? (tile = tile_cache_insert(cache, &t->key)) : session->patch_tile;
+            chw_to_rgba(pixels, pixels_alpha, tile_size * scale, raw, resample);
+            out = raw;
+          }
+          write_patch(session, t->cell, out, tile_out, destination, destination_width, destination_height, x, y, overlap_out);
+        } else if (shard) {
+          // stored unblended, the merge blends them in the order a whole-image run writes them
+          size_t const tile_bytes = tile_out * tile_out * 4;
+          uint8_t *const out = destination + t->cell * tile_bytes;
+          if (t->cached) {
+            memcpy(out, t->cached, tile_bytes);
+          } else {
+            chw_to_rgba(pixels, pixels_alpha, tile_size * scale, out, resample);
+            if (cache) {
+              tile = tile_cache_insert(cache, &t->key);
+              memcpy(tile, out, tile_bytes);
+            }
+          }
+        } else if (t->cached) {
+          rgba_to_hwc(t->cached, tile_out, destination, destination_width, destination_height, x, y, overlap_out, edges);
+        } else if (cache) {
+          tile = tile_cache_insert(cache, &t->key);
+          chw_to_rgba(pixels, pixels_alpha, tile_size * scale, tile, resample);
+          rgba_to_hwc(tile, tile_out, destination, destination_width, destination_height, x, y, overlap_out, edges);
+        } else if (floats) {
+          chw_to_f32(pixels,
+                     pixels_alpha,
+                     tile_size * scale,
+                     destination32,
+                     planar,
+                     destination_width,
+                     destination_height,
+                     x,
+                     y,
+                     overlap_out,
+                     edges,
+                     resample);
+        } else if (wide) {
+          chw_to_hwc_u16(pixels,
+                         pixels_alpha,
+                         tile_size * scale,
+                         destination16,
+                         destination_width,
+                         destination_height,
+                         x,
+                         y,
+                         overlap_out,
+                         edges,
+                         resample);
+        } else {
+          chw_to_hwc(pixels,
+                     pixels_alpha,
+                     tile_size * scale,
+                     destination,
+                     destination_width,
+                     destination_height,
+                     x,
+                     y,
+                     overlap_out,
+                     edges,
+                     resample);
+        }
+        if (image->mip) {
+          image_mip_update(image->mip, destination, destination_width, destination_height, lx, ly, lw, lh);
+        }
+        session->tiles_done[t->cell] = 1;
+        atomic_fetch_add(&session->progress.tiles_written, 1);
+        if (image->unlock) {
+          image->unlock(image->userdata);
+        }
+        if (tile) {
+          tile_cache_save(cache, &t->key);
+        }
       }
       completed = processed;
     }
 
-    size_t n = 0;
-    while (y < source_height && x < source_width && n < batch_size) {
-      hwc_to_chw(source,
-                 source_width,
-                 source_height,
-                 x,
-                 y,
-                 tile_size,
-                 input_rgb_tensors_data[0] + n * 3 * tile_size * tile_size,
-                 input_alpha_tensors_data[0] + n * 3 * tile_size * tile_size);
-      target[n].x = x;
-      target[n].y = y;
-      ++n;
-      x += tile_size - overlap;
-      if (x >= source_width) {
-        x = 0;
-        y += tile_size - overlap;
+    size_t n = 0, slots = 0;
+    while (next < num_tiles && n < batch_size) {
+      if (image->order == session_order_viewport && !patch) {
+        pick_next_tile(session, tiles, next, num_tiles, &roi);
       }
+      size_t const x = tiles[next].x, y = tiles[next].y;
+      struct position *const t = &target[n];
+      *t = (struct position){.x = x, .y = y, .cell = tiles[next].cell};
+      if (cache) {
+        tile_key(session, source, source_width, source_height, x, y, overlap, tile_out, image->premultiply_alpha, &t->key);
+        t->cached = tile_cache_find(cache, &t->key);
+        if (t->cached) {
+          ++session->stats.cache_hits;
+        } else {
+          ++session->stats.cache_misses;
+        }
+      }
+      if (!t->cached) {
+        t->slot = slots++;
+        size_t const plane = tile_size * tile_size;
+        FLOAT_TYPE *const pixels = input_rgb_tensors_data[0] + t->slot * channels * plane;
+        FLOAT_TYPE *const pixels_alpha = channels == 4 ? pixels + 3 * plane : input_alpha_tensors_data[0] + t->slot * 3 * plane;
+        if (wide && channels == 4) {
+          hwc_u16_to_chw4(source16, source_width, source_height, x, y, tile_size, pixels);
+        } else if (wide) {
+          hwc_u16_to_chw(source16, source_width, source_height, x, y, tile_size, pixels, pixels_alpha);
+        } else if (channels == 4) {
+          hwc_to_chw4(source, source_width, source_height, x, y, tile_size, pixels);
+        } else {
+          hwc_to_chw(source, source_width, source_height, x, y, tile_size, pixels, pixels_alpha);
+        }
+        if (image->premultiply_alpha) {
+          chw_premultiply(pixels, pixels_alpha, plane);
+        }
+      }
+      ++session->stats.tiles;
+      ++n;
+      ++next;
     }
 
     if (processed != processing) {
-      mtx_lock(&session->mtx);
-      while (ctx.n < running) {
-        cnd_wait(&session->cnd, &session->mtx);
-      }
+      wait_for_runs(session, &ctx, running, image);
       ctx.n = 0;
-      mtx_unlock(&session->mtx);
+      if (atomic_load(&session->progress.stop) != session_stop_none) {
+        running = 0; // a terminated run's failure is reported as the stop reason below
+        if (ctx.status != NULL) {
+          g_ort->ReleaseStatus(ctx.status);
+          ctx.status = NULL;
+        }
+        goto cleanup;
+      }
       if (ctx.status != NULL) {
         st = ctx.status;
         ctx.status = NULL;
         msg = SR_TSTR("failed to run session");
         goto cleanup;
       }
+      if (first_batch_running) {
+        session->stats.first_batch_us = elapsed_us(&first_batch_start);
+        if (session->cold) {
+          session->stats.cold_run_us = session->stats.first_batch_us;
+          session->cold = false;
+        }
+        first_batch_running = false;
+      }
     }
     processed = processing;
     processing += n;
     running = 0;
 
-    if (n) {
+    if (slots && !first_batch_launched) {
+      timespec_get(&first_batch_start, TIME_UTC);
+      first_batch_running = true;
+      first_batch_launched = true;
+    }
+    if (slots && shared) {
+      st = g_ort->RunAsync(session_rgb,
+                           session->run_options,
+                           (const char *const[]){session->rgb_io.input_name},
+                           (OrtValue const *const[]){input_tensors[0]},
+                           1,
+                           (const char *const[]){session->rgb_io.output_name},
+                           1,
+                           (OrtValue *[]){output_tensors[0]},
+                           async_callback,
+                           &ctx);
+      if (st != NULL) {
+        msg = SR_TSTR("failed to run session");
+        goto cleanup;
+      }
+      ++running;
+    } else if (slots) {
       st = g_ort->RunAsync(session_rgb,
-                           NULL,
-                           (const char *const[]){"input"},
+                           session->run_options,
+                           (const char *const[]){session->rgb_io.input_name},
                            (OrtValue const *const[]){input_rgb_tensors[0]},
                            1,
-                           (const char *const[]){"output"},
+                           (const char *const[]){session->rgb_io.output_name},
                            1,
                            (OrtValue *[]){output_rgb_tensors[0]},
                            async_callback,
@@ -466,11 +1798,11 @@ bool session_inference(struct session *const session, struct session_image *cons
       }
       ++running;
       st = g_ort->RunAsync(session_alpha,
-                           NULL,
-                           (const char *const[]){"input"},
+                           session->run_options,
+                           (const char *const[]){session->alpha_io.input_name},
                            (OrtValue const *const[]){input_alpha_tensors[0]},
                            1,
-                           (const char *const[]){"output"},
+                           (const char *const[]){session->alpha_io.output_name},
                            1,
                            (OrtValue *[]){output_alpha_tensors[0]},
                            async_callback,
@@ -486,25 +1818,33 @@ bool session_inference(struct session *const session, struct session_image *cons
     swap_tensor_and_data(&output_rgb_tensors[0], &output_rgb_tensors[1], &output_rgb_tensors_data[0], &output_rgb_tensors_data[1]);
     swap_tensor_and_data(&input_alpha_tensors[0], &input_alpha_tensors[1], &input_alpha_tensors_data[0], &input_alpha_tensors_data[1]);
     swap_tensor_and_data(&output_alpha_tensors[0], &output_alpha_tensors[1], &output_alpha_tensors_data[0], &output_alpha_tensors_data[1]);
+    swap_tensor(&input_tensors[0], &input_tensors[1]);
+    swap_tensor(&output_tensors[0], &output_tensors[1]);
     for (size_t i = 0; i < batch_size; ++i) {
       swap_position(&target[i], &target[batch_size + i]);
     }
   }
 cleanup:
   if (running) {
-    mtx_lock(&session->mtx);
-    while (ctx.n < running) {
-      cnd_wait(&session->cnd, &session->mtx);
-    }
-    mtx_unlock(&session->mtx);
+    wait_for_runs(session, &ctx, running, image);
     if (ctx.status != NULL) {
-      if (st == NULL) {
+      if (st == NULL && atomic_load(&session->progress.stop) == session_stop_none) {
         st = ctx.status;
       } else {
         g_ort->ReleaseStatus(ctx.status);
       }
     }
   }
+  if (session->cache) {
+    tile_cache_flush(session->cache);
+  }
+  if (st == NULL && atomic_load(&session->progress.stop) == session_stop_cancelled) {
+    st = g_ort->CreateStatus(ORT_OK, "aborted by user");
+    msg = SR_TSTR("interrupted");
+  } else if (st == NULL && atomic_load(&session->progress.stop) == session_stop_deadline) {
+    st = g_ort->CreateStatus(ORT_FAIL, "deadline exceeded");
+    msg = SR_TSTR("interrupted");
+  }
   if (st != NULL) {
     OrtErrorCode const code = g_ort->GetErrorCode(st);
     ov_snprintf(session->last_error, 256, NULL, SR_TSTR("%ls: %hs(%d)"), msg, g_ort->GetErrorMessage(st), code);
@@ -513,3 +1853,194 @@ cleanup:
   }
   return true;
 }
+
+bool session_set_tile_cache(struct session *const session, size_t const capacity, SR_CHAR_T const *const directory) {
+  if (session == NULL) {
+    return false;
+  }
+  finish_load(session);
+  if (session->cache != NULL) {
+    tile_cache_destroy(session->cache);
+    session->cache = NULL;
+  }
+  if (session->cache_directory != NULL) {
+    free(session->cache_directory);
+    session->cache_directory = NULL;
+  }
+  session->cache_capacity = 0;
+  if (capacity == 0) {
+    return true;
+  }
+  if (directory != NULL) {
+    size_t const len = SR_STRLEN(directory);
+    session->cache_directory = malloc((len + 1) * sizeof(SR_CHAR_T));
+    if (session->cache_directory == NULL) {
+      session->last_error[sr_append(session->last_error, SR_TSTR("failed to create tile cache."))] = SR_TSTR('\0');
+      return false;
+    }
+    memcpy(session->cache_directory, directory, (len + 1) * sizeof(SR_CHAR_T));
+  }
+  // the cache itself is created by the next inference, once the tile size in output pixels is known
+  session->cache_capacity = capacity;
+  return true;
+}
+
+static size_t gcd(size_t a, size_t b) {
+  while (b) {
+    size_t const t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+bool session_set_output_scale(struct session *const session, size_t const numerator, size_t const denominator) {
+  if (session == NULL) {
+    return false;
+  }
+  finish_load(session);
+  if (numerator == 0) {
+    session->output_numerator = 0;
+    session->output_denominator = 0;
+    return true;
+  }
+  if (denominator == 0) {
+    session->last_error[sr_append(session->last_error, SR_TSTR("invalid output scale"))] = SR_TSTR('\0');
+    return false;
+  }
+  size_t const g = gcd(numerator, denominator);
+  if (tile_overlap % (denominator / g) != 0 || numerator / g > max_scale * (denominator / g)) {
+    session->last_error[sr_append(session->last_error, SR_TSTR("output scale must be a multiple of 1/8 up to 16"))] = SR_TSTR('\0');
+    return false;
+  }
+  session->output_numerator = numerator / g;
+  session->output_denominator = denominator / g;
+  return true;
+}
+
+bool session_get_tile_grid(struct session *const session,
+                           size_t const width,
+                           size_t const height,
+                           struct session_tile_grid *const grid) {
+  if (session == NULL || grid == NULL || width == 0 || height == 0) {
+    return false;
+  }
+  finish_load(session);
+  if (session->rgb_session == NULL) {
+    return false;
+  }
+  size_t num = 0, den = 0;
+  output_ratio(session, &num, &den);
+  size_t const tile_size = session->rgb_io.tile_size;
+  size_t const step = tile_size - tile_overlap;
+  // same grid as tile_span over the whole image
+  *grid = (struct session_tile_grid){
+      .columns = (width + step - 1) / step,
+      .rows = (height + step - 1) / step,
+      .tile_size = tile_size * num / den,
+      .step = step * num / den,
+      .overlap = tile_overlap * num / den,
+  };
+  return true;
+}
+
+bool session_get_output_size(
+    struct session *const session, size_t const width, size_t const height, size_t *const output_width, size_t *const output_height) {
+  if (session == NULL || width == 0 || height == 0) {
+    return false;
+  }
+  finish_load(session);
+  if (session->rgb_session == NULL) {
+    return false;
+  }
+  size_t num = 0, den = 0;
+  output_ratio(session, &num, &den);
+  // the largest output is 16 times the source in each direction with 4 bytes per pixel
+  if (width > SIZE_MAX / 4 / max_scale / max_scale / height) {
+    return false;
+  }
+  // rounded down so that edge pixels are never averaged with the zero padding of the last tile
+  size_t const w = width * num / den, h = height * num / den;
+  *output_width = w ? w : 1;
+  *output_height = h ? h : 1;
+  return true;
+}
+
+void session_cancel(struct session *const session) {
+  if (session == NULL) {
+    return;
+  }
+  atomic_store(&session->cancel_requested, true);
+  OrtStatus *const st = g_ort->RunOptionsSetTerminate(session->run_options);
+  if (st != NULL) {
+    g_ort->ReleaseStatus(st);
+  }
+}
+
+void session_get_progress(struct session const *const session, struct session_progress *const progress) {
+  if (session == NULL || progress == NULL) {
+    return;
+  }
+  *progress = (struct session_progress){
+      .tiles_written = atomic_load(&session->progress.tiles_written),
+      .tiles_total = atomic_load(&session->progress.tiles_total),
+      .stop = (enum session_stop)atomic_load(&session->progress.stop),
+  };
+}
+
+void session_set_viewport(struct session *const session, size_t const x, size_t const y, size_t const width, size_t const height) {
+  if (session == NULL) {
+    return;
+  }
+  mtx_lock(&session->mtx);
+  session->viewport = (struct viewport){x, y, width, height};
+  mtx_unlock(&session->mtx);
+}
+
+bool session_set_tuning(struct session *const session, struct session_tuning const *const tuning) {
+  if (session == NULL || tuning == NULL) {
+    return false;
+  }
+  finish_load(session);
+  if (tuning->tile_size % tile_overlap != 0 || tuning->tile_size > 1024 || tuning->batch_size > max_batch_size ||
+      tuning->threads > 1024) {
+    session->last_error[sr_append(session->last_error, SR_TSTR("invalid tuning"))] = SR_TSTR('\0');
+    return false;
+  }
+  if (tuning->tile_size != 0 && tuning->tile_size <= tile_overlap) {
+    session->last_error[sr_append(session->last_error, SR_TSTR("tile size must be larger than the overlap"))] = SR_TSTR('\0');
+    return false;
+  }
+  session->tuning = *tuning;
+  return true;
+}
+
+uint64_t session_get_model_id(struct session *const session) {
+  if (session == NULL) {
+    return 0;
+  }
+  finish_load(session);
+  if (session->rgb_session == NULL) {
+    return 0;
+  }
+  struct hash h;
+  hash_init(&h, session->rgb_model_id);
+  hash_word(&h, session->alpha_model_id);
+  hash_final(&h);
+  return h.v[0] ? h.v[0] : 1;
+}
+
+size_t session_get_scale(struct session *const session) {
+  if (session == NULL) {
+    return 0;
+  }
+  finish_load(session);
+  return session->rgb_session != NULL ? session->rgb_io.scale : 0;
+}
+
+void session_get_stats(struct session const *const session, struct session_stats *const stats) {
+  if (session == NULL || stats == NULL) {
+    return;
+  }
+  *stats = session->stats;
+}
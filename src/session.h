@@ -2,6 +2,9 @@
 
 #include <ovthreads.h>
 
+#include <stdatomic.h>
+#include <time.h>
+
 #include "common.h"
 #include "onnx.h"
 
@@ -24,6 +27,15 @@ struct session_provider {
 
 struct session_options {
   struct session_provider provider;
+  // Model metadata, usually taken from the model manifest.
+  // NULL or zero means "input", "output" and 4x; fp16 must match the tensor type of the build.
+  char const *input_name;
+  char const *output_name;
+  size_t scale;
+  // 0 or 3 for an RGB model. 4 for a model that takes and returns RGBA; it is loaded for both RGB and Alpha
+  // and upscales both in one run per batch.
+  size_t channels;
+  bool fp16;
   union {
     struct file {
       SR_CHAR_T const *const path;
@@ -36,18 +48,115 @@ struct session_options {
   };
 };
 
+struct image_mip;
+
+// Order in which tiles are run and written.
+enum session_order {
+  session_order_raster,   // top-left to bottom-right
+  session_order_viewport, // tiles in the viewport first, then outward from its center, see session_set_viewport
+};
+
+// Sample format of session_image.destination.
+enum session_destination_format {
+  session_destination_rgba,    // interleaved integer samples of bits_per_channel
+  session_destination_f32_hwc, // interleaved float RGBA
+  session_destination_f32_chw, // float planes R, G, B and A of output_width * output_height each
+};
+
 struct session_image {
   size_t width;
   size_t height;
   size_t channels;
   uint8_t *source;      // width * height * channels
-  uint8_t *destination; // (width * 4) * (height * 4) * channels
+  uint8_t *destination; // output_width * output_height * channels, see session_get_output_size
+  // 8 (or 0) or 16. With 16, source and destination hold native-endian uint16_t samples, suitably aligned,
+  // and previous_source and mip must be NULL; the tile cache is not used.
+  size_t bits_per_channel;
+  // Float destinations receive the model output without quantization or clamping, only blended where tiles
+  // overlap, for consumers that feed it to another network. The same restrictions as 16 bits apply.
+  enum session_destination_format destination_format;
+  // Optional region of interest in source pixels, the whole image when roi_width or roi_height is 0.
+  // Only tiles that intersect it are run, and destination holds just the region: the output size of
+  // roi_width x roi_height, placed at the output position of (roi_x, roi_y).
+  size_t roi_x;
+  size_t roi_y;
+  size_t roi_width;
+  size_t roi_height;
+  enum session_order order;
+  // Optional. Runs only the tiles in columns [tile_x, tile_x + tile_columns) and rows [tile_y, tile_y + tile_rows)
+  // of the whole-image grid, see session_get_tile_grid, so that one image can be split across processes.
+  // destination then receives their RGBA8 output unblended, tile after tile in raster order, each
+  // grid.tile_size * grid.tile_size * 4 bytes; shard_merge stitches them. Only for RGBA8 without a region of
+  // interest, previous_source, mip or lock.
+  size_t tile_x;
+  size_t tile_y;
+  size_t tile_columns;
+  size_t tile_rows;
+  // Runs the models on colour premultiplied by alpha and divides the upscaled alpha back out, so that colour
+  // hidden under transparent pixels does not bleed into edges. It replaces a separate edge bleed pass.
+  bool premultiply_alpha;
+  // Optional. The source the destination was last produced from; only tiles whose input differs and their
+  // neighbors are rerun and patched into the destination, which must still hold that previous output for the
+  // same region. The result is then the same as a whole run in raster order, which this run uses whatever order
+  // is set; a destination from such a run, or patched this way, stays identical to one over any number of runs.
+  uint8_t const *previous_source;
+  // Optional cancellation token. It is checked without locking before every batch of tiles and polled while the
+  // models run; once set, in-flight runs are terminated and inference returns true with "interrupted".
+  atomic_bool const *cancel;
+  // Optional deadline in TIME_UTC, zero for none. Past it inference stops the same way but returns false.
+  struct timespec deadline;
+  // Optional. Pyramid of the destination, see image_mip_init; every tile written also refreshes the levels it
+  // covers, so previews can read a small level while inference runs.
+  struct image_mip *mip;
   void *userdata;
+  // Optional. Called around the write of each tile with its rectangle in the destination; returning false aborts.
+  // They run on the inference thread once per tile, so they should only record progress, not wait for a UI.
   bool (*lock)(
       size_t const x, size_t const y, size_t const w, size_t const h, size_t const progress, size_t const total, void *const userdata);
   void (*unlock)(void *const userdata);
 };
 
+// Tile grid of a whole-image run. Sizes are in output pixels.
+struct session_tile_grid {
+  size_t columns;
+  size_t rows;
+  size_t tile_size;
+  size_t step;    // between the origins of neighboring tiles
+  size_t overlap; // blended between neighbors
+};
+
+struct session_stats {
+  size_t tiles;
+  size_t tiles_unchanged; // skipped because previous_source had the same input around them
+  size_t cache_hits;
+  size_t cache_misses;
+  // Latency of one batch through both models in microseconds.
+  uint64_t cold_run_us;    // the first batch after the models were loaded, by session_warm_up or session_inference
+  uint64_t warm_run_us;    // the fastest later batch of session_warm_up, 0 without one
+  uint64_t first_batch_us; // the first batch of the last session_inference, until its output was collected
+};
+
+// Why the last session_inference stopped early.
+enum session_stop {
+  session_stop_none,
+  session_stop_cancelled,
+  session_stop_deadline,
+};
+
+struct session_progress {
+  size_t tiles_written; // tiles of the last session_inference whose output is in the destination
+  size_t tiles_total;   // tiles it scheduled
+  enum session_stop stop;
+};
+
+// Shapes and threading the models are compiled for, 0 keeps the default of each field.
+// The best values depend on the model, the execution provider and the machine, see sr --autotune.
+struct session_tuning {
+  size_t tile_size;  // input tile edge in pixels, a multiple of 8 (default 128)
+  size_t batch_size; // tiles per model run, up to 8 (default 1)
+  size_t threads;    // intra-op threads of the CPU provider (default: one per physical core)
+};
+
 struct session;
 
 struct session *session_create(SR_CHAR_T error_msg[256]);
@@ -55,4 +164,69 @@ void session_destroy(struct session *const session);
 SR_CHAR_T const *session_get_last_error(struct session const *const session);
 bool session_load_rgb_model(struct session *const session, struct session_options const *const opts);
 bool session_load_alpha_model(struct session *const session, struct session_options const *const opts);
+// Loads the models on background threads, both at the same time, and returns at once so that the caller can
+// prepare its image meanwhile. Either may be NULL to keep the loaded model. Nothing is replaced unless both load.
+// The same model with the same options in both is built once, when its batch size is not fixed, and runs the
+// RGB and Alpha tiles of each batch together, which halves its memory and the number of runs.
+// An RGBA model in either takes both slots and the other is ignored.
+// The options and the strings and memory they point to must stay valid until the load completes.
+// done, if not NULL, is called on a loader thread when it completes and must not call into the session;
+// session_wait_models waits for completion, and so does every function that uses the models or the settings
+// that depend on them, including session_get_scale, session_get_model_id, session_get_output_size,
+// session_set_output_scale and session_set_tile_cache; session_cancel, session_get_progress and
+// session_set_viewport do not.
+bool session_load_models_async(struct session *const session,
+                               struct session_options const *const rgb,
+                               struct session_options const *const alpha,
+                               void (*const done)(bool const succeeded, void *const userdata),
+                               void *const userdata);
+// Returns false with the error in session_get_last_error if the last session_load_models_async failed.
+bool session_wait_models(struct session *const session);
 bool session_inference(struct session *const session, struct session_image *const image);
+// Runs batches of blank tiles through both models right after loading, so that session_inference does not pay
+// for kernel selection, allocations and page faults on its first tiles. Two runs touch both tensor sets.
+// With background set it returns at once and whatever uses the models next waits for it to finish, so the caller
+// can decode its image in the meantime; a failure is then only reported if it persists in session_inference.
+bool session_warm_up(struct session *const session, size_t const runs, bool const background);
+// Applies to models loaded afterwards; both models must be loaded with the same tuning before session_inference.
+bool session_set_tuning(struct session *const session, struct session_tuning const *const tuning);
+// Returns a value that changes when the file at path is replaced or modified, from its size and modification time,
+// or 0 if it cannot be read. Tile cache keys include it for models loaded from files.
+uint64_t session_get_file_stamp(SR_CHAR_T const *const path);
+// Returns a value that identifies the loaded models, the same that tile cache keys start from: it changes with
+// the model files or memory and the provider they run on. 0 if no RGB model is loaded.
+uint64_t session_get_model_id(struct session *const session);
+// Returns the upscaling factor of the loaded RGB model, or 0 if none is loaded.
+// It comes from the model's output shape when that is fixed, otherwise from session_options.scale.
+size_t session_get_scale(struct session *const session);
+// Describes the grid of tiles session_inference runs for a width x height source with the loaded models.
+bool session_get_tile_grid(struct session *const session,
+                           size_t const width,
+                           size_t const height,
+                           struct session_tile_grid *const grid);
+// Stops the session_inference running on another thread as soon as possible, terminating model runs in flight.
+// It has no effect on later calls; use session_image.cancel to cancel work that may not have started yet.
+void session_cancel(struct session *const session);
+// Reports how far the last session_inference got, so a caller can keep a partial destination.
+// It may also be called from any thread while session_inference runs.
+void session_get_progress(struct session const *const session, struct session_progress *const progress);
+// Sets the viewport in source pixels for session_order_viewport, an empty one means center-out over the region.
+// It may be called from any thread while session_inference runs, e.g. on scroll; the next tile scheduled follows it.
+void session_set_viewport(struct session *const session, size_t const x, size_t const y, size_t const width, size_t const height);
+// Sets the output size to numerator / denominator times the source, 0 restores the scale of the model.
+// Smaller scales run the model as usual and reduce each tile with an area filter as it is written,
+// so memory for the destination and the tile cache shrinks with the requested scale.
+// The scale must be a multiple of 1/8 and must not exceed the scale of the model at inference time.
+bool session_set_output_scale(struct session *const session, size_t const numerator, size_t const denominator);
+// Returns the destination size for a width x height source at the current output scale.
+// Fails if no model is loaded or the destination would not fit in memory.
+bool session_get_output_size(
+    struct session *const session, size_t const width, size_t const height, size_t *const output_width, size_t *const output_height);
+
+// Enables the content-addressed tile cache. Tiles are keyed by their source pixels including the overlap,
+// the identity of both models, the tile size and the overlap, so a hit can skip inference entirely.
+// capacity is the number of tiles kept in memory (0 disables the cache).
+// If directory is not NULL, tiles are also stored there and survive across processes.
+bool session_set_tile_cache(struct session *const session, size_t const capacity, SR_CHAR_T const *const directory);
+// Returns counters accumulated over all session_inference calls.
+void session_get_stats(struct session const *const session, struct session_stats *const stats);
@@ -0,0 +1,244 @@
+#include "shard.h"
+
+#include "image.h"
+
+#include <ovprintf.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char const g_magic[8] = {'S', 'R', 'S', 'H', 'A', 'R', 'D', '2'};
+
+enum {
+  header_fields = sizeof(struct shard_header) / sizeof(uint64_t),
+  header_bytes = sizeof(g_magic) + header_fields * 8,
+};
+
+static FILE *open_file(SR_CHAR_T const *const path, bool const write) {
+#ifdef _WIN32
+  return _wfopen(path, write ? L"wb" : L"rb");
+#else
+  return fopen(path, write ? "wb" : "rb");
+#endif
+}
+
+static size_t tile_bytes(struct shard_header const *const h) { return (size_t)(h->tile_size * h->tile_size * 4); }
+
+static void encode_header(struct shard_header const *const h, uint8_t buf[header_bytes]) {
+  uint64_t const fields[header_fields] = {
+      h->identity,
+      h->output_width,
+      h->output_height,
+      h->columns,
+      h->rows,
+      h->tile_size,
+      h->step,
+      h->overlap,
+      h->tile_x,
+      h->tile_y,
+      h->tile_columns,
+      h->tile_rows,
+  };
+  memcpy(buf, g_magic, sizeof(g_magic));
+  for (size_t i = 0; i < header_fields; ++i) {
+    for (size_t b = 0; b < 8; ++b) {
+      buf[sizeof(g_magic) + i * 8 + b] = (uint8_t)(fields[i] >> (b * 8));
+    }
+  }
+}
+
+// Tiles start every step pixels; a grid that session_get_tile_grid produced for the image has its last tile end at
+// or past the edge, and start before it, or exactly at it when a reduced output scale rounded the size down.
+static bool covers(uint64_t const size, uint64_t const count, uint64_t const step, uint64_t const tile_size) {
+  uint64_t const last = (count - 1) * step;
+  return last <= size && size <= last + tile_size;
+}
+
+static bool decode_header(uint8_t const buf[header_bytes], struct shard_header *const h) {
+  if (memcmp(buf, g_magic, sizeof(g_magic)) != 0) {
+    return false;
+  }
+  uint64_t fields[header_fields] = {0};
+  for (size_t i = 0; i < header_fields; ++i) {
+    for (size_t b = 0; b < 8; ++b) {
+      fields[i] |= (uint64_t)buf[sizeof(g_magic) + i * 8 + b] << (b * 8);
+    }
+  }
+  *h = (struct shard_header){
+      .identity = fields[0],
+      .output_width = fields[1],
+      .output_height = fields[2],
+      .columns = fields[3],
+      .rows = fields[4],
+      .tile_size = fields[5],
+      .step = fields[6],
+      .overlap = fields[7],
+      .tile_x = fields[8],
+      .tile_y = fields[9],
+      .tile_columns = fields[10],
+      .tile_rows = fields[11],
+  };
+  // sizes a real run can produce, so that the products below cannot overflow
+  if (!h->output_width || !h->output_height || h->output_width > UINT32_MAX || h->output_height > UINT32_MAX || !h->columns ||
+      !h->rows || h->columns > UINT32_MAX || h->rows > UINT32_MAX || !h->tile_size || h->tile_size > 16384 || !h->step ||
+      h->step > h->tile_size || h->overlap >= h->tile_size || h->tile_x > h->columns || h->tile_columns > h->columns - h->tile_x ||
+      h->tile_y > h->rows || h->tile_rows > h->rows - h->tile_y) {
+    return false;
+  }
+  // the merged RGBA8 image must be addressable, and the grid must be the one of an image of this size
+  if (h->output_width > SIZE_MAX / 4 / h->output_height) {
+    return false;
+  }
+  return covers(h->output_width, h->columns, h->step, h->tile_size) && covers(h->output_height, h->rows, h->step, h->tile_size);
+}
+
+bool shard_write(SR_CHAR_T const *const path,
+                 struct shard_header const *const header,
+                 uint8_t const *const tiles,
+                 SR_CHAR_T error_msg[256]) {
+  if (path == NULL || header == NULL || (tiles == NULL && header->tile_columns * header->tile_rows != 0)) {
+    error_msg[sr_append(error_msg, SR_TSTR("invalid parameter."))] = SR_TSTR('\0');
+    return false;
+  }
+  FILE *const f = open_file(path, true);
+  if (f == NULL) {
+    ov_snprintf(error_msg, 256, NULL, SR_TSTR("failed to create shard: %ls"), path);
+    return false;
+  }
+  uint8_t buf[header_bytes];
+  encode_header(header, buf);
+  size_t const n = (size_t)(header->tile_columns * header->tile_rows);
+  bool ok = fwrite(buf, 1, sizeof(buf), f) == sizeof(buf) && (n == 0 || fwrite(tiles, tile_bytes(header), n, f) == n);
+  if (fclose(f) != 0) {
+    ok = false;
+  }
+  if (!ok) {
+    ov_snprintf(error_msg, 256, NULL, SR_TSTR("failed to write shard: %ls"), path);
+  }
+  return ok;
+}
+
+static bool read_header(FILE *const f, SR_CHAR_T const *const path, struct shard_header *const header, SR_CHAR_T error_msg[256]) {
+  uint8_t buf[header_bytes];
+  if (fread(buf, 1, sizeof(buf), f) != sizeof(buf) || !decode_header(buf, header)) {
+    ov_snprintf(error_msg, 256, NULL, SR_TSTR("not a shard: %ls"), path);
+    return false;
+  }
+  return true;
+}
+
+bool shard_read_header(SR_CHAR_T const *const path, struct shard_header *const header, SR_CHAR_T error_msg[256]) {
+  if (path == NULL || header == NULL) {
+    error_msg[sr_append(error_msg, SR_TSTR("invalid parameter."))] = SR_TSTR('\0');
+    return false;
+  }
+  FILE *const f = open_file(path, false);
+  if (f == NULL) {
+    ov_snprintf(error_msg, 256, NULL, SR_TSTR("failed to open shard: %ls"), path);
+    return false;
+  }
+  bool const ok = read_header(f, path, header, error_msg);
+  fclose(f);
+  return ok;
+}
+
+static bool same_grid(struct shard_header const *const a, struct shard_header const *const b) {
+  return a->identity == b->identity && a->output_width == b->output_width && a->output_height == b->output_height &&
+         a->columns == b->columns && a->rows == b->rows && a->tile_size == b->tile_size && a->step == b->step &&
+         a->overlap == b->overlap;
+}
+
+// Tiles are written in raster order over the whole grid, each blending into its left and top neighbors exactly as
+// session_inference does in session_order_raster. Within a shard that is also the order of its file, so every
+// shard is read front to back once.
+bool shard_merge(SR_CHAR_T const *const *const paths, size_t const num_paths, uint8_t *const destination, SR_CHAR_T error_msg[256]) {
+  if (paths == NULL || num_paths == 0 || destination == NULL) {
+    error_msg[sr_append(error_msg, SR_TSTR("invalid parameter."))] = SR_TSTR('\0');
+    return false;
+  }
+  bool ok = false;
+  FILE **const files = calloc(num_paths, sizeof(FILE *));
+  struct shard_header *const headers = calloc(num_paths, sizeof(struct shard_header));
+  size_t *owner = NULL;
+  uint8_t *tile = NULL;
+  if (files == NULL || headers == NULL) {
+    error_msg[sr_append(error_msg, SR_TSTR("failed to allocate memory."))] = SR_TSTR('\0');
+    goto cleanup;
+  }
+  for (size_t i = 0; i < num_paths; ++i) {
+    files[i] = open_file(paths[i], false);
+    if (files[i] == NULL) {
+      ov_snprintf(error_msg, 256, NULL, SR_TSTR("failed to open shard: %ls"), paths[i]);
+      goto cleanup;
+    }
+    if (!read_header(files[i], paths[i], &headers[i], error_msg)) {
+      goto cleanup;
+    }
+    if (!same_grid(&headers[0], &headers[i])) {
+      ov_snprintf(error_msg, 256, NULL, SR_TSTR("shard belongs to another image or settings: %ls"), paths[i]);
+      goto cleanup;
+    }
+  }
+  struct shard_header const *const g = &headers[0];
+  size_t const columns = (size_t)g->columns, rows = (size_t)g->rows;
+  owner = malloc(columns * rows * sizeof(size_t));
+  tile = malloc(tile_bytes(g));
+  if (owner == NULL || tile == NULL) {
+    error_msg[sr_append(error_msg, SR_TSTR("failed to allocate memory."))] = SR_TSTR('\0');
+    goto cleanup;
+  }
+  for (size_t i = 0; i < columns * rows; ++i) {
+    owner[i] = SIZE_MAX;
+  }
+  for (size_t i = 0; i < num_paths; ++i) {
+    struct shard_header const *const h = &headers[i];
+    for (size_t y = (size_t)h->tile_y; y < (size_t)(h->tile_y + h->tile_rows); ++y) {
+      for (size_t x = (size_t)h->tile_x; x < (size_t)(h->tile_x + h->tile_columns); ++x) {
+        if (owner[y * columns + x] != SIZE_MAX) {
+          ov_snprintf(error_msg, 256, NULL, SR_TSTR("tile %zu,%zu is in more than one shard: %ls"), x, y, paths[i]);
+          goto cleanup;
+        }
+        owner[y * columns + x] = i;
+      }
+    }
+  }
+  size_t const dw = (size_t)g->output_width, dh = (size_t)g->output_height;
+  for (size_t y = 0; y < rows; ++y) {
+    for (size_t x = 0; x < columns; ++x) {
+      size_t const i = owner[y * columns + x];
+      if (i == SIZE_MAX) {
+        ov_snprintf(error_msg, 256, NULL, SR_TSTR("no shard has tile %zu,%zu"), x, y);
+        goto cleanup;
+      }
+      if (fread(tile, 1, tile_bytes(g), files[i]) != tile_bytes(g)) {
+        ov_snprintf(error_msg, 256, NULL, SR_TSTR("shard is truncated: %ls"), paths[i]);
+        goto cleanup;
+      }
+      unsigned const edges = (x > 0 ? image_blend_left : 0u) | (y > 0 ? image_blend_top : 0u);
+      rgba_to_hwc(tile,
+                  (size_t)g->tile_size,
+                  destination,
+                  dw,
+                  dh,
+                  (ptrdiff_t)(x * (size_t)g->step),
+                  (ptrdiff_t)(y * (size_t)g->step),
+                  (size_t)g->overlap,
+                  edges);
+    }
+  }
+  ok = true;
+cleanup:
+  if (files != NULL) {
+    for (size_t i = 0; i < num_paths; ++i) {
+      if (files[i] != NULL) {
+        fclose(files[i]);
+      }
+    }
+    free(files);
+  }
+  free(headers);
+  free(owner);
+  free(tile);
+  return ok;
+}
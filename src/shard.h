@@ -0,0 +1,35 @@
+#pragma once
+
+#include "common.h"
+
+// Splits one image across processes or machines. Each worker runs a rectangular range of the tile grid (see
+// session_image.tile_columns) and writes its tiles to a shard file; shard_merge stitches the shards of a grid with the
+// same seam blending, in the same order, as a single run, so the result is bit-identical to it.
+// A shard file is a header of little-endian 64-bit fields followed by the RGBA8 tiles of its range in raster order.
+
+struct shard_header {
+  // hash of the source image, the models and the options that change the output; shards merge only when it matches
+  uint64_t identity;
+  uint64_t output_width;
+  uint64_t output_height;
+  // the tile grid of the whole image, see session_tile_grid
+  uint64_t columns;
+  uint64_t rows;
+  uint64_t tile_size;
+  uint64_t step;
+  uint64_t overlap;
+  // range of the grid in this shard, empty when there were more workers than rows
+  uint64_t tile_x;
+  uint64_t tile_y;
+  uint64_t tile_columns;
+  uint64_t tile_rows;
+};
+
+bool shard_write(SR_CHAR_T const *const path,
+                 struct shard_header const *const header,
+                 uint8_t const *const tiles,
+                 SR_CHAR_T error_msg[256]);
+bool shard_read_header(SR_CHAR_T const *const path, struct shard_header *const header, SR_CHAR_T error_msg[256]);
+// The shards must share their identity and grid and together cover it exactly once.
+// destination receives output_width * output_height RGBA8 pixels.
+bool shard_merge(SR_CHAR_T const *const *const paths, size_t const num_paths, uint8_t *const destination, SR_CHAR_T error_msg[256]);
@@ -0,0 +1,448 @@
+#include "stream.h"
+
+#include <ovprintf.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <windows.h>
+
+static void set_error(SR_CHAR_T error_msg[256], SR_CHAR_T const *const msg) {
+  ov_snprintf(error_msg, 256, NULL, SR_TSTR("%ls"), msg);
+}
+
+static void set_win32_error(SR_CHAR_T error_msg[256], SR_CHAR_T const *const msg) {
+  SR_CHAR_T errmsg[128];
+  DWORD const code = GetLastError();
+  FormatMessageW(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
+                 NULL,
+                 code,
+                 0,
+                 errmsg,
+                 sizeof(errmsg) / sizeof(errmsg[0]),
+                 NULL);
+  ov_snprintf(error_msg, 256, NULL, SR_TSTR("%ls: %ls(%d)"), msg, errmsg, (int)code);
+}
+
+// Reads up to len bytes, *read is less than len only at the end of the stream.
+static bool read_full(HANDLE const h, void *const buf, size_t const len, size_t *const read) {
+  size_t pos = 0;
+  while (pos < len) {
+    DWORD const chunk = (DWORD)(len - pos < 0x40000000 ? len - pos : 0x40000000);
+    DWORD n = 0;
+    if (!ReadFile(h, (uint8_t *)buf + pos, chunk, &n, NULL)) {
+      if (GetLastError() == ERROR_BROKEN_PIPE) {
+        break; // the writer closed its end of the pipe
+      }
+      return false;
+    }
+    if (n == 0) {
+      break;
+    }
+    pos += n;
+  }
+  *read = pos;
+  return true;
+}
+
+static bool write_full(HANDLE const h, void const *const buf, size_t const len) {
+  size_t pos = 0;
+  while (pos < len) {
+    DWORD const chunk = (DWORD)(len - pos < 0x40000000 ? len - pos : 0x40000000);
+    DWORD n = 0;
+    if (!WriteFile(h, (uint8_t const *)buf + pos, chunk, &n, NULL) || n == 0) {
+      return false;
+    }
+    pos += n;
+  }
+  return true;
+}
+
+// Reads up to len bytes, starting with what is left in the read-ahead buffer.
+// *read is less than len only at the end of the stream.
+static bool read_stream(struct stream *const s, void *const buf, size_t const len, size_t *const read) {
+  size_t const left = s->buffer_len - s->buffer_pos;
+  size_t const buffered = len < left ? len : left;
+  memcpy(buf, s->buffer + s->buffer_pos, buffered);
+  s->buffer_pos += buffered;
+  size_t n = 0;
+  if (buffered < len && !read_full(s->handle, (uint8_t *)buf + buffered, len - buffered, &n)) {
+    return false;
+  }
+  *read = buffered + n;
+  return true;
+}
+
+// Refills the read-ahead buffer with whatever one read returns, so that header lines are not read a byte per call.
+// *eof is set at the end of the stream.
+static bool fill_buffer(struct stream *const s, bool *const eof) {
+  DWORD n = 0;
+  s->buffer_pos = 0;
+  s->buffer_len = 0;
+  if (!ReadFile(s->handle, s->buffer, sizeof(s->buffer), &n, NULL)) {
+    if (GetLastError() != ERROR_BROKEN_PIPE) {
+      return false;
+    }
+    n = 0; // the writer closed its end of the pipe
+  }
+  s->buffer_len = n;
+  *eof = n == 0;
+  return true;
+}
+
+// Reads a header line without its terminating newline. *len is 0 at the end of the stream.
+static bool read_line(struct stream *const s, char *const line, size_t const size, size_t *const len, SR_CHAR_T error_msg[256]) {
+  size_t pos = 0;
+  for (;;) {
+    if (s->buffer_pos == s->buffer_len) {
+      bool eof = false;
+      if (!fill_buffer(s, &eof)) {
+        set_win32_error(error_msg, SR_TSTR("failed to read stream"));
+        return false;
+      }
+      if (eof) {
+        if (pos != 0) {
+          set_error(error_msg, SR_TSTR("unexpected end of stream in y4m header."));
+          return false;
+        }
+        break;
+      }
+    }
+    char const c = s->buffer[s->buffer_pos++];
+    if (c == '\n') {
+      break;
+    }
+    if (pos + 1 >= size) {
+      set_error(error_msg, SR_TSTR("y4m header is too long."));
+      return false;
+    }
+    line[pos++] = c;
+  }
+  line[pos] = '\0';
+  *len = pos;
+  return true;
+}
+
+static size_t plane_bytes(struct stream const *const s) {
+  size_t const luma = s->width * s->height;
+  switch (s->chroma) {
+  case stream_chroma_420:
+    return luma + ((s->width + 1) / 2) * ((s->height + 1) / 2) * 2;
+  case stream_chroma_444:
+    return luma * 3;
+  case stream_chroma_444alpha:
+    return luma * 4;
+  }
+  return 0;
+}
+
+static char const *chroma_name(struct stream const *const s) {
+  if (s->chroma_tag[0] != '\0') {
+    return s->chroma_tag;
+  }
+  enum stream_chroma const chroma = s->chroma;
+  switch (chroma) {
+  case stream_chroma_420:
+    return "420jpeg";
+  case stream_chroma_444:
+    return "444";
+  case stream_chroma_444alpha:
+    return "444alpha";
+  }
+  return "";
+}
+
+static bool parse_chroma(char const *const name, enum stream_chroma *const chroma) {
+  if (strcmp(name, "420jpeg") == 0 || strcmp(name, "420paldv") == 0 || strcmp(name, "420mpeg2") == 0 || strcmp(name, "420") == 0) {
+    *chroma = stream_chroma_420;
+  } else if (strcmp(name, "444") == 0) {
+    *chroma = stream_chroma_444;
+  } else if (strcmp(name, "444alpha") == 0) {
+    *chroma = stream_chroma_444alpha;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+static bool parse_y4m_header(struct stream *const s, char *const line, SR_CHAR_T error_msg[256]) {
+  static char const magic[] = "YUV4MPEG2";
+  if (strncmp(line, magic, sizeof(magic) - 1) != 0 || (line[sizeof(magic) - 1] != ' ' && line[sizeof(magic) - 1] != '\0')) {
+    set_error(error_msg, SR_TSTR("input is not a y4m stream."));
+    return false;
+  }
+  s->chroma = stream_chroma_420;
+  s->params[0] = '\0';
+  size_t params_len = 0;
+  char *next = line + sizeof(magic) - 1;
+  while (*next != '\0') {
+    char *token = next;
+    while (*token == ' ') {
+      ++token;
+    }
+    if (*token == '\0') {
+      break;
+    }
+    next = token;
+    while (*next != ' ' && *next != '\0') {
+      ++next;
+    }
+    if (*next == ' ') {
+      *next++ = '\0';
+    }
+    switch (token[0]) {
+    case 'W':
+      s->width = strtoull(token + 1, NULL, 10);
+      break;
+    case 'H':
+      s->height = strtoull(token + 1, NULL, 10);
+      break;
+    case 'C':
+      if (!parse_chroma(token + 1, &s->chroma) || strlen(token + 1) >= sizeof(s->chroma_tag)) {
+        set_error(error_msg, SR_TSTR("unsupported y4m colour space, only 8-bit 420, 444 and 444alpha are supported."));
+        return false;
+      }
+      strcpy(s->chroma_tag, token + 1);
+      break;
+    default: {
+      size_t const len = strlen(token);
+      if (params_len + len + 2 > sizeof(s->params)) {
+        set_error(error_msg, SR_TSTR("y4m header is too long."));
+        return false;
+      }
+      s->params[params_len++] = ' ';
+      memcpy(s->params + params_len, token, len + 1);
+      params_len += len;
+    } break;
+    }
+  }
+  if (s->width == 0 || s->height == 0 || s->width > SIZE_MAX / 64 / s->height) {
+    set_error(error_msg, SR_TSTR("invalid y4m frame size."));
+    return false;
+  }
+  return true;
+}
+
+static inline uint8_t clamp_u8(int const v) { return (uint8_t)(v < 0 ? 0 : v > 255 ? 255 : v); }
+
+// BT.601 limited range, which is what ffmpeg assumes for untagged y4m.
+static void yuv_to_rgba(struct stream const *const s, uint8_t *const rgba) {
+  size_t const w = s->width, h = s->height;
+  size_t const cw = s->chroma == stream_chroma_420 ? (w + 1) / 2 : w;
+  size_t const ch = s->chroma == stream_chroma_420 ? (h + 1) / 2 : h;
+  uint8_t const *const py = s->planes;
+  uint8_t const *const pu = py + w * h;
+  uint8_t const *const pv = pu + cw * ch;
+  uint8_t const *const pa = s->chroma == stream_chroma_444alpha ? pv + cw * ch : NULL;
+  size_t const shift = s->chroma == stream_chroma_420 ? 1 : 0;
+  for (size_t y = 0; y < h; ++y) {
+    uint8_t *d = rgba + y * w * 4;
+    size_t const cy = (y >> shift) * cw;
+    for (size_t x = 0; x < w; ++x, d += 4) {
+      int const c = 298 * ((int)py[y * w + x] - 16);
+      int const u = (int)pu[cy + (x >> shift)] - 128;
+      int const v = (int)pv[cy + (x >> shift)] - 128;
+      d[0] = clamp_u8((c + 409 * v + 128) >> 8);
+      d[1] = clamp_u8((c - 100 * u - 208 * v + 128) >> 8);
+      d[2] = clamp_u8((c + 516 * u + 128) >> 8);
+      d[3] = pa ? pa[y * w + x] : 255;
+    }
+  }
+}
+
+static void rgba_to_yuv(struct stream const *const s, uint8_t const *const rgba) {
+  size_t const w = s->width, h = s->height;
+  uint8_t *const py = s->planes;
+  for (size_t i = 0; i < w * h; ++i) {
+    uint8_t const *const p = rgba + i * 4;
+    py[i] = (uint8_t)(((66 * p[0] + 129 * p[1] + 25 * p[2] + 128) >> 8) + 16);
+  }
+  if (s->chroma == stream_chroma_420) {
+    size_t const cw = (w + 1) / 2, ch = (h + 1) / 2;
+    uint8_t *const pu = py + w * h;
+    uint8_t *const pv = pu + cw * ch;
+    for (size_t cy = 0; cy < ch; ++cy) {
+      for (size_t cx = 0; cx < cw; ++cx) {
+        int r = 0, g = 0, b = 0, n = 0;
+        for (size_t y = cy * 2; y < cy * 2 + 2 && y < h; ++y) {
+          for (size_t x = cx * 2; x < cx * 2 + 2 && x < w; ++x) {
+            uint8_t const *const p = rgba + (y * w + x) * 4;
+            r += p[0];
+            g += p[1];
+            b += p[2];
+            ++n;
+          }
+        }
+        r /= n;
+        g /= n;
+        b /= n;
+        pu[cy * cw + cx] = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+        pv[cy * cw + cx] = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+      }
+    }
+    return;
+  }
+  uint8_t *const pu = py + w * h;
+  uint8_t *const pv = pu + w * h;
+  uint8_t *const pa = pv + w * h;
+  for (size_t i = 0; i < w * h; ++i) {
+    uint8_t const *const p = rgba + i * 4;
+    int const r = p[0], g = p[1], b = p[2];
+    pu[i] = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+    pv[i] = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+    if (s->chroma == stream_chroma_444alpha) {
+      pa[i] = p[3];
+    }
+  }
+}
+
+bool stream_open_input(struct stream *const s,
+                       void *const handle,
+                       enum stream_format const format,
+                       size_t const width,
+                       size_t const height,
+                       SR_CHAR_T error_msg[256]) {
+  if (s == NULL || handle == NULL || handle == INVALID_HANDLE_VALUE) {
+    set_error(error_msg, SR_TSTR("invalid parameter."));
+    return false;
+  }
+  *s = (struct stream){
+      .handle = handle,
+      .format = format,
+      .width = width,
+      .height = height,
+  };
+  if (format == stream_format_rgba) {
+    return true;
+  }
+  char line[1024];
+  size_t len = 0;
+  if (!read_line(s, line, sizeof(line), &len, error_msg)) {
+    return false;
+  }
+  if (len == 0) {
+    set_error(error_msg, SR_TSTR("input stream is empty."));
+    return false;
+  }
+  if (!parse_y4m_header(s, line, error_msg)) {
+    return false;
+  }
+  s->planes = malloc(plane_bytes(s));
+  if (s->planes == NULL) {
+    set_error(error_msg, SR_TSTR("failed to allocate memory."));
+    return false;
+  }
+  return true;
+}
+
+bool stream_open_output(struct stream *const s,
+                        void *const handle,
+                        struct stream const *const input,
+                        size_t const width,
+                        size_t const height,
+                        SR_CHAR_T error_msg[256]) {
+  if (s == NULL || handle == NULL || handle == INVALID_HANDLE_VALUE || input == NULL) {
+    set_error(error_msg, SR_TSTR("invalid parameter."));
+    return false;
+  }
+  *s = (struct stream){
+      .handle = handle,
+      .format = input->format,
+      .chroma = input->chroma,
+      .width = width,
+      .height = height,
+  };
+  if (s->format == stream_format_rgba) {
+    return true;
+  }
+  memcpy(s->params, input->params, sizeof(s->params));
+  memcpy(s->chroma_tag, input->chroma_tag, sizeof(s->chroma_tag));
+  s->planes = malloc(plane_bytes(s));
+  if (s->planes == NULL) {
+    set_error(error_msg, SR_TSTR("failed to allocate memory."));
+    return false;
+  }
+  char header[512];
+  int const len = snprintf(header, sizeof(header), "YUV4MPEG2 W%zu H%zu%s C%s\n", s->width, s->height, s->params, chroma_name(s));
+  if (len < 0 || (size_t)len >= sizeof(header) || !write_full(handle, header, (size_t)len)) {
+    set_win32_error(error_msg, SR_TSTR("failed to write y4m header"));
+    stream_close(s);
+    return false;
+  }
+  return true;
+}
+
+bool stream_read(struct stream *const s, uint8_t *const rgba, bool *const eof, SR_CHAR_T error_msg[256]) {
+  *eof = false;
+  size_t n = 0;
+  if (s->format == stream_format_rgba) {
+    size_t const len = s->width * s->height * 4;
+    if (!read_stream(s, rgba, len, &n)) {
+      set_win32_error(error_msg, SR_TSTR("failed to read stream"));
+      return false;
+    }
+    if (n == 0) {
+      *eof = true;
+      return true;
+    }
+    if (n != len) {
+      set_error(error_msg, SR_TSTR("stream ended in the middle of a frame."));
+      return false;
+    }
+    return true;
+  }
+
+  char line[1024];
+  size_t len = 0;
+  if (!read_line(s, line, sizeof(line), &len, error_msg)) {
+    return false;
+  }
+  if (len == 0) {
+    *eof = true;
+    return true;
+  }
+  if (strncmp(line, "FRAME", 5) != 0) {
+    set_error(error_msg, SR_TSTR("invalid y4m frame header."));
+    return false;
+  }
+  size_t const bytes = plane_bytes(s);
+  if (!read_stream(s, s->planes, bytes, &n)) {
+    set_win32_error(error_msg, SR_TSTR("failed to read stream"));
+    return false;
+  }
+  if (n != bytes) {
+    set_error(error_msg, SR_TSTR("stream ended in the middle of a frame."));
+    return false;
+  }
+  yuv_to_rgba(s, rgba);
+  return true;
+}
+
+bool stream_write(struct stream *const s, uint8_t const *const rgba, SR_CHAR_T error_msg[256]) {
+  if (s->format == stream_format_rgba) {
+    if (!write_full(s->handle, rgba, s->width * s->height * 4)) {
+      set_win32_error(error_msg, SR_TSTR("failed to write stream"));
+      return false;
+    }
+    return true;
+  }
+  static char const frame[] = "FRAME\n";
+  rgba_to_yuv(s, rgba);
+  if (!write_full(s->handle, frame, sizeof(frame) - 1) || !write_full(s->handle, s->planes, plane_bytes(s))) {
+    set_win32_error(error_msg, SR_TSTR("failed to write stream"));
+    return false;
+  }
+  return true;
+}
+
+void stream_close(struct stream *const s) {
+  if (s == NULL) {
+    return;
+  }
+  if (s->planes) {
+    free(s->planes);
+    s->planes = NULL;
+  }
+  s->handle = NULL;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "common.h"
+
+// Frame streams over a pipe or file handle, for use as an ffmpeg filter:
+//   ffmpeg -i in.mp4 -f rawvideo -pix_fmt rgba - | sr ... --input - --output - | ffmpeg -f rawvideo -pix_fmt rgba ...
+//   ffmpeg -i in.mp4 -f yuv4mpegpipe - | sr ... --input - --output - --stream-format y4m | ffmpeg -i - ...
+// Frames are always exchanged with the caller as RGBA8.
+enum stream_format {
+  stream_format_rgba,
+  stream_format_y4m,
+};
+
+enum stream_chroma {
+  stream_chroma_420,
+  stream_chroma_444,
+  stream_chroma_444alpha,
+};
+
+struct stream {
+  void *handle;
+  enum stream_format format;
+  enum stream_chroma chroma;
+  size_t width;
+  size_t height;
+  char params[256];    // y4m stream parameters other than W, H and C, passed through to the output
+  char chroma_tag[16]; // C parameter as given, so that the output keeps the chroma siting of the input
+  uint8_t *planes;     // y4m frame data
+  char buffer[4096];   // read ahead by y4m header lines, consumed before the handle is read again
+  size_t buffer_pos;
+  size_t buffer_len;
+};
+
+// width and height are only used for raw RGBA streams, y4m streams take them from the stream header.
+bool stream_open_input(struct stream *const s,
+                       void *const handle,
+                       enum stream_format const format,
+                       size_t const width,
+                       size_t const height,
+                       SR_CHAR_T error_msg[256]);
+// The output has the format and parameters of input at width x height.
+bool stream_open_output(struct stream *const s,
+                        void *const handle,
+                        struct stream const *const input,
+                        size_t const width,
+                        size_t const height,
+                        SR_CHAR_T error_msg[256]);
+// eof is set when the stream ended cleanly before the frame.
+bool stream_read(struct stream *const s, uint8_t *const rgba, bool *const eof, SR_CHAR_T error_msg[256]);
+bool stream_write(struct stream *const s, uint8_t const *const rgba, SR_CHAR_T error_msg[256]);
+// The handle is owned by the caller and is not closed.
+void stream_close(struct stream *const s);
@@ -0,0 +1,296 @@
+#include "tile_cache.h"
+
+#include <ovprintf.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+enum {
+  no_entry = 0,
+};
+
+struct entry {
+  struct hash key;
+  size_t prev; // 1-based, 0 means none
+  size_t next; // 1-based, 0 means none
+  bool valid;
+  bool dirty; // saved but not written to the directory yet
+};
+
+struct tile_cache {
+  size_t capacity;
+  size_t tile_bytes;
+  size_t used;
+  size_t head; // most recently used, 1-based
+  size_t tail; // least recently used, 1-based
+  size_t dirty; // number of entries waiting for tile_cache_flush
+  size_t table_mask;
+  size_t *table; // open addressing with linear probing, holds 1-based entry indices
+  struct entry *entries;
+  uint8_t *tiles;
+  SR_CHAR_T *directory;
+};
+
+struct tile_cache *tile_cache_create(size_t const capacity, size_t const tile_bytes, SR_CHAR_T const *const directory) {
+  struct tile_cache *cache = NULL;
+  if (capacity == 0 || tile_bytes == 0 || capacity > SIZE_MAX / tile_bytes) {
+    return NULL;
+  }
+  cache = malloc(sizeof(struct tile_cache));
+  if (cache == NULL) {
+    goto failed;
+  }
+  memset(cache, 0, sizeof(struct tile_cache));
+  cache->capacity = capacity;
+  cache->tile_bytes = tile_bytes;
+
+  size_t table_size = 16;
+  while (table_size < capacity * 2) {
+    table_size *= 2;
+  }
+  cache->table_mask = table_size - 1;
+  cache->table = calloc(table_size, sizeof(size_t));
+  cache->entries = calloc(capacity, sizeof(struct entry));
+  cache->tiles = malloc(capacity * tile_bytes);
+  if (cache->table == NULL || cache->entries == NULL || cache->tiles == NULL) {
+    goto failed;
+  }
+  if (directory != NULL && directory[0] != SR_TSTR('\0')) {
+    size_t const len = SR_STRLEN(directory);
+    cache->directory = malloc((len + 1) * sizeof(SR_CHAR_T));
+    if (cache->directory == NULL) {
+      goto failed;
+    }
+    memcpy(cache->directory, directory, (len + 1) * sizeof(SR_CHAR_T));
+  }
+  return cache;
+
+failed:
+  tile_cache_destroy(cache);
+  return NULL;
+}
+
+void tile_cache_destroy(struct tile_cache *const cache) {
+  if (cache == NULL) {
+    return;
+  }
+  if (cache->entries && cache->tiles) {
+    tile_cache_flush(cache);
+  }
+  if (cache->directory) {
+    free(cache->directory);
+  }
+  if (cache->tiles) {
+    free(cache->tiles);
+  }
+  if (cache->entries) {
+    free(cache->entries);
+  }
+  if (cache->table) {
+    free(cache->table);
+  }
+  free(cache);
+}
+
+size_t tile_cache_get_tile_bytes(struct tile_cache const *const cache) { return cache ? cache->tile_bytes : 0; }
+
+static inline struct entry *get_entry(struct tile_cache *const cache, size_t const idx) { return &cache->entries[idx - 1]; }
+
+static inline uint8_t *get_tile(struct tile_cache *const cache, size_t const idx) {
+  return cache->tiles + (idx - 1) * cache->tile_bytes;
+}
+
+static size_t *find_slot(struct tile_cache *const cache, struct hash const *const key) {
+  size_t pos = (size_t)key->v[0] & cache->table_mask;
+  for (;;) {
+    size_t *const slot = &cache->table[pos];
+    if (*slot == no_entry || hash_equal(&get_entry(cache, *slot)->key, key)) {
+      return slot;
+    }
+    pos = (pos + 1) & cache->table_mask;
+  }
+}
+
+static void table_remove(struct tile_cache *const cache, size_t *const slot) {
+  // backward shift deletion keeps probe sequences intact without tombstones
+  size_t hole = (size_t)(slot - cache->table);
+  size_t pos = hole;
+  for (;;) {
+    pos = (pos + 1) & cache->table_mask;
+    size_t const idx = cache->table[pos];
+    if (idx == no_entry) {
+      break;
+    }
+    size_t const home = (size_t)get_entry(cache, idx)->key.v[0] & cache->table_mask;
+    if (((pos - home) & cache->table_mask) >= ((pos - hole) & cache->table_mask)) {
+      cache->table[hole] = idx;
+      hole = pos;
+    }
+  }
+  cache->table[hole] = no_entry;
+}
+
+static void lru_unlink(struct tile_cache *const cache, size_t const idx) {
+  struct entry *const e = get_entry(cache, idx);
+  if (e->prev != no_entry) {
+    get_entry(cache, e->prev)->next = e->next;
+  } else {
+    cache->head = e->next;
+  }
+  if (e->next != no_entry) {
+    get_entry(cache, e->next)->prev = e->prev;
+  } else {
+    cache->tail = e->prev;
+  }
+  e->prev = no_entry;
+  e->next = no_entry;
+}
+
+static void lru_push_front(struct tile_cache *const cache, size_t const idx) {
+  struct entry *const e = get_entry(cache, idx);
+  e->prev = no_entry;
+  e->next = cache->head;
+  if (cache->head != no_entry) {
+    get_entry(cache, cache->head)->prev = idx;
+  }
+  cache->head = idx;
+  if (cache->tail == no_entry) {
+    cache->tail = idx;
+  }
+}
+
+static void lru_push_back(struct tile_cache *const cache, size_t const idx) {
+  struct entry *const e = get_entry(cache, idx);
+  e->next = no_entry;
+  e->prev = cache->tail;
+  if (cache->tail != no_entry) {
+    get_entry(cache, cache->tail)->next = idx;
+  }
+  cache->tail = idx;
+  if (cache->head == no_entry) {
+    cache->head = idx;
+  }
+}
+
+// Removes the entry for key from the lookup table and makes it the next eviction victim.
+static void discard(struct tile_cache *const cache, struct hash const *const key) {
+  size_t *const slot = find_slot(cache, key);
+  size_t const idx = *slot;
+  if (idx == no_entry) {
+    return;
+  }
+  table_remove(cache, slot);
+  lru_unlink(cache, idx);
+  lru_push_back(cache, idx);
+  get_entry(cache, idx)->valid = false;
+}
+
+static void build_path(struct tile_cache const *const cache, struct hash const *const key, SR_CHAR_T path[1024]) {
+  ov_snprintf(path,
+              1024,
+              NULL,
+              SR_TSTR("%ls/%016llx%016llx.rgba"),
+              cache->directory,
+              (unsigned long long)key->v[0],
+              (unsigned long long)key->v[1]);
+}
+
+static bool load_from_disk(struct tile_cache const *const cache, struct hash const *const key, uint8_t *const tile) {
+  SR_CHAR_T path[1024];
+  build_path(cache, key, path);
+#ifdef _WIN32
+  FILE *f = _wfopen(path, L"rb");
+#else
+  FILE *f = fopen(path, "rb");
+#endif
+  if (!f) {
+    return false;
+  }
+  bool const r = fread(tile, 1, cache->tile_bytes, f) == cache->tile_bytes;
+  fclose(f);
+  return r;
+}
+
+static void write_to_disk(struct tile_cache *const cache, size_t const idx) {
+  struct entry *const e = get_entry(cache, idx);
+  if (!e->dirty) {
+    return;
+  }
+  e->dirty = false;
+  --cache->dirty;
+  SR_CHAR_T path[1024];
+  build_path(cache, &e->key, path);
+#ifdef _WIN32
+  FILE *f = _wfopen(path, L"wb");
+#else
+  FILE *f = fopen(path, "wb");
+#endif
+  if (!f) {
+    return;
+  }
+  fwrite(get_tile(cache, idx), 1, cache->tile_bytes, f);
+  fclose(f);
+}
+
+uint8_t *tile_cache_insert(struct tile_cache *const cache, struct hash const *const key) {
+  size_t *slot = find_slot(cache, key);
+  size_t idx = *slot;
+  if (idx != no_entry) {
+    lru_unlink(cache, idx);
+    lru_push_front(cache, idx);
+    return get_tile(cache, idx);
+  }
+  if (cache->used < cache->capacity) {
+    idx = ++cache->used;
+  } else {
+    idx = cache->tail;
+    write_to_disk(cache, idx);
+    lru_unlink(cache, idx);
+    if (get_entry(cache, idx)->valid) {
+      table_remove(cache, find_slot(cache, &get_entry(cache, idx)->key));
+      slot = find_slot(cache, key);
+    }
+  }
+  get_entry(cache, idx)->key = *key;
+  get_entry(cache, idx)->valid = true;
+  *slot = idx;
+  lru_push_front(cache, idx);
+  return get_tile(cache, idx);
+}
+
+uint8_t const *tile_cache_find(struct tile_cache *const cache, struct hash const *const key) {
+  size_t const idx = *find_slot(cache, key);
+  if (idx != no_entry) {
+    lru_unlink(cache, idx);
+    lru_push_front(cache, idx);
+    return get_tile(cache, idx);
+  }
+  if (cache->directory == NULL) {
+    return NULL;
+  }
+  uint8_t *const tile = tile_cache_insert(cache, key);
+  if (!load_from_disk(cache, key, tile)) {
+    // a missing or truncated file must never turn into a hit
+    discard(cache, key);
+    return NULL;
+  }
+  return tile;
+}
+
+void tile_cache_save(struct tile_cache *const cache, struct hash const *const key) {
+  if (cache->directory == NULL) {
+    return;
+  }
+  size_t const idx = *find_slot(cache, key);
+  if (idx == no_entry || get_entry(cache, idx)->dirty) {
+    return;
+  }
+  get_entry(cache, idx)->dirty = true;
+  ++cache->dirty;
+}
+
+void tile_cache_flush(struct tile_cache *const cache) {
+  for (size_t idx = 1; cache->dirty && idx <= cache->used; ++idx) {
+    write_to_disk(cache, idx);
+  }
+}
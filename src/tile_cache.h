@@ -0,0 +1,25 @@
+#pragma once
+
+#include "common.h"
+#include "hash.h"
+
+// Content-addressed store for post-processed RGBA tiles.
+// Tiles are kept in memory in LRU order and, when a directory is given, also persisted as raw files.
+struct tile_cache;
+
+struct tile_cache *tile_cache_create(size_t const capacity, size_t const tile_bytes, SR_CHAR_T const *const directory);
+void tile_cache_destroy(struct tile_cache *const cache);
+size_t tile_cache_get_tile_bytes(struct tile_cache const *const cache);
+
+// Returns the cached tile or NULL.
+// A hit becomes the most recently used entry, so it survives at least capacity - 1 subsequent insertions.
+uint8_t const *tile_cache_find(struct tile_cache *const cache, struct hash const *const key);
+
+// Returns a buffer of tile_bytes for key, evicting the least recently used entry if necessary.
+// The caller fills the buffer and then calls tile_cache_save to persist it.
+uint8_t *tile_cache_insert(struct tile_cache *const cache, struct hash const *const key);
+// Marks the filled tile of key for the directory. Files are written in batches by tile_cache_flush, or when the
+// entry is evicted first, so that disk writes stay out of the per-tile path.
+void tile_cache_save(struct tile_cache *const cache, struct hash const *const key);
+// Writes all tiles marked by tile_cache_save; tile_cache_destroy flushes too.
+void tile_cache_flush(struct tile_cache *const cache);